@@ -0,0 +1,389 @@
+/* chashtable.c
+**
+** A hashtable for concurrent use, see chashtable.h.
+**
+** The buckets are chains of nodes, each with the key inline. All links are
+** atomic pointers. A writer fills in a new node before it's linked in with
+** a release store, so a reader that finds it also sees its contents. A
+** node is unlinked with a single store as well, so readers always see
+** either the old or the new chain, and it's retired instead of freed.
+**
+** The key (with its hash value and length) of a node never changes, only
+** the value does. On grow, readers may still be walking the old chains, so
+** the nodes are copied into the new bucket array, rather than moved.
+**
+** The stripe of a key is the top bits of its mixed hash value, and the
+** bucket the top bits too, but more of them. Since there are always at
+** least as many buckets as stripes, all keys of a bucket are in the same
+** stripe, and the stripe lock protects the bucket.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "chashtable.h"
+#include "epoch.h"
+
+#define CH_STRIPES_LOG2 8
+#define CH_STRIPES (1 << CH_STRIPES_LOG2) /* Writer locks */
+#define CH_MIN_LOG2 10		/* At least 4 buckets per stripe */
+#define CH_LINE 64		/* Cache line size */
+#define CH_RECLAIM 128		/* Retired objects to collect before freeing */
+
+/* 2^64 / the golden ratio, as in hashtable.c */
+#define FIB_MULT UINT64_C(0x9E3779B97F4A7C15)
+
+typedef struct cnode_s
+{
+  struct cnode_s *_Atomic next;
+  void *_Atomic value;
+  hashval_t hash;
+  size_t len;
+  char key[];			/* Nul terminated */
+} cnode_t;
+
+typedef struct cbuckets_s
+{
+  unsigned log2;		/* The size is 2^log2 */
+  size_t maxcount;		/* Grow when there are more keys */
+  size_t stripemax;		/* Check maxcount when a stripe has more */
+  cnode_t *_Atomic b[];
+} cbuckets_t;
+
+/* Each stripe on its own cache line */
+typedef union stripe_u
+{
+  struct
+  {
+    pthread_mutex_t lock;
+    atomic_size_t count;	/* The number of keys in the stripe */
+  };
+  char line[CH_LINE];
+} stripe_t;
+
+struct chashtable_s
+{
+  cbuckets_t *_Atomic buckets;
+  float maxload;
+  hashfunc_t *hfun;
+  hashdestfunc_t *dfun;
+  epoch_t epoch;
+  stripe_t stripes[CH_STRIPES];
+};
+
+#define ch_mix(HV)           ((HV) * FIB_MULT)
+#define ch_stripe(H, MIX)    ((H)->stripes + ((MIX) >> (64 - CH_STRIPES_LOG2)))
+#define ch_bucket(BP, MIX)   ((BP)->b + ((MIX) >> (64 - (BP)->log2)))
+
+static hashval_t
+ch_hash(chashtable_t h, const char *key, size_t len)
+{
+  return (h->hfun ? h->hfun(key) : hash_mem_fast(key, len));
+}
+
+static bool
+node_match(cnode_t *np, const char *key, size_t len, hashval_t hv)
+{
+  return (np->hash == hv && np->len == len &&
+          memcmp(np->key, key, len) == 0);
+}
+
+static cnode_t *
+node_new(const char *key, size_t len, hashval_t hv, void *val)
+{
+  cnode_t *np = malloc(sizeof(cnode_t) + len + 1);
+
+  if (np)
+  {
+    atomic_init(&np->next, NULL);
+    atomic_init(&np->value, val);
+    np->hash = hv;
+    np->len = len;
+    memcpy(np->key, key, len);
+    np->key[len] = '\0';
+  }
+  return np;
+}
+
+static cbuckets_t *
+buckets_new(unsigned log2, float maxload)
+{
+  size_t size = (size_t)1 << log2;
+  cbuckets_t *bp = malloc(sizeof(cbuckets_t) + size * sizeof(cnode_t *));
+
+  if (bp)
+  {
+    bp->log2 = log2;
+    bp->maxcount = (size_t)(size * maxload);
+    bp->stripemax = bp->maxcount / CH_STRIPES;
+    for (size_t i = 0 ; i < size ; i++)
+      atomic_init(bp->b + i, NULL);
+  }
+  return bp;
+}
+
+/* Frees the bucket array and all its nodes, but not the values */
+static void
+buckets_free(void *p)
+{
+  cbuckets_t *bp = p;
+  size_t size = (size_t)1 << bp->log2;
+
+  for (size_t i = 0 ; i < size ; i++)
+  {
+    cnode_t *np = atomic_load_explicit(bp->b + i, memory_order_relaxed);
+
+    while (np)
+    {
+      cnode_t *next = atomic_load_explicit(&np->next, memory_order_relaxed);
+
+      free(np);
+      np = next;
+    }
+  }
+  free(bp);
+}
+
+chashtable_t
+chashtable_create(size_t initsize, float maxload,
+                  hashfunc_t *hfun,
+                  hashdestfunc_t *dfun)
+{
+  chashtable_t h = malloc(sizeof(struct chashtable_s));
+  unsigned log2 = CH_MIN_LOG2;
+  int i;
+
+  if (h == NULL)
+    return NULL;
+  while (((size_t)1 << log2) < initsize && log2 < 8 * sizeof(size_t) - 2)
+    log2 += 1;
+  if (maxload < 0.5 || 1.0 <= maxload)
+    maxload = 0.8;
+  h->maxload = maxload;
+  h->hfun = hfun;
+  h->dfun = dfun;
+  h->epoch = epoch_create();
+  if (h->epoch == NULL)
+  {
+    free(h);
+    return NULL;
+  }
+  atomic_init(&h->buckets, buckets_new(log2, maxload));
+  if (atomic_load(&h->buckets) == NULL)
+  {
+    epoch_destroy(h->epoch);
+    free(h);
+    return NULL;
+  }
+  for (i = 0 ; i < CH_STRIPES ; i++)
+  {
+    if (pthread_mutex_init(&h->stripes[i].lock, NULL) != 0)
+    {
+      while (i--)
+        pthread_mutex_destroy(&h->stripes[i].lock);
+      buckets_free(atomic_load(&h->buckets));
+      epoch_destroy(h->epoch);
+      free(h);
+      return NULL;
+    }
+    atomic_init(&h->stripes[i].count, 0);
+  }
+  return h;
+}
+
+void
+chashtable_destroy(chashtable_t h)
+{
+  cbuckets_t *bp = atomic_load(&h->buckets);
+
+  if (h->dfun)
+  {
+    size_t size = (size_t)1 << bp->log2;
+
+    for (size_t i = 0 ; i < size ; i++)
+      for (cnode_t *np = atomic_load(bp->b + i) ;
+           np ;
+           np = atomic_load(&np->next))
+        h->dfun (atomic_load(&np->value));
+  }
+  buckets_free(bp);
+  epoch_destroy(h->epoch);
+  for (int i = 0 ; i < CH_STRIPES ; i++)
+    pthread_mutex_destroy(&h->stripes[i].lock);
+  free(h);
+}
+
+size_t
+chashtable_count(chashtable_t h)
+{
+  size_t count = 0;
+
+  for (int i = 0 ; i < CH_STRIPES ; i++)
+    count += atomic_load_explicit(&h->stripes[i].count, memory_order_relaxed);
+  return count;
+}
+
+/* Doubles the size, unless someone else already grew the table from size
+** 2^'log2'. All the stripes are locked, so nothing changes meanwhile,
+** but readers keep using the old buckets until the new ones are in place.
+** If out of memory, the table simply doesn't grow this time.
+*/
+static void
+ch_grow(chashtable_t h, unsigned log2)
+{
+  cbuckets_t *bp, *nbp;
+  size_t size, i;
+
+  for (i = 0 ; i < CH_STRIPES ; i++)
+    pthread_mutex_lock(&h->stripes[i].lock);
+  bp = atomic_load_explicit(&h->buckets, memory_order_relaxed);
+  size = (size_t)1 << bp->log2;
+  if (bp->log2 == log2 && (nbp = buckets_new(log2 + 1, h->maxload)) != NULL)
+  {
+    for (i = 0 ; i < size ; i++)
+    {
+      cnode_t *np = atomic_load_explicit(bp->b + i, memory_order_relaxed);
+
+      for ( ; np ; np = atomic_load_explicit(&np->next, memory_order_relaxed))
+      {
+        cnode_t *cp = node_new(np->key, np->len, np->hash,
+                               atomic_load_explicit(&np->value,
+                                                    memory_order_relaxed));
+        cnode_t *_Atomic *headp;
+
+        if (cp == NULL)
+          break;
+        headp = ch_bucket(nbp, ch_mix(cp->hash));
+        atomic_init(&cp->next, atomic_load_explicit(headp,
+                                                    memory_order_relaxed));
+        atomic_init(headp, cp);
+      }
+      if (np)
+        break;			/* Out of memory */
+    }
+    if (i < size)
+      buckets_free(nbp);
+    else
+    {
+      atomic_store_explicit(&h->buckets, nbp, memory_order_release);
+      epoch_retire(h->epoch, bp, buckets_free);
+    }
+  }
+  for (i = CH_STRIPES ; i-- > 0 ; )
+    pthread_mutex_unlock(&h->stripes[i].lock);
+  epoch_reclaim(h->epoch, CH_RECLAIM);
+}
+
+hashtable_ret_t
+chashtable_put(chashtable_t h, const char *key, void *val, void **oldvalp)
+{
+  size_t len = strlen(key);
+  hashval_t hv = ch_hash(h, key, len);
+  uint64_t mix = ch_mix(hv);
+  stripe_t *sp = ch_stripe(h, mix);
+  cnode_t *_Atomic *headp;
+  cnode_t *np;
+  cbuckets_t *bp;
+  size_t count, maxcount;
+  unsigned log2;
+
+  pthread_mutex_lock(&sp->lock);
+  bp = atomic_load_explicit(&h->buckets, memory_order_relaxed);
+  headp = ch_bucket(bp, mix);
+  for (np = atomic_load_explicit(headp, memory_order_relaxed) ;
+       np ;
+       np = atomic_load_explicit(&np->next, memory_order_relaxed))
+    if (node_match(np, key, len, hv))
+    {
+      void *old = atomic_exchange_explicit(&np->value, val,
+                                           memory_order_acq_rel);
+
+      pthread_mutex_unlock(&sp->lock);
+      if (oldvalp)
+        *oldvalp = old;
+      else if (h->dfun)
+      {
+        epoch_retire(h->epoch, old, h->dfun);
+        epoch_reclaim(h->epoch, CH_RECLAIM);
+      }
+      return hashtable_ret_replaced;
+    }
+  np = node_new(key, len, hv, val);
+  if (np == NULL)
+  {
+    pthread_mutex_unlock(&sp->lock);
+    return hashtable_ret_error;
+  }
+  atomic_init(&np->next, atomic_load_explicit(headp, memory_order_relaxed));
+  atomic_store_explicit(headp, np, memory_order_release);
+  count = atomic_load_explicit(&sp->count, memory_order_relaxed) + 1;
+  atomic_store_explicit(&sp->count, count, memory_order_relaxed);
+  log2 = bp->log2;
+  maxcount = bp->maxcount;
+  count = (count > bp->stripemax ? chashtable_count(h) : 0);
+  pthread_mutex_unlock(&sp->lock);
+  if (count > maxcount)
+    ch_grow(h, log2);
+  return hashtable_ret_ok;
+}
+
+hashtable_ret_t
+chashtable_get(chashtable_t h, const char *key, void **valuep)
+{
+  size_t len = strlen(key);
+  hashval_t hv = ch_hash(h, key, len);
+  uint64_t mix = ch_mix(hv);
+  unsigned ticket = epoch_enter(h->epoch);
+  cbuckets_t *bp = atomic_load_explicit(&h->buckets, memory_order_acquire);
+  cnode_t *np = atomic_load_explicit(ch_bucket(bp, mix), memory_order_acquire);
+
+  while (np && !node_match(np, key, len, hv))
+    np = atomic_load_explicit(&np->next, memory_order_acquire);
+  if (np && valuep)
+    *valuep = atomic_load_explicit(&np->value, memory_order_acquire);
+  epoch_exit(h->epoch, ticket);
+  return (np ? hashtable_ret_ok : hashtable_ret_not_found);
+}
+
+hashtable_ret_t
+chashtable_rem(chashtable_t h, const char *key, void **valuep)
+{
+  size_t len = strlen(key);
+  hashval_t hv = ch_hash(h, key, len);
+  uint64_t mix = ch_mix(hv);
+  stripe_t *sp = ch_stripe(h, mix);
+  cnode_t *_Atomic *linkp;
+  cnode_t *np;
+  void *val;
+
+  pthread_mutex_lock(&sp->lock);
+  linkp = ch_bucket(atomic_load_explicit(&h->buckets, memory_order_relaxed),
+                    mix);
+  while ((np = atomic_load_explicit(linkp, memory_order_relaxed)) != NULL &&
+         !node_match(np, key, len, hv))
+    linkp = &np->next;
+  if (np == NULL)
+  {
+    pthread_mutex_unlock(&sp->lock);
+    return hashtable_ret_not_found;
+  }
+  atomic_store_explicit(linkp,
+                        atomic_load_explicit(&np->next, memory_order_relaxed),
+                        memory_order_release);
+  atomic_store_explicit(&sp->count,
+                        atomic_load_explicit(&sp->count,
+                                             memory_order_relaxed) - 1,
+                        memory_order_relaxed);
+  val = atomic_load_explicit(&np->value, memory_order_relaxed);
+  pthread_mutex_unlock(&sp->lock);
+  epoch_retire(h->epoch, np, free);
+  if (valuep)
+    *valuep = val;
+  else if (h->dfun)
+    epoch_retire(h->epoch, val, h->dfun);
+  epoch_reclaim(h->epoch, CH_RECLAIM);
+  return hashtable_ret_ok;
+}
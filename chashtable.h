@@ -0,0 +1,79 @@
+/* chashtable.h
+**
+** A hashtable for concurrent use by many threads.
+**
+** Lookups never take a lock. The only thing they write to is the reader
+** counter of the calling thread (see epoch.h), which has a cache line of
+** its own, shared with other threads only when there are more than 64 of
+** them, so lookups scale with the number of cores. Puts and removes lock
+** one of a number of stripes, each covering a part of the buckets, so
+** writers only wait for each other when they happen to use the same
+** stripe. A grow locks all the stripes, and builds a new bucket array
+** beside the old one, which readers keep using until the new one is in
+** place.
+**
+** Removed keys, and replaced or removed values (when there's a destructor
+** function), are freed only when no lookup can see them anymore, using
+** epoch based reclamation (see epoch.h).
+**
+** Keys are nul terminated strings, the hash functions are the same as for
+** hashtable_t, and the table never shrinks.
+*/
+
+#pragma once
+
+#include "hashtable.h"
+
+typedef struct chashtable_s *chashtable_t;
+
+/* Create a concurrent hashtable. The 'initsize' is the initial size of the
+** table, which is always a power of two, at least 256.
+** When the load reaches 'maxload' (default 0.8), the table doubles in size.
+** 'hfun' is the string hash function to use (default is hash_string_fast).
+** 'dfun' is the optional destructor function for value data.
+** Returns NULL if out of memory.
+*/
+extern chashtable_t
+chashtable_create(size_t initsize, float maxload,
+                  hashfunc_t *hfun,
+                  hashdestfunc_t *dfun);
+
+/* Destroys a table, calling the destructor for each value, if there is one.
+** No other thread may use the table anymore.
+*/
+extern void
+chashtable_destroy(chashtable_t h);
+
+/* Puts the key-value pair into the table, like hashtable_put().
+** If the key existed and 'oldvalp' is NULL, the old value is destroyed
+** (later, when no lookup can see it anymore) if there's a destructor.
+** Returns hashtable_ret_error if out of memory.
+** Returns hashtable_ret_ok on success, and if key didn't exist.
+** Returns hashtable_ret_replaced on success, and if key was replaced.
+*/
+extern hashtable_ret_t
+chashtable_put(chashtable_t h, const char *key, void *val, void **oldvalp);
+
+/* Looks up the value for 'key' in the table, without locking.
+** '*valuep' is updated unless 'valuep' is NULL.
+** Note that if another thread replaces or removes the key at the same
+** time, the value might be destroyed any time after this returns. It's up
+** to the caller to prevent that, if it matters.
+** Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if found, and '*valuep' updated to value.
+*/
+extern hashtable_ret_t
+chashtable_get(chashtable_t h, const char *key, void **valuep);
+
+/* Removes the 'key' from the table, like hashtable_rem().
+** Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if removed
+*/
+extern hashtable_ret_t
+chashtable_rem(chashtable_t h, const char *key, void **valuep);
+
+/* Returns the number of keys in the table. While other threads are
+** changing the table, it's only approximate.
+*/
+extern size_t
+chashtable_count(chashtable_t h);
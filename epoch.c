@@ -0,0 +1,206 @@
+/* epoch.c
+**
+** Epoch based reclamation, see epoch.h.
+**
+** There's a global epoch counter, and two sets of reader counters, one for
+** even and one for odd epochs. A reader increments a counter for the parity
+** of the current epoch. Reclaiming takes the list of retired objects,
+** advances the epoch, and waits for the counters of the previous parity
+** to drop to zero. After that, no reader can still see any object in the
+** list, since they were all unlinked before the epoch advanced.
+**
+** Each parity has a number of counters on separate cache lines, and each
+** thread uses one of them, so that readers on different cores don't write
+** to the same cache line.
+*/
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "epoch.h"
+
+#define EPOCH_SLOTS 64		/* Reader counters per parity */
+#define EPOCH_LINE  64		/* Cache line size */
+
+typedef struct slot_s
+{
+  atomic_size_t n;
+  char pad[EPOCH_LINE - sizeof(atomic_size_t)];
+} slot_t;
+
+typedef struct retired_s
+{
+  struct retired_s *next;
+  void *p;
+  epoch_freefunc_t *ffun;
+} retired_t;
+
+struct epoch_s
+{
+  slot_t readers[2][EPOCH_SLOTS];
+  atomic_uint epoch;
+  pthread_mutex_t lock;		/* For the retired list */
+  pthread_mutex_t sync;		/* Only one reclaim at a time */
+  retired_t *retired;
+  size_t nretired;
+};
+
+static atomic_uint Next_slot;
+static _Thread_local unsigned My_slot = EPOCH_SLOTS;
+
+/* The reader counter slot of the calling thread */
+static unsigned
+thread_slot(void)
+{
+  if (My_slot == EPOCH_SLOTS)
+    My_slot = atomic_fetch_add_explicit(&Next_slot, 1,
+                                        memory_order_relaxed) % EPOCH_SLOTS;
+  return My_slot;
+}
+
+epoch_t
+epoch_create(void)
+{
+  epoch_t e = malloc(sizeof(struct epoch_s));
+
+  if (e)
+  {
+    for (int p = 0 ; p < 2 ; p++)
+      for (int s = 0 ; s < EPOCH_SLOTS ; s++)
+        atomic_init(&e->readers[p][s].n, 0);
+    atomic_init(&e->epoch, 0);
+    if (pthread_mutex_init(&e->lock, NULL) != 0)
+    {
+      free(e);
+      return NULL;
+    }
+    if (pthread_mutex_init(&e->sync, NULL) != 0)
+    {
+      pthread_mutex_destroy(&e->lock);
+      free(e);
+      return NULL;
+    }
+    e->retired = NULL;
+    e->nretired = 0;
+  }
+  return e;
+}
+
+static void
+free_list(retired_t *rp)
+{
+  while (rp)
+  {
+    retired_t *next = rp->next;
+
+    rp->ffun (rp->p);
+    free(rp);
+    rp = next;
+  }
+}
+
+void
+epoch_destroy(epoch_t e)
+{
+  free_list(e->retired);
+  pthread_mutex_destroy(&e->lock);
+  pthread_mutex_destroy(&e->sync);
+  free(e);
+}
+
+unsigned
+epoch_enter(epoch_t e)
+{
+  unsigned s = thread_slot();
+
+  for (;;)
+  {
+    unsigned p = atomic_load(&e->epoch) & 1;
+
+    atomic_fetch_add(&e->readers[p][s].n, 1);
+    /* If the epoch advanced in between, a reclaim might already be
+    ** past our counter, so try again with the new one.
+    */
+    if ((atomic_load(&e->epoch) & 1) == p)
+      return p * EPOCH_SLOTS + s;
+    atomic_fetch_sub(&e->readers[p][s].n, 1);
+  }
+}
+
+void
+epoch_exit(epoch_t e, unsigned ticket)
+{
+  atomic_fetch_sub_explicit(&e->readers[ticket / EPOCH_SLOTS]
+                            [ticket % EPOCH_SLOTS].n,
+                            1, memory_order_release);
+}
+
+/* Advances the epoch, and waits for the readers of the previous one.
+** Must be called with 'sync' locked.
+*/
+static void
+synchronize(epoch_t e)
+{
+  unsigned p = atomic_fetch_add(&e->epoch, 1) & 1;
+
+  for (int s = 0 ; s < EPOCH_SLOTS ; s++)
+    while (atomic_load(&e->readers[p][s].n) != 0)
+      sched_yield();
+}
+
+void
+epoch_retire(epoch_t e, void *p, epoch_freefunc_t *ffun)
+{
+  retired_t *rp = malloc(sizeof(retired_t));
+
+  if (rp == NULL)
+  {				/* Out of memory, free it right away */
+    pthread_mutex_lock(&e->sync);
+    synchronize(e);
+    pthread_mutex_unlock(&e->sync);
+    ffun (p);
+    return;
+  }
+  rp->p = p;
+  rp->ffun = ffun;
+  pthread_mutex_lock(&e->lock);
+  rp->next = e->retired;
+  e->retired = rp;
+  e->nretired += 1;
+  pthread_mutex_unlock(&e->lock);
+}
+
+size_t
+epoch_reclaim(epoch_t e, size_t min)
+{
+  retired_t *list;
+  size_t n;
+
+  if (min > 0)
+  {				/* Quick check, without waiting for 'sync' */
+    pthread_mutex_lock(&e->lock);
+    n = e->nretired;
+    pthread_mutex_unlock(&e->lock);
+    if (n < min)
+      return 0;
+  }
+  pthread_mutex_lock(&e->sync);
+  pthread_mutex_lock(&e->lock);	/* Take what's there now */
+  n = e->nretired;
+  if (n < min)
+  {				/* Not enough, or someone else took them */
+    pthread_mutex_unlock(&e->lock);
+    pthread_mutex_unlock(&e->sync);
+    return 0;
+  }
+  list = e->retired;
+  e->retired = NULL;
+  e->nretired = 0;
+  pthread_mutex_unlock(&e->lock);
+  synchronize(e);
+  pthread_mutex_unlock(&e->sync);
+  free_list(list);
+  return n;
+}
@@ -0,0 +1,56 @@
+/* epoch.h
+**
+** Epoch based reclamation, for data structures with lock-free readers.
+**
+** Readers bracket their accesses with epoch_enter() and epoch_exit(), which
+** never block. A writer that unlinks an object, so that no new reader can
+** find it, hands it to epoch_retire() instead of freeing it. It's freed
+** later by epoch_reclaim(), when all readers that might still see it have
+** left.
+**
+** Don't retire or reclaim while inside epoch_enter()/epoch_exit() in the
+** same thread, epoch_reclaim() would wait for itself.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct epoch_s *epoch_t;
+
+/* The type of the function that frees a retired object */
+typedef void
+epoch_freefunc_t(void *);
+
+/* Creates an epoch object, or returns NULL if out of memory */
+extern epoch_t
+epoch_create(void);
+
+/* Frees all retired objects at once, and then the epoch object itself.
+** There must be no readers left.
+*/
+extern void
+epoch_destroy(epoch_t e);
+
+/* Enters a read side section. The returned ticket is given to epoch_exit()
+** when leaving. Sections may be nested, and they don't block.
+*/
+extern unsigned
+epoch_enter(epoch_t e);
+
+extern void
+epoch_exit(epoch_t e, unsigned ticket);
+
+/* Hands the unlinked object 'p' over, to be freed by 'ffun' when all
+** readers that entered before now have left.
+*/
+extern void
+epoch_retire(epoch_t e, void *p, epoch_freefunc_t *ffun);
+
+/* If at least 'min' objects are retired, waits for the readers that
+** entered before now to leave, and frees them. With 'min' 0, it always
+** waits, which is the same as synchronize_rcu().
+** Returns the number of objects freed.
+*/
+extern size_t
+epoch_reclaim(epoch_t e, size_t min);
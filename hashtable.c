@@ -7,89 +7,186 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "hashtable.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifndef USE_MACROS
 #define USE_MACROS 1
 #endif
 
+#ifndef HASHTABLE_STATS
+#define HASHTABLE_STATS 1	/* Keep the counters for hashtable_stats() */
+#endif
+
 #define SWAP(A, B, TMP) ((TMP) = (A), (A) = (B), (B) = (TMP))
 
+#if defined(__GNUC__)
+#define PREFETCH(P) __builtin_prefetch(P)
+#else
+#define PREFETCH(P) ((void)0)
+#endif
+
+/*
+** Arena allocation, for tables created with HASHTABLE_ARENA. Long keys
+** are bump allocated from large chunks, and chain nodes are taken from
+** slabs through a free list. The chunks and slabs are only freed all at
+** once, when the table is cleared or destroyed.
+*/
+
+#define ARENA_CHUNK 65536	/* Bytes of key strings per chunk */
+#define ARENA_SLAB  256		/* Chain nodes per slab */
+
+typedef struct chunk_s
+{
+  struct chunk_s *next;
+  char mem[];
+} chunk_t;
+
+typedef struct arena_s
+{
+  chunk_t *chunks;
+  char *pos;			/* The free part of the current chunk */
+  size_t left;
+  struct slab_s *slabs;
+  struct datum_s *freenodes;
+} arena_t;
+
+/* Copies the 'len' bytes long string 's' into the arena */
+static char *
+arena_strdup(arena_t *ap, const char *s, size_t len)
+{
+  size_t n = len + 1;
+  char *p;
+
+  if (n > ap->left)
+  {
+    size_t size = (n > ARENA_CHUNK / 4 ? n : ARENA_CHUNK);
+    chunk_t *cp = malloc(sizeof(chunk_t) + size);
+
+    if (cp == NULL)
+      return NULL;
+    cp->next = ap->chunks;
+    ap->chunks = cp;
+    if (size == n)
+    {				/* A huge key gets a chunk of its own */
+      memcpy(cp->mem, s, n);
+      return cp->mem;
+    }
+    ap->pos = cp->mem;
+    ap->left = size;
+  }
+  p = ap->pos;
+  ap->pos += n;
+  ap->left -= n;
+  memcpy(p, s, n);
+  return p;
+}
+
+
 /*
-** A key string type that avoids allocating small chunks
+** A key type that avoids allocating small chunks. It also caches the
+** length and hash value of the key. Keys are binary, but are always
+** stored with a terminating nul byte, so they can be used as strings.
 */
 
 #define HKEY_SHORT 7
 
 typedef struct hkey_s
 {
-  char str[HKEY_SHORT+1];
-  char *strp;
+  union
+  {
+    char str[HKEY_SHORT+1];	/* When len <= HKEY_SHORT */
+    char *strp;
+  } u;
+  uint32_t len;			/* 0 when not set */
+  hashval_t hash;		/* The key's full hash value */
 } hkey_t;
 
-/* Returns strcmp style values, e.g. -1, 0, 1 */
-static int
-hkey_comp(hkey_t *hkeyp, const char *s)
-{
-  if (hkeyp->strp)
-    return strcmp(hkeyp->strp, s);
-  else
-    return strcmp(hkeyp->str, s);
-}
+#define HKEY_MAXLEN UINT32_MAX
 
 #if USE_MACROS
-#define hkey_is_set(HP) ((HP)->strp != NULL || (HP)->str[0] != '\0')
+#define hkey_is_set(HP) ((HP)->len != 0)
+#define hkey_key(HP) ((HP)->len <= HKEY_SHORT ? (HP)->u.str : (HP)->u.strp)
 #else
 static bool
 hkey_is_set(hkey_t *hkeyp)
 {
-  return (hkeyp->strp != NULL || hkeyp->str[0] != '\0');
+  return (hkeyp->len != 0);
+}
+
+static char *
+hkey_key(hkey_t *hkeyp)
+{
+  return (hkeyp->len <= HKEY_SHORT ? hkeyp->u.str : hkeyp->u.strp);
 }
 #endif
 
-static bool
-hkey_set(hkey_t *hkeyp, const char *s)
+/* Returns 0 if equal, like memcmp, but never compares keys of different
+** lengths.
+*/
+static int
+hkey_comp(hkey_t *hkeyp, const char *s, size_t len)
 {
-  bool ret = true;
-  size_t len = strlen(s);
+  if (hkeyp->len != len)
+    return 1;
+  return memcmp(hkey_key(hkeyp), s, len);
+}
 
+/* The long key is allocated from the arena 'ap' if not NULL. If 'borrow',
+** it's not copied at all, just pointed to.
+*/
+static bool
+hkey_set(arena_t *ap, bool borrow, hkey_t *hkeyp, const char *s, size_t len,
+         hashval_t hash)
+{
   if (len <= HKEY_SHORT)
   {
-    strcpy(hkeyp->str, s);
-    hkeyp->strp = NULL;
+    memcpy(hkeyp->u.str, s, len);
+    hkeyp->u.str[len] = '\0';
   }
   else
   {
-    hkeyp->str[0] = '\0';
-    hkeyp->strp = (char *)malloc(len+1);
-    if (hkeyp->strp == NULL)
-      ret = false;
+    if (borrow)
+      hkeyp->u.strp = (char *)s;
+    else if (ap)
+      hkeyp->u.strp = arena_strdup(ap, s, len);
     else
-      strncpy(hkeyp->strp, s, len+1);
+    {
+      hkeyp->u.strp = (char *)malloc(len+1);
+      if (hkeyp->u.strp)
+      {
+        memcpy(hkeyp->u.strp, s, len);
+        hkeyp->u.strp[len] = '\0';
+      }
+    }
+    if (hkeyp->u.strp == NULL)
+      return false;
   }
-  return ret;
-}
-
-#if USE_MACROS
-#define hkey_key(HP) ((HP)->strp ? (HP)->strp : (HP)->str)
-#else
-static char *
-hkey_key(hkey_t *hkeyp)
-{
-  return (hkeyp->strp ? hkeyp->strp : hkeyp->str);
+  hkeyp->len = (uint32_t)len;
+  hkeyp->hash = hash;
+  return true;
 }
-#endif
 
+/* Keys in the arena 'ap', or borrowed, are not freed */
 static void
-hkey_clear(hkey_t *hkeyp)
+hkey_clear(arena_t *ap, bool borrow, hkey_t *hkeyp)
 {
   if (hkeyp)
   {
-    if (hkeyp->strp)
-      free(hkeyp->strp);
-    hkeyp->strp = NULL;
-    hkeyp->str[0] = '\0';
+    if (hkeyp->len > HKEY_SHORT && !ap && !borrow)
+      free(hkeyp->u.strp);
+    memset(hkeyp, 0, sizeof(*hkeyp));
   }
 }
 
@@ -98,11 +195,14 @@ hkey_clear(hkey_t *hkeyp)
 ** A hashed datum structure
 */
 
+/* With inline values (hashtable_create_inline()), the value bytes start at
+** 'value' and go on past the end of the struct, so the value is last.
+*/
 typedef struct datum_s
 {
   hkey_t hkey;
-  void *value;
   struct datum_s *next;
+  void *value;
 } datum_t;
 
 #if USE_MACROS
@@ -123,56 +223,137 @@ datum_set_next(datum_t *dp1, datum_t *dp2)
 #endif /* !USE_MACROS */
 
 static bool
-datum_set(datum_t *dp, const char *hkey, void *val, datum_t *nextp)
+datum_set(arena_t *ap, bool borrow, datum_t *dp, const char *hkey, size_t len,
+          hashval_t hash, void *val, datum_t *nextp)
 {
-  hkey_clear(&dp->hkey);
-  if (!hkey_set(&dp->hkey, hkey))
+  hkey_clear(ap, borrow, &dp->hkey);
+  if (!hkey_set(ap, borrow, &dp->hkey, hkey, len, hash))
     return false;
   dp->value = val;
   dp->next = nextp;
   return true;
 }
 
+static void
+datum_clear(arena_t *ap, bool borrow, datum_t *dp)
+{
+  if (dp)
+  {
+    hkey_clear(ap, borrow, &dp->hkey);
+    dp->value = NULL;
+    dp->next = NULL;
+  }
+}
+
+/* A chain node of 'size' bytes (the table's datum size), from the arena
+** 'ap' if not NULL
+*/
+typedef struct slab_s
+{
+  struct slab_s *next;
+  char nodes[];			/* ARENA_SLAB nodes */
+} slab_t;
+
 static datum_t *
-datum_copy(datum_t *dp)
+node_alloc(arena_t *ap, size_t size)
 {
-  datum_t *dp2 = malloc(sizeof(datum_t));
+  datum_t *dp;
 
-  if (dp2)
+  if (ap == NULL)
+    return malloc(size);
+  if (ap->freenodes == NULL)
   {
-    memset(&dp2->hkey, 0, sizeof(dp2->hkey));
-    if (!datum_set(dp2, hkey_key(&dp->hkey), dp->value, dp->next))
+    slab_t *sp = malloc(sizeof(slab_t) + ARENA_SLAB * size);
+
+    if (sp == NULL)
+      return NULL;
+    sp->next = ap->slabs;
+    ap->slabs = sp;
+    for (size_t i = 0 ; i < ARENA_SLAB ; i++)
     {
-      free(dp2);
-      dp2 = NULL;
+      dp = (datum_t *)(sp->nodes + i * size);
+      dp->next = ap->freenodes;
+      ap->freenodes = dp;
     }
   }
-  return dp2;
+  dp = ap->freenodes;
+  ap->freenodes = dp->next;
+  return dp;
 }
 
+/* Frees the node itself, not what's in it */
 static void
-datum_clear(datum_t *dp)
+node_free(arena_t *ap, datum_t *dp)
 {
-  if (dp)
+  if (ap == NULL)
+    free(dp);
+  else
   {
-    hkey_clear(&dp->hkey);
-    dp->value = NULL;
-    dp->next = NULL;
+    dp->next = ap->freenodes;
+    ap->freenodes = dp;
   }
 }
 
 static void
-datum_free(datum_t *dp)
+datum_free(arena_t *ap, bool borrow, datum_t *dp)
+{
+  datum_clear(ap, borrow, dp);
+  node_free(ap, dp);
+}
+
+/* Moves all the keys and chain nodes of 'from' into 'to' */
+static void
+arena_join(arena_t *to, arena_t *from)
+{
+  chunk_t **cpp = &from->chunks;
+  slab_t **spp = &from->slabs;
+  datum_t **dpp = &from->freenodes;
+
+  while (*cpp)
+    cpp = &(*cpp)->next;
+  *cpp = to->chunks;
+  to->chunks = from->chunks;
+  while (*spp)
+    spp = &(*spp)->next;
+  *spp = to->slabs;
+  to->slabs = from->slabs;
+  while (*dpp)
+    dpp = &(*dpp)->next;
+  *dpp = to->freenodes;
+  to->freenodes = from->freenodes;
+  memset(from, 0, sizeof(*from));
+}
+
+/* Frees all the keys and chain nodes in the arena */
+static void
+arena_free(arena_t *ap)
 {
-  datum_clear(dp);
-  free(dp);
+  while (ap->chunks)
+  {
+    chunk_t *cp = ap->chunks->next;
+
+    free(ap->chunks);
+    ap->chunks = cp;
+  }
+  while (ap->slabs)
+  {
+    slab_t *sp = ap->slabs->next;
+
+    free(ap->slabs);
+    ap->slabs = sp;
+  }
+  ap->pos = NULL;
+  ap->left = 0;
+  ap->freenodes = NULL;
 }
 
 #if USE_MACROS
 #define datum_is_set(DP)  hkey_is_set(&(DP)->hkey)
+#define datum_hash(DP)    ((DP)->hkey.hash)
+#define datum_len(DP)     ((DP)->hkey.len)
 #define datum_key(DP)     hkey_key(&(DP)->hkey)
 #define datum_value(DP)   ((DP)->value)
-#define datum_comp(DP, S) hkey_comp(&(DP)->hkey, (S))
+#define datum_comp(DP, S, L) hkey_comp(&(DP)->hkey, (S), (L))
 #define datum_next(DP)    ((DP)->next)
 #else
 static bool
@@ -181,6 +362,18 @@ datum_is_set(datum_t *dp)
   return hkey_is_set(&dp->hkey);
 }
 
+static hashval_t
+datum_hash(datum_t *dp)
+{
+  return dp->hkey.hash;
+}
+
+static size_t
+datum_len(datum_t *dp)
+{
+  return dp->hkey.len;
+}
+
 static char *
 datum_key(datum_t *dp)
 {
@@ -193,11 +386,11 @@ datum_value(datum_t *dp)
   return dp->value;
 }
 
-/* Returns strcmp style values, e.g. -1, 0, 1 */
+/* Returns 0 if equal */
 static int
-datum_comp(datum_t *dp, const char *s)
+datum_comp(datum_t *dp, const char *s, size_t len)
 {
-  return hkey_comp(&dp->hkey, s);
+  return hkey_comp(&dp->hkey, s, len);
 }
 
 static datum_t *
@@ -222,22 +415,42 @@ hash_string_fast(const char *s)
   return val;
 }
 
+hashval_t
+hash_mem_fast(const void *key, size_t len)
+{
+  const char *s = key;
+  hashval_t val = 0;
+
+  while (len--)
+    val += (val << 3) + *s++;
+  return val;
+}
+
 #define SEED_MAX 2147483646
 
 hashval_t
 hash_string_good(const char *s)
 {
+  return hash_mem_good(s, strlen(s));
+}
+
+/* This is a 32-bit hash function, the upper half of the value is 0 */
+hashval_t
+hash_mem_good(const void *key, size_t len)
+{
+  const char *s = key;
+  const char *end = s + len;
   uint32_t i;
-  hashval_t val;
+  uint32_t val;
   union
   {
-      hashval_t ul;
-      char s[sizeof(hashval_t)];
+      uint32_t ul;
+      char s[sizeof(uint32_t)];
   } u;
 
   /* Pack the first word */
   i = 0;
-  while (i < sizeof(u.s) && *s)
+  while (i < sizeof(u.s) && s < end)
     u.s[i++] = *s++;
   while (i < sizeof(u.s))
     u.s[i++] = '\0';		/* Pad if necessary */
@@ -265,10 +478,10 @@ hash_string_good(const char *s)
 #undef RAND_R
 
   /* The rest is simply xor:ed wordwise */
-  while (*s)
+  while (s < end)
   {
     i = 0;
-    while (i < sizeof(u.s) && *s)
+    while (i < sizeof(u.s) && s < end)
       u.s[i++] = *s++;
     while (i < sizeof(u.s))
       u.s[i++] = '\0';
@@ -280,334 +493,3273 @@ hash_string_good(const char *s)
 #undef SEED_MAX
 
 /*
-** The hash table
+** wyhash (final version 4), by Wang Yi, public domain. It reads the key 8
+** bytes at a time (4 for short keys), and mixes with 64x64->128 bit
+** multiplications, so it's much faster than the ones above on long keys,
+** and uses the full 64 bits.
 */
 
-struct hashtable_s
-{
-  size_t size;
-  size_t count;
-  float minload;
-  float maxload;
-  hashfunc_t *hfun;		/* Hash function */
-  hashdestfunc_t *dfun;		/* Destructor */
-  datum_t *data;
-};
+#if defined(__SIZEOF_INT128__)
 
-hashtable_t
-hashtable_create(size_t initsize, float minload, float maxload,
-		 hashfunc_t *hfun,
-		 hashdestfunc_t *dfun)
+__extension__ typedef unsigned __int128 wy_u128;
+
+static inline void
+wy_mum(uint64_t *a, uint64_t *b)
 {
-  hashtable_t table = malloc(sizeof(struct hashtable_s));
+  wy_u128 r = (wy_u128)*a * *b;
 
-  if (table)
-  {
-    if (initsize == 0)
-      initsize = 101;
-    initsize |= 1;		/* Make it odd, it helps some hash functions */
-    if (maxload < 0.5 || 1.0 <= maxload)
-      maxload = 0.8;
-    if (minload < 0.2 || maxload <= minload)
-      minload = 0.5;
-    if (minload >= maxload)
-      minload = maxload / 2;
-    table->size = initsize;
-    table->count = 0;
-    table->minload = minload;
-    table->maxload = maxload;
-    if (!hfun)
-      hfun = hash_string_fast;
-    table->hfun = hfun;
-    table->dfun = dfun;
-    table->data = malloc(initsize * sizeof(datum_t));
-    if (table->data == NULL)
-    {
-      free(table);
-      return NULL;
-    }
-    memset(table->data, 0, initsize * sizeof(datum_t));
-  }
-  return table;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
 }
 
-void
-hashtable_clear(hashtable_t h)
-{
-  for (size_t i = 0 ; i < h->size ; i++)
-  {
-    datum_t *dp = h->data + i;
+#else  /* !__SIZEOF_INT128__ */
 
-    if (datum_is_set(dp))
-    {
-      void *val = datum_value(dp);
-      datum_t *nextp = datum_next(dp);
+static inline void
+wy_mum(uint64_t *a, uint64_t *b)
+{
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = (t < rl);
+  uint64_t lo = t + (rm1 << 32);
 
-      datum_clear(dp);
-      if (h->dfun)
-        h->dfun (val);
-      dp = nextp;
-      while (dp)
-      {
-        nextp = datum_next(dp);
-        if (h->dfun)
-          h->dfun (datum_value(dp));
-        datum_free(dp);
-        dp = nextp;
-      }
-    }
-  }
-  h->count = 0;
-  memset(h->data, 0, h->size * sizeof(datum_t));
+  c += (lo < t);
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
 }
 
-void
-hashtable_destroy(hashtable_t h)
+#endif /* !__SIZEOF_INT128__ */
+
+static inline uint64_t
+wy_mix(uint64_t a, uint64_t b)
 {
-  hashtable_clear(h);
-  free(h->data);
-  free(h);
+  wy_mum(&a, &b);
+  return a ^ b;
 }
 
-static hashtable_ret_t
-hashtable_put_nogrow(hashtable_t h, const char *key, void *val, void **oldvalp);
-
-/* Returns true on sucess
-** Returns false on failure
-*/
-static bool
-hashtable_grow(hashtable_t h)
+static inline uint64_t
+wy_r8(const uint8_t *p)
 {
-  size_t newsize = (size_t) (h->count / h->minload);
-  hashtable_t h2 = hashtable_create(newsize, h->minload, h->maxload,
-				    h->hfun, NULL);
+  uint64_t v;
 
-  if (h2)
-  {
-    size_t i;
-    datum_t *data;
-
-    for (i = 0 ; i < h->size ; i++)
-    {
-      datum_t *dp = h->data + i;
+  memcpy(&v, p, 8);
+  return v;
+}
 
-      if (datum_is_set(dp))
-      {
-	datum_t *nextp = datum_next(dp);
+static inline uint64_t
+wy_r4(const uint8_t *p)
+{
+  uint32_t v;
 
-	if (hashtable_put_nogrow(h2, datum_key(dp), datum_value(dp), NULL) < 0)
-	{
-	  hashtable_destroy(h2);
-	  return false;
-	}
-	dp = nextp;
-	while (dp)
-	{
-	  nextp = datum_next(dp);
-	  if (hashtable_put_nogrow(h2, datum_key(dp), datum_value(dp), NULL) < 0)
-	  {
-	    hashtable_destroy(h2);
-	    return false;
-	  }
-	  dp = nextp;
-	}
-      }
-    }
-    SWAP(h->data, h2->data, data);
-    SWAP(h->size, h2->size, i);
-    SWAP(h->count, h2->count, i);
-    hashtable_destroy(h2);
-  }
-  return true;
+  memcpy(&v, p, 4);
+  return v;
 }
 
-/* Returns true if found, and *dpp pointing to the entry, *prevp pointing to prev.
-** Returns false if not found, and *dpp pointing the slot where it goes.
-*/
-static bool
-hashtable_find(hashtable_t h, const char *key, datum_t **dpp, datum_t **prevp)
+/* 1 to 3 bytes */
+static inline uint64_t
+wy_r3(const uint8_t *p, size_t k)
 {
-  datum_t *dp = h->data + (h->hfun(key) % h->size);
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
 
-  if (datum_is_set(dp))
+static const uint64_t Wy_secret[4] =
   {
-    datum_t *p = dp;
-    datum_t *prev = NULL;
+   UINT64_C(0x2d358dccaa6c78a5), UINT64_C(0x8bb84b93962eacc9),
+   UINT64_C(0x4b33a62ed433d4a3), UINT64_C(0x4d5a2da51de1aa47)
+  };
 
-    while (p)
+static uint64_t
+wy_hash(const void *key, size_t len, uint64_t seed)
+{
+  const uint8_t *p = key;
+  const uint64_t *secret = Wy_secret;
+  uint64_t a, b;
+
+  seed ^= wy_mix(seed ^ secret[0], secret[1]);
+  if (len <= 16)
+  {
+    if (len >= 4)
     {
-      if (datum_comp(p, key) == 0)
-      {
-	*dpp = p;
-        if (prevp)
-          *prevp = prev;
-	return true;
-      }
-      prev = p;
-      p = datum_next(p);
+      a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+    }
+    else if (len > 0)
+    {
+      a = wy_r3(p, len);
+      b = 0;
     }
+    else
+      a = b = 0;
   }
-  *dpp = dp;
-  return false;
-}
+  else
+  {
+    size_t i = len;
 
-/* Returns hashtable_ret_error on failure.
-** Returns hashtable_ret_ok on success, and if key didn't exist.
-** Returns hashtable_ret_replaced on success, and if key was replaced.
-*/
-static hashtable_ret_t
-hashtable_put_nogrow(hashtable_t h, const char *key, void *val, void **oldvalp)
-{
-  datum_t *dp;
+    if (i > 48)
+    {
+      uint64_t see1 = seed, see2 = seed;
 
-  if (hashtable_find(h, key, &dp, NULL))
-  {				/* Found */
-    if (oldvalp != NULL)
-      *oldvalp = datum_value(dp); /* Return old one */
-    else if (h->dfun)
-      h->dfun (datum_value(dp)); /* Clear old one */
-    if (!datum_set_value(dp, val))
-        return hashtable_ret_error;
-    return hashtable_ret_replaced;
-  }
-  else
-  {				/* Not found */
-    if (datum_is_set(dp))
-    {				/* Push new value */
-      datum_t *newp = datum_copy(dp); /* Copy the old one */
-
-      if (!newp)
-	return hashtable_ret_error;
-      if (!datum_set(dp, key, val, newp)) /* Set the new one,    */
-      {				          /* pointing to the old */
-	datum_free(newp);
-	return hashtable_ret_error;
-      }
+      do
+      {
+        seed = wy_mix(wy_r8(p) ^ secret[1], wy_r8(p + 8) ^ seed);
+        see1 = wy_mix(wy_r8(p + 16) ^ secret[2], wy_r8(p + 24) ^ see1);
+        see2 = wy_mix(wy_r8(p + 32) ^ secret[3], wy_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
     }
-    else
-    {				/* Just smack it into this slot */
-      if (!datum_set(dp, key, val, NULL))
-	return hashtable_ret_error;
+    while (i > 16)
+    {
+      seed = wy_mix(wy_r8(p) ^ secret[1], wy_r8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
     }
-    h->count += 1;
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
   }
-   return hashtable_ret_ok;
+  a ^= secret[1];
+  b ^= seed;
+  wy_mum(&a, &b);
+  return wy_mix(a ^ secret[0] ^ len, b ^ secret[1]);
 }
 
-/* Returns hashtable_ret_error on failure.
-** Returns hashtable_ret_ok on success, and if key didn't exist.
-** Returns hashtable_ret_replaced on success, and if key was replaced.
-*/
-hashtable_ret_t
-hashtable_put(hashtable_t h, const char *key, void *val, void **oldvalp)
+hashval_t
+hash_mem_wy(const void *key, size_t len)
 {
-  if (key == NULL || key[0] == '\0')
-    return hashtable_ret_error;
-  if (((float)h->count+1) / h->size >= h->maxload)
-  {
-    if (!hashtable_grow(h))
-      return hashtable_ret_error;
-  }
-  return hashtable_put_nogrow(h, key, val, oldvalp);
+  return wy_hash(key, len, 0);
 }
 
-/* Returns hashtable_ret_not_found if not found
-** Returns hashtable_ret_ok if found, and '*valuep' updated to value.
-*/
-hashtable_ret_t
-hashtable_get(hashtable_t h, const char *key, void **valp)
+hashval_t
+hash_string_wy(const char *s)
+{
+  return hash_mem_wy(s, strlen(s));
+}
+
+/*
+** The hash table
+*/
+
+struct hashtable_s
+{
+  size_t size;
+  size_t count;
+  size_t growat;		/* Grow when count + 1 reaches this */
+  float minload;
+  float maxload;
+  float shrinkload;		/* Shrink when the load drops below this */
+  size_t initsize;		/* Don't shrink automatically below this */
+  hashfunc_t *hfun;		/* Hash function */
+  hashfunc_n_t *hfun_n;		/* Hash function with length, if any */
+  hashdestfunc_t *dfun;		/* Destructor */
+  unsigned engine;		/* HASHTABLE_CHAIN, _SWISS, _FROZEN */
+  unsigned flags;
+  arena_t *arena;		/* HASHTABLE_ARENA, otherwise NULL */
+  size_t vsize;			/* Inline values: their size, otherwise 0 */
+  size_t dsize;			/* The size of a datum, see datum_at() */
+  datum_t *data;
+  datum_t *odata;		/* Incremental grow: the old buckets */
+  size_t osize;
+  size_t migrate;		/* Incremental grow: the next old bucket */
+  uint8_t *ctrl;		/* Swiss, cuckoo: control bytes, size + SW_GROUP */
+  size_t tombs;			/* Swiss: number of deleted slots */
+  size_t moves;			/* Times keys were moved, for iterators */
+  size_t edits;			/* Times keys were put or removed, too */
+  size_t kicks;			/* Cuckoo: keys moved by puts, and the */
+  size_t *klog;			/* last CK_LOG of them, from and to slots */
+  struct frozen_s *frozen;	/* Frozen: the whole table */
+  size_t maplen;		/* Frozen: mapped from a file if > 0 */
+#if HASHTABLE_STATS
+  hashtable_stats_t stats;	/* The counters, size and count not used */
+#endif
+};
+
+/* HASHTABLE_BORROW: long keys are the caller's, only pointed to */
+#define borrowed(H) (((H)->flags & HASHTABLE_BORROW) != 0)
+
+/* The engines with a flat array of slots and control bytes */
+#define flat_engine(H) \
+  ((H)->engine == HASHTABLE_SWISS || (H)->engine == HASHTABLE_CUCKOO)
+
+/* Datum 'I' in the array 'DATA'. With inline values longer than a pointer,
+** the datums are longer than datum_t, so the arrays are indexed by bytes.
+*/
+#define datum_at(H, DATA, I) \
+  ((datum_t *)((char *)(DATA) + (size_t)(I) * (H)->dsize))
+#define datum_copy(H, TO, FROM) memcpy((TO), (FROM), (H)->dsize)
+
+/* The value as returned by gets, a pointer to the bytes if inline */
+static inline void *
+value_get(hashtable_t h, datum_t *dp)
+{
+  return (h->vsize ? (void *)&dp->value : datum_value(dp));
+}
+
+/* An inline value is copied from where 'val' points, or zeroed if NULL */
+static inline void
+value_set(hashtable_t h, datum_t *dp, const void *val)
+{
+  if (h->vsize == 0)
+    datum_set_value(dp, (void *)val);
+  else if (val)
+    memcpy(&dp->value, val, h->vsize);
+  else
+    memset(&dp->value, 0, h->vsize);
+}
+
+/* Counting for hashtable_stats(). A resize is timed from a
+** 'uint64_t t0 = STAT_CLOCK()' before it.
+*/
+#if HASHTABLE_STATS
+#define STAT_ADD(H, F, N) ((H)->stats.F += (N))
+#define STAT_CLOCK()      stat_clock()
+#define STAT_RESIZE(H, T0) \
+  ((H)->stats.resizes += 1, (H)->stats.resize_ns += stat_clock() - (T0))
+
+static uint64_t
+stat_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+#else
+#define STAT_ADD(H, F, N)  ((void)(H))
+#define STAT_CLOCK()       0
+#define STAT_RESIZE(H, T0) ((void)(T0))
+#endif
+
+/* Whether taking a chain node from node_alloc(), or setting a key of
+** length 'len' with hkey_set(), allocates memory, for the counting.
+*/
+#define node_allocates(AP) ((AP) == NULL || (AP)->freenodes == NULL)
+#define key_allocates(H, LEN) \
+  ((LEN) > HKEY_SHORT && !borrowed(H) && \
+   ((H)->arena == NULL || (LEN) + 1 > (H)->arena->left))
+
+
+/*
+** Bucket indexes
+*/
+
+#define FIB_MULT UINT64_C(0x9E3779B97F4A7C15) /* 2^64 / golden ratio */
+
+/* A power of two, at least 16 (which is SW_GROUP) */
+static size_t
+pow2_size(size_t n)
+{
+  size_t size = 16;
+
+  while (size < n)
+    size <<= 1;
+  return size;
+}
+
+/* log2 of a power of two */
+static inline unsigned
+size_log2(size_t size)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctzll((unsigned long long)size);
+#else
+  unsigned n = 0;
+
+  while (size > 1)
+  {
+    size >>= 1;
+    n += 1;
+  }
+  return n;
+#endif
+}
+
+/* The bucket for the hash value 'hv' in an array of 'size' buckets.
+** With HASHTABLE_POW2, it's Fibonacci hashing: the multiplication spreads
+** all bits of the hash value to the top bits of the product, which are used
+** as the index, so there's no division, and weak hash functions still
+** spread well. Otherwise it's the remainder with an odd size.
+*/
+static inline size_t
+bucket_index(hashtable_t h, hashval_t hv, size_t size)
+{
+  if (h->flags & HASHTABLE_POW2)
+    return (size_t)((hv * FIB_MULT) >> (64 - size_log2(size)));
+  return (size_t)(hv % size);
+}
+
+/* Sets the size, and the number of keys where the load reaches maxload,
+** so that puts compare integers instead of dividing.
+*/
+static void
+set_size(hashtable_t h, size_t size)
+{
+  double g = (double)size * h->maxload;
+
+  h->size = size;
+  h->growat = (size_t)g;
+  if ((double)h->growat < g)
+    h->growat += 1;
+}
+
+
+/*
+** Open addressing with control bytes, "swiss table" style.
+**
+** The data is a flat array of datums (the next pointer is not used), and
+** for each slot there is a control byte: either SW_EMPTY, SW_DELETED, or,
+** for a used slot, 7 bits of the hash value. Lookups compare SW_GROUP
+** control bytes at a time, so a datum is only touched when the tag matches.
+** The first SW_GROUP control bytes are mirrored after the end, so that a
+** group can be loaded from any position without wrapping.
+*/
+
+#define SW_GROUP   16
+#define SW_EMPTY   ((uint8_t)0x80)
+#define SW_DELETED ((uint8_t)0xFE)
+
+#define sw_is_full(C) (((C) & 0x80) == 0)
+
+/* Bit i is set if control byte i in the group matched */
+typedef uint32_t sw_mask_t;
+
+#if defined(__SSE2__)
+
+static inline sw_mask_t
+sw_match(const uint8_t *g, uint8_t c)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)g);
+
+  return (sw_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+}
+
+/* Empty or deleted, i.e. the high bit is set */
+static inline sw_mask_t
+sw_match_free(const uint8_t *g)
+{
+  return (sw_mask_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+
+#else  /* !__SSE2__ */
+
+static inline sw_mask_t
+sw_match(const uint8_t *g, uint8_t c)
+{
+  sw_mask_t m = 0;
+
+  for (unsigned i = 0 ; i < SW_GROUP ; i++)
+    if (g[i] == c)
+      m |= (sw_mask_t)1 << i;
+  return m;
+}
+
+static inline sw_mask_t
+sw_match_free(const uint8_t *g)
+{
+  sw_mask_t m = 0;
+
+  for (unsigned i = 0 ; i < SW_GROUP ; i++)
+    if (!sw_is_full(g[i]))
+      m |= (sw_mask_t)1 << i;
+  return m;
+}
+
+#endif /* !__SSE2__ */
+
+/* Index of the lowest set bit, 'm' must not be 0 */
+static inline unsigned
+sw_ctz(sw_mask_t m)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctz(m);
+#else
+  unsigned n = 0;
+
+  while (!(m & 1))
+  {
+    m >>= 1;
+    n += 1;
+  }
+  return n;
+#endif
+}
+
+/* Number of leading zeros in a SW_GROUP bit mask */
+static inline unsigned
+sw_clz(sw_mask_t m)
+{
+  unsigned n = SW_GROUP;
+
+  while (m)
+  {
+    m >>= 1;
+    n -= 1;
+  }
+  return n;
+}
+
+/* The position uses the high bits, the tag the low 7 bits, so the hash
+** value is mixed first to spread hash_string_fast's bits over both.
+*/
+static inline uint64_t
+sw_mix(hashval_t hv)
+{
+  uint64_t x = (uint64_t)hv * FIB_MULT;
+
+  return x ^ (x >> 29);
+}
+
+#define SW_H1(X) ((size_t)((X) >> 7))
+#define SW_H2(X) ((uint8_t)((X) & 0x7F))
+
+static void
+sw_set_ctrl(uint8_t *ctrl, size_t size, size_t i, uint8_t c)
+{
+  ctrl[i] = c;
+  if (i < SW_GROUP)
+    ctrl[size + i] = c;
+}
+
+/* Returns the slot index if found, h->size if not found. */
+static size_t
+sw_find(hashtable_t h, const char *key, size_t len, hashval_t hv)
+{
+  uint64_t hx = sw_mix(hv);
+  size_t mask = h->size - 1;
+  size_t pos = SW_H1(hx) & mask;
+  size_t step = 0;
+  uint8_t tag = SW_H2(hx);
+
+  STAT_ADD(h, searches, 1);
+  for (;;)
+  {
+    const uint8_t *g = h->ctrl + pos;
+    sw_mask_t m = sw_match(g, tag);
+
+    STAT_ADD(h, probes, 1);
+    while (m)
+    {
+      size_t i = (pos + sw_ctz(m)) & mask;
+      datum_t *dp = datum_at(h, h->data, i);
+
+      if (datum_hash(dp) == hv)
+      {
+        STAT_ADD(h, compares, 1);
+        if (datum_comp(dp, key, len) == 0)
+          return i;
+      }
+      m &= m - 1;
+    }
+    if (sw_match(g, SW_EMPTY))
+      return h->size;
+    step += SW_GROUP;		/* Triangular probing over the groups */
+    pos = (pos + step) & mask;
+  }
+}
+
+/* Returns the first empty or deleted slot in the probe sequence */
+static size_t
+sw_find_free(const uint8_t *ctrl, size_t size, uint64_t hx)
+{
+  size_t mask = size - 1;
+  size_t pos = SW_H1(hx) & mask;
+  size_t step = 0;
+
+  for (;;)
+  {
+    sw_mask_t m = sw_match_free(ctrl + pos);
+
+    if (m)
+      return (pos + sw_ctz(m)) & mask;
+    step += SW_GROUP;
+    pos = (pos + step) & mask;
+  }
+}
+
+/* Rehashes into 'newsize' slots. This is also used to get rid of deleted
+** slots without growing. The datums are moved, not copied.
+** Returns true on sucess
+** Returns false on failure
+*/
+static bool
+sw_resize(hashtable_t h, size_t newsize)
+{
+  uint64_t t0 = STAT_CLOCK();
+  uint8_t *ctrl = malloc(newsize + SW_GROUP);
+  datum_t *data = calloc(newsize, h->dsize);
+
+  if (ctrl == NULL || data == NULL)
+  {
+    free(ctrl);
+    free(data);
+    return false;
+  }
+  STAT_ADD(h, allocs, 2);
+  memset(ctrl, SW_EMPTY, newsize + SW_GROUP);
+  for (size_t i = 0 ; i < h->size ; i++)
+    if (sw_is_full(h->ctrl[i]))
+    {
+      uint64_t hx = sw_mix(datum_hash(datum_at(h, h->data, i)));
+      size_t j = sw_find_free(ctrl, newsize, hx);
+
+      sw_set_ctrl(ctrl, newsize, j, SW_H2(hx));
+      datum_copy(h, datum_at(h, data, j), datum_at(h, h->data, i));
+    }
+  free(h->ctrl);
+  free(h->data);
+  h->ctrl = ctrl;
+  h->data = data;
+  set_size(h, newsize);
+  h->tombs = 0;
+  h->moves += 1;
+  STAT_RESIZE(h, t0);
+  return true;
+}
+
+/* Inserts a key that's not in the table, growing first if needed.
+** Returns the slot, or h->size if out of memory.
+*/
+static size_t
+sw_insert(hashtable_t h, const char *key, size_t len, hashval_t hv,
+          void *val)
+{
+  datum_t *dp;
+  size_t i;
+
+  /* Deleted slots count as used here, or a probe might never end */
+  if (h->count + h->tombs + 1 >= h->growat)
+  {
+    if (!sw_resize(h, pow2_size((size_t)((h->count + 1) / h->minload))))
+      return h->size;
+  }
+  i = sw_find_free(h->ctrl, h->size, sw_mix(hv));
+  STAT_ADD(h, allocs, key_allocates(h, len));
+  dp = datum_at(h, h->data, i);
+  if (!datum_set(h->arena, borrowed(h), dp, key, len, hv, val, NULL))
+    return h->size;
+  value_set(h, dp, val);
+  if (h->ctrl[i] == SW_DELETED)
+    h->tombs -= 1;
+  sw_set_ctrl(h->ctrl, h->size, i, SW_H2(sw_mix(hv)));
+  h->count += 1;
+  h->edits += 1;
+  return i;
+}
+
+static hashtable_ret_t
+sw_put(hashtable_t h, const char *key, size_t len, hashval_t hv,
+       void *val, void **oldvalp)
+{
+  size_t i = sw_find(h, key, len, hv);
+  datum_t *dp;
+
+  if (i < h->size)
+  {				/* Found */
+    dp = datum_at(h, h->data, i);
+    if (oldvalp != NULL)
+      *oldvalp = datum_value(dp);
+    else if (h->dfun)
+      h->dfun (datum_value(dp));
+    value_set(h, dp, val);
+    return hashtable_ret_replaced;
+  }
+  if (sw_insert(h, key, len, hv, val) == h->size)
+    return hashtable_ret_error;
+  return hashtable_ret_ok;
+}
+
+static hashtable_ret_t
+sw_get(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  size_t i = sw_find(h, key, len, hv);
+
+  if (i < h->size)
+  {
+    if (valp)
+      *valp = value_get(h, datum_at(h, h->data, i));
+    STAT_ADD(h, hits, 1);
+    return hashtable_ret_ok;
+  }
+  STAT_ADD(h, misses, 1);
+  return hashtable_ret_not_found;
+}
+
+/* Removes the key in slot 'i' */
+static void
+sw_rem_slot(hashtable_t h, size_t i, void **valp)
+{
+  size_t mask = h->size - 1;
+  sw_mask_t after, before;
+
+  if (valp)
+    *valp = datum_value(datum_at(h, h->data, i));
+  else if (h->dfun)
+    h->dfun (datum_value(datum_at(h, h->data, i)));
+  datum_clear(h->arena, borrowed(h), datum_at(h, h->data, i));
+  /* If there is an empty slot within a group's width on both sides,
+  ** no probe can have passed this slot, so it can be made empty again
+  ** instead of deleted.
+  */
+  after = sw_match(h->ctrl + i, SW_EMPTY);
+  before = sw_match(h->ctrl + ((i - SW_GROUP) & mask), SW_EMPTY);
+  if (after && before && sw_ctz(after) + sw_clz(before) < SW_GROUP)
+    sw_set_ctrl(h->ctrl, h->size, i, SW_EMPTY);
+  else
+  {
+    sw_set_ctrl(h->ctrl, h->size, i, SW_DELETED);
+    h->tombs += 1;
+  }
+  h->count -= 1;
+  h->edits += 1;
+}
+
+static hashtable_ret_t
+sw_rem(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  size_t i = sw_find(h, key, len, hv);
+
+  if (i == h->size)
+    return hashtable_ret_not_found;
+  sw_rem_slot(h, i, valp);
+  return hashtable_ret_ok;
+}
+
+static void
+sw_clear(hashtable_t h)
+{
+  for (size_t i = 0 ; i < h->size && (h->dfun || !h->arena) ; i++)
+    if (sw_is_full(h->ctrl[i]))
+    {
+      if (h->dfun)
+        h->dfun (datum_value(datum_at(h, h->data, i)));
+      datum_clear(h->arena, borrowed(h), datum_at(h, h->data, i));
+    }
+  memset(h->ctrl, SW_EMPTY, h->size + SW_GROUP);
+  h->count = 0;
+  h->edits += 1;
+  h->tombs = 0;
+}
+
+/* The "chain length" of a slot is the number of groups probed to find it */
+static size_t
+sw_probe_length(hashtable_t h, size_t i)
+{
+  size_t mask = h->size - 1;
+  size_t pos = SW_H1(sw_mix(datum_hash(datum_at(h, h->data, i)))) & mask;
+  size_t step = 0;
+  size_t c = 1;
+
+  while (((i - pos) & mask) >= SW_GROUP)
+  {
+    step += SW_GROUP;
+    pos = (pos + step) & mask;
+    c += 1;
+  }
+  return c;
+}
+
+
+/*
+** Bucketized cuckoo hashing.
+**
+** The data is a flat array of datums like for the swiss tables, with the
+** same control bytes (but no deleted ones, and the mirrored bytes after
+** the end are not used), grouped into buckets of CK_WAYS slots. Each key
+** has two buckets, and is always in one of them, so a lookup checks at
+** most 2 * CK_WAYS control bytes, and only compares keys where the 7-bit
+** tag matches. The first bucket comes from the hash value, like the
+** position in a swiss table. The second comes from a seeded hash of the
+** key itself, so keys with the same hash value (like many short keys with
+** hash_string_fast) still get different second buckets. It's only
+** computed when the key is not in the first bucket.
+**
+** When both buckets are full, a breadth first search over the other
+** buckets of the keys in them, and so on, finds the shortest path of keys
+** to kick one step each, ending in a free slot. If there is none within
+** CK_PATHS buckets, the table grows instead.
+*/
+
+#define CK_WAYS  4		/* Slots per bucket */
+#define CK_PATHS 128		/* Buckets searched for a free slot */
+#define CK_LOG   32		/* Moves remembered for iterators */
+#define CK_SEED  UINT64_C(0xC2B2AE3D27D4EB4F)
+
+typedef struct ck_step_s
+{
+  size_t bucket;
+  int from;			/* The step before, -1 for the key's own */
+  unsigned slot;		/* The slot in that bucket that moves here */
+} ck_step_t;
+
+/* The buckets of a key in a table of 'SIZE' slots */
+#define ck_bucket1(SIZE, HX) (SW_H1(HX) & ((SIZE) / CK_WAYS - 1))
+
+static inline size_t
+ck_bucket2(size_t size, const char *key, size_t len, size_t b1)
+{
+  size_t b2 = (size_t)wy_hash(key, len, CK_SEED) & (size / CK_WAYS - 1);
+
+  return (b2 == b1 ? b1 ^ 1 : b2);
+}
+
+/* Returns the slot of the key in bucket 'b', or h->size if not there */
+static inline size_t
+ck_find_in(hashtable_t h, size_t b, const char *key, size_t len,
+           hashval_t hv, uint8_t tag)
+{
+  STAT_ADD(h, probes, 1);
+  for (size_t i = b * CK_WAYS ; i < (b + 1) * CK_WAYS ; i++)
+    if (h->ctrl[i] == tag)
+    {
+      datum_t *dp = datum_at(h, h->data, i);
+
+      if (datum_hash(dp) == hv)
+      {
+        STAT_ADD(h, compares, 1);
+        if (datum_comp(dp, key, len) == 0)
+          return i;
+      }
+    }
+  return h->size;
+}
+
+/* Returns the slot index if found, h->size if not found. */
+static size_t
+ck_find(hashtable_t h, const char *key, size_t len, hashval_t hv)
+{
+  uint64_t hx = sw_mix(hv);
+  size_t b1 = ck_bucket1(h->size, hx);
+  size_t i;
+
+  STAT_ADD(h, searches, 1);
+  i = ck_find_in(h, b1, key, len, hv, SW_H2(hx));
+  if (i == h->size)
+    i = ck_find_in(h, ck_bucket2(h->size, key, len, b1),
+                   key, len, hv, SW_H2(hx));
+  return i;
+}
+
+/* The other bucket of the key in slot 'i' */
+static size_t
+ck_other(hashtable_t h, size_t i)
+{
+  datum_t *dp = datum_at(h, h->data, i);
+  size_t b1 = ck_bucket1(h->size, sw_mix(datum_hash(dp)));
+
+  if (i / CK_WAYS != b1)
+    return b1;
+  return ck_bucket2(h->size, datum_key(dp), datum_len(dp), b1);
+}
+
+/* Whether 'b' is on the path that ends with step 'k' */
+static bool
+ck_on_path(const ck_step_t *steps, int k, size_t b)
+{
+  for ( ; k >= 0 ; k = steps[k].from)
+    if (steps[k].bucket == b)
+      return true;
+  return false;
+}
+
+/* Makes a free slot in bucket 'b1' or 'b2', kicking keys to their other
+** buckets if needed. The buckets on a path are all different, and all
+** but the last were full, so the keys can be moved from the end back.
+** Returns the free slot, or h->size if there was no path.
+*/
+static size_t
+ck_make_room(hashtable_t h, size_t b1, size_t b2)
+{
+  ck_step_t steps[CK_PATHS];
+  int n = 2;
+
+  steps[0] = (ck_step_t){ b1, -1, 0 };
+  steps[1] = (ck_step_t){ b2, -1, 0 };
+  for (int k = 0 ; k < n ; k++)
+  {
+    size_t b = steps[k].bucket;
+
+    for (size_t i = b * CK_WAYS ; i < (b + 1) * CK_WAYS ; i++)
+      if (!sw_is_full(h->ctrl[i]))
+      {
+        for ( ; steps[k].from >= 0 ; k = steps[k].from)
+        {
+          size_t j = steps[steps[k].from].bucket * CK_WAYS + steps[k].slot;
+          size_t *lp = h->klog + 2 * (h->kicks++ % CK_LOG);
+
+          datum_copy(h, datum_at(h, h->data, i), datum_at(h, h->data, j));
+          memset(datum_at(h, h->data, j), 0, h->dsize); /* Not its key */
+          h->ctrl[i] = h->ctrl[j];
+          h->ctrl[j] = SW_EMPTY;
+          lp[0] = j;
+          lp[1] = i;
+          i = j;
+        }
+        return i;
+      }
+    for (unsigned s = 0 ; s < CK_WAYS && n < CK_PATHS ; s++)
+    {
+      size_t other = ck_other(h, b * CK_WAYS + s);
+
+      if (!ck_on_path(steps, k, other))
+        steps[n++] = (ck_step_t){ other, k, s };
+    }
+  }
+  return h->size;
+}
+
+/* Rehashes into 'newsize' slots, or more if the keys don't fit.
+** Returns true on sucess
+** Returns false on failure
+*/
+static bool
+ck_resize(hashtable_t h, size_t newsize)
+{
+  uint64_t t0 = STAT_CLOCK();
+  uint8_t *octrl = h->ctrl;
+  datum_t *odata = h->data;
+  size_t osize = h->size;
+
+  for (;;)
+  {
+    uint8_t *ctrl = malloc(newsize + SW_GROUP);
+    datum_t *data = calloc(newsize, h->dsize);
+    size_t i;
+
+    if (ctrl == NULL || data == NULL)
+    {
+      free(ctrl);
+      free(data);
+      return false;
+    }
+    STAT_ADD(h, allocs, 2);
+    memset(ctrl, SW_EMPTY, newsize + SW_GROUP);
+    h->ctrl = ctrl;
+    h->data = data;
+    h->size = newsize;
+    for (i = 0 ; i < osize ; i++)
+      if (sw_is_full(octrl[i]))
+      {
+        datum_t *dp = datum_at(h, odata, i);
+        size_t b1 = ck_bucket1(h->size, sw_mix(datum_hash(dp)));
+        size_t j = ck_make_room(h, b1, ck_bucket2(h->size, datum_key(dp),
+                                                  datum_len(dp), b1));
+
+        if (j == h->size)
+          break;
+        datum_copy(h, datum_at(h, data, j), dp);
+        ctrl[j] = octrl[i];
+      }
+    if (i == osize)
+      break;
+    free(ctrl);			/* The datums are still in the old array */
+    free(data);
+    h->ctrl = octrl;
+    h->data = odata;
+    h->size = osize;
+    newsize *= 2;
+  }
+  free(octrl);
+  free(odata);
+  set_size(h, newsize);
+  h->moves += 1;
+  STAT_RESIZE(h, t0);
+  return true;
+}
+
+/* Inserts a key that's not in the table, growing first if needed.
+** Returns the slot, or h->size if out of memory.
+*/
+static size_t
+ck_insert(hashtable_t h, const char *key, size_t len, hashval_t hv,
+          void *val)
+{
+  uint64_t hx = sw_mix(hv);
+  datum_t *dp;
+  size_t i;
+
+  if (h->count + 1 >= h->growat)
+  {
+    if (!ck_resize(h, pow2_size((size_t)((h->count + 1) / h->minload))))
+      return h->size;
+  }
+  for (;;)
+  {
+    size_t b1 = ck_bucket1(h->size, hx);
+
+    i = ck_make_room(h, b1, ck_bucket2(h->size, key, len, b1));
+    if (i < h->size)
+      break;
+    if (!ck_resize(h, h->size * 2)) /* No path to a free slot */
+      return h->size;
+  }
+  STAT_ADD(h, allocs, key_allocates(h, len));
+  dp = datum_at(h, h->data, i);
+  if (!datum_set(h->arena, borrowed(h), dp, key, len, hv, val, NULL))
+    return h->size;
+  value_set(h, dp, val);
+  h->ctrl[i] = SW_H2(hx);
+  h->count += 1;
+  h->edits += 1;
+  return i;
+}
+
+static hashtable_ret_t
+ck_put(hashtable_t h, const char *key, size_t len, hashval_t hv,
+       void *val, void **oldvalp)
+{
+  size_t i = ck_find(h, key, len, hv);
+  datum_t *dp;
+
+  if (i < h->size)
+  {				/* Found */
+    dp = datum_at(h, h->data, i);
+    if (oldvalp != NULL)
+      *oldvalp = datum_value(dp);
+    else if (h->dfun)
+      h->dfun (datum_value(dp));
+    value_set(h, dp, val);
+    return hashtable_ret_replaced;
+  }
+  if (ck_insert(h, key, len, hv, val) == h->size)
+    return hashtable_ret_error;
+  return hashtable_ret_ok;
+}
+
+static hashtable_ret_t
+ck_get(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  size_t i = ck_find(h, key, len, hv);
+
+  if (i < h->size)
+  {
+    if (valp)
+      *valp = value_get(h, datum_at(h, h->data, i));
+    STAT_ADD(h, hits, 1);
+    return hashtable_ret_ok;
+  }
+  STAT_ADD(h, misses, 1);
+  return hashtable_ret_not_found;
+}
+
+/* Removes the key in slot 'i'. No deleted slots needed, a key is never
+** looked for past its buckets.
+*/
+static void
+ck_rem_slot(hashtable_t h, size_t i, void **valp)
+{
+  if (valp)
+    *valp = datum_value(datum_at(h, h->data, i));
+  else if (h->dfun)
+    h->dfun (datum_value(datum_at(h, h->data, i)));
+  datum_clear(h->arena, borrowed(h), datum_at(h, h->data, i));
+  h->ctrl[i] = SW_EMPTY;
+  h->count -= 1;
+  h->edits += 1;
+}
+
+static hashtable_ret_t
+ck_rem(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  size_t i = ck_find(h, key, len, hv);
+
+  if (i == h->size)
+    return hashtable_ret_not_found;
+  ck_rem_slot(h, i, valp);
+  return hashtable_ret_ok;
+}
+
+/* The "chain length" of a slot is 1 in the first bucket, 2 in the second */
+#define ck_probe_length(H, I) \
+  (1 + ((I) / CK_WAYS != \
+        ck_bucket1((H)->size, \
+                   sw_mix(datum_hash(datum_at((H), (H)->data, (I)))))))
+
+
+/*
+** Frozen tables, made by hashtable_freeze(). The whole table is a single
+** block of memory without any pointers in it, so it can be copied, or
+** written to a file and mapped back into memory as it is, see
+** hashtable_save(). It's a header, the index of the first entry of each
+** bucket (and one past the last, for the end of the last bucket), the
+** entries sorted by bucket, the nul terminated keys, and optionally the
+** values, when they are saved as fixed size blobs.
+** The buckets are Fibonacci hashed, like with HASHTABLE_POW2, and there are
+** about as many as there are keys, so a lookup typically reads one
+** index and one or two adjacent entries, and compares one key.
+**
+** A table made by hashtable_freeze_mph() has a minimal perfect hash
+** function instead, CHD style ("hash, displace and compress"): the keys are
+** hashed into buckets of about MPH_BUCKET_KEYS each, and for each bucket
+** there's a displacement, found when building, which gives all its keys
+** slots of their own. There are exactly as many slots (entries) as keys.
+** A lookup reads the displacement, and then the one entry it gives. The
+** index is the displacements instead of the bucket starts, and the hash
+** values are seeded wyhash values instead of the table's own, since they
+** must be different for all keys.
+*/
+
+#define FZ_MAGIC UINT64_C(0x315A524642415448) /* "HTABFRZ1", little endian */
+
+/* The hash function, so that a saved table can be opened with the right
+** one. A table with any other function has to be opened with it given.
+*/
+#define FZ_HASH_CUSTOM 0
+#define FZ_HASH_FAST   1
+#define FZ_HASH_GOOD   2
+#define FZ_HASH_WY     3
+
+typedef struct frozen_s
+{
+  uint64_t magic;
+  uint64_t bytes;		/* The size of the whole block */
+  uint64_t log2;		/* The number of buckets is 2^log2 */
+  uint64_t count;
+  uint64_t keybytes;		/* Size of the keys, nuls included */
+  uint64_t vsize;		/* Size of each value blob, 0 if none */
+  uint64_t hash;		/* FZ_HASH_* */
+  uint64_t mph;			/* MPH: the number of buckets, otherwise 0 */
+  uint64_t seed;		/* MPH: the hash seed */
+} frozen_t;
+
+typedef struct fentry_s
+{
+  hashval_t hash;
+  uint64_t koff;		/* Offset of the key in the keys */
+  uint64_t len;
+  uint64_t value;		/* The void * value, or the offset of the blob */
+} fentry_t;
+
+#define FZ_ALIGN(N) (((N) + 7) & ~(size_t)7)
+
+#define MPH_BUCKET_KEYS 4	/* Keys per MPH bucket on average */
+#define MPH_SEEDS 8		/* Seeds to try before giving up */
+
+/* The size of the index, the bucket starts or the MPH displacements */
+static size_t
+fz_index_bytes(size_t log2, size_t mph)
+{
+  if (mph)
+    return FZ_ALIGN(mph * sizeof(uint32_t));
+  return (((size_t)1 << log2) + 1) * sizeof(uint64_t);
+}
+
+#define fz_first(FZ) ((uint64_t *)((FZ) + 1))
+#define fz_disp(FZ)  ((uint32_t *)((FZ) + 1))
+#define fz_ents(FZ)  \
+  ((fentry_t *)((char *)((FZ) + 1) + fz_index_bytes((FZ)->log2, (FZ)->mph)))
+#define fz_keys(FZ)  ((char *)(fz_ents(FZ) + (FZ)->count))
+#define fz_bucket(FZ, HV) ((size_t)(((HV) * FIB_MULT) >> (64 - (FZ)->log2)))
+
+/* The offset of the value blobs, after the keys */
+static size_t
+fz_voff(size_t index, size_t count, size_t keybytes)
+{
+  return FZ_ALIGN(sizeof(frozen_t) + index +
+                  count * sizeof(fentry_t) + keybytes);
+}
+
+/* The size of the whole block */
+static size_t
+fz_bytes(size_t index, size_t count, size_t keybytes, size_t vsize)
+{
+  return fz_voff(index, count, keybytes) + count * vsize;
+}
+
+/* 'x' scaled to [0, n), without a division */
+static inline size_t
+mph_range(uint32_t x, size_t n)
+{
+  return (size_t)(((uint64_t)x * n) >> 32);
+}
+
+static inline size_t
+mph_bucket(const frozen_t *fz, hashval_t hv)
+{
+  return mph_range((uint32_t)(hv >> 32), fz->mph);
+}
+
+/* The slot of a key with the hash value 'hv', with the displacement 'd' */
+static inline size_t
+mph_slot(const frozen_t *fz, hashval_t hv, uint32_t d)
+{
+  uint64_t x = (hv ^ (d * FIB_MULT)) * UINT64_C(0xD6E8FEB86659FD93);
+
+  return mph_range((uint32_t)(x ^ (x >> 32)), fz->count);
+}
+
+static void *
+fz_value(const frozen_t *fz, const fentry_t *ep)
+{
+  if (fz->vsize)
+    return (char *)fz + ep->value;
+  return (void *)(uintptr_t)ep->value;
+}
+
+static const fentry_t *
+fz_find(hashtable_t h, const char *key, size_t len, hashval_t hv)
+{
+  const frozen_t *fz = h->frozen;
+  const fentry_t *ep, *end;
+
+  STAT_ADD(h, searches, 1);
+  if (fz->mph)
+  {				/* One entry to check */
+    if (fz->count == 0)
+      return NULL;
+    ep = fz_ents(fz) + mph_slot(fz, hv, fz_disp(fz)[mph_bucket(fz, hv)]);
+    end = ep + 1;
+  }
+  else
+  {
+    const uint64_t *first = fz_first(fz);
+    size_t b = fz_bucket(fz, hv);
+
+    ep = fz_ents(fz) + first[b];
+    end = fz_ents(fz) + first[b + 1];
+  }
+  for ( ; ep < end ; ep++)
+  {
+    STAT_ADD(h, probes, 1);
+    if (ep->hash == hv && ep->len == len)
+    {
+      STAT_ADD(h, compares, 1);
+      if (memcmp(fz_keys(fz) + ep->koff, key, len) == 0)
+        return ep;
+    }
+  }
+  return NULL;
+}
+
+static hashtable_ret_t
+fz_get(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  const fentry_t *ep = fz_find(h, key, len, hv);
+
+  if (ep == NULL)
+  {
+    STAT_ADD(h, misses, 1);
+    return hashtable_ret_not_found;
+  }
+  if (valp)
+    *valp = fz_value(h->frozen, ep);
+  STAT_ADD(h, hits, 1);
+  return hashtable_ret_ok;
+}
+
+/* Checks that the header of a mapped file is consistent with its size
+** 'bytes', so that no lookup or iteration goes outside it. The contents
+** are not checked.
+*/
+static bool
+fz_valid(const frozen_t *fz, size_t bytes)
+{
+  if (fz->magic != FZ_MAGIC || fz->bytes != bytes ||
+      fz->count > bytes / sizeof(fentry_t) ||
+      fz->keybytes > bytes ||
+      fz->vsize > bytes || fz->vsize % 8 != 0 ||
+      fz->hash > FZ_HASH_WY)
+    return false;
+  if (fz->mph)
+    return (fz->log2 == 0 && fz->count <= UINT32_MAX &&
+            fz->mph == (fz->count + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS +
+                       (fz->count == 0) &&
+            fz_bytes(fz_index_bytes(0, fz->mph), fz->count, fz->keybytes,
+                     fz->vsize) == bytes);
+  return (fz->log2 >= 4 && fz->log2 < 8 * sizeof(size_t) - 4 &&
+          ((size_t)1 << fz->log2) <= bytes / sizeof(uint64_t) &&
+          fz_bytes(fz_index_bytes(fz->log2, 0), fz->count, fz->keybytes,
+                   fz->vsize) == bytes &&
+          fz_first(fz)[0] == 0 &&
+          fz_first(fz)[(size_t)1 << fz->log2] == fz->count);
+}
+
+
+/*
+** The public functions
+*/
+
+static hashtable_t
+create_table(size_t initsize, float minload, float maxload,
+             hashfunc_t *hfun, hashfunc_n_t *hfun_n,
+             hashdestfunc_t *dfun, size_t vsize,
+             unsigned flags);
+
+/* The builtin ones have length versions, which saves a pass over the
+** key, since the length is always known anyway.
+*/
+static hashfunc_n_t *
+builtin_hfun_n(hashfunc_t *hfun)
+{
+  if (hfun == NULL || hfun == hash_string_fast)
+    return hash_mem_fast;
+  if (hfun == hash_string_good)
+    return hash_mem_good;
+  if (hfun == hash_string_wy)
+    return hash_mem_wy;
+  return NULL;
+}
+
+hashtable_t
+hashtable_create(size_t initsize, float minload, float maxload,
+		 hashfunc_t *hfun,
+		 hashdestfunc_t *dfun)
+{
+  return hashtable_create_ext(initsize, minload, maxload, hfun, dfun, 0);
+}
+
+hashtable_t
+hashtable_create_ext(size_t initsize, float minload, float maxload,
+                     hashfunc_t *hfun,
+                     hashdestfunc_t *dfun,
+                     unsigned flags)
+{
+  return create_table(initsize, minload, maxload,
+                      hfun, builtin_hfun_n(hfun), dfun, 0, flags);
+}
+
+hashtable_t
+hashtable_create_n(size_t initsize, float minload, float maxload,
+                   hashfunc_n_t *hfun,
+                   hashdestfunc_t *dfun,
+                   unsigned flags)
+{
+  if (hfun == NULL)
+    hfun = hash_mem_fast;
+  return create_table(initsize, minload, maxload, NULL, hfun, dfun, 0, flags);
+}
+
+hashtable_t
+hashtable_create_inline(size_t initsize, float minload, float maxload,
+                        hashfunc_t *hfun,
+                        size_t vsize,
+                        unsigned flags)
+{
+  if (vsize == 0)
+    return NULL;
+  return create_table(initsize, minload, maxload,
+                      hfun, builtin_hfun_n(hfun), NULL, vsize, flags);
+}
+
+/* Replaces unreasonable loads by the defaults */
+static void
+fix_loads(float *minloadp, float *maxloadp)
+{
+  if (*maxloadp < 0.5 || 1.0 <= *maxloadp)
+    *maxloadp = 0.8;
+  if (*minloadp < 0.2 || *maxloadp <= *minloadp)
+    *minloadp = 0.5;
+  if (*minloadp >= *maxloadp)
+    *minloadp = *maxloadp / 2;
+}
+
+/* One of 'hfun' and 'hfun_n' must be set. If both are, they must give the
+** same hash values. If 'vsize' > 0, the values are that many bytes inline.
+*/
+static hashtable_t
+create_table(size_t initsize, float minload, float maxload,
+             hashfunc_t *hfun, hashfunc_n_t *hfun_n,
+             hashdestfunc_t *dfun, size_t vsize,
+             unsigned flags)
+{
+  hashtable_t table;
+
+  if ((flags & HASHTABLE_ENGINE_MASK) == HASHTABLE_FROZEN)
+    return NULL;		/* Only made by hashtable_freeze() */
+  table = malloc(sizeof(struct hashtable_s));
+  if (table)
+  {
+    table->engine = flags & HASHTABLE_ENGINE_MASK;
+    table->flags = flags;
+    if (initsize == 0)
+      initsize = 101;
+    if (flat_engine(table) || (flags & HASHTABLE_POW2))
+      initsize = pow2_size(initsize);
+    else
+      initsize |= 1;		/* Make it odd, it helps some hash functions */
+    fix_loads(&minload, &maxload);
+    table->count = 0;
+    table->minload = minload;
+    table->maxload = maxload;
+    set_size(table, initsize);
+    table->shrinkload = minload / 4;
+    table->initsize = initsize;
+    table->hfun = hfun;
+    table->hfun_n = hfun_n;
+    table->dfun = dfun;
+    table->ctrl = NULL;
+    table->tombs = 0;
+    table->moves = 0;
+    table->edits = 0;
+    table->kicks = 0;
+    table->klog = NULL;
+    table->frozen = NULL;
+    table->maplen = 0;
+    table->odata = NULL;
+    table->osize = 0;
+    table->migrate = 0;
+    table->arena = NULL;
+    table->vsize = vsize;
+    table->dsize = sizeof(datum_t);
+    if (vsize > sizeof(void *))	/* Room for the rest after the datum */
+      table->dsize = offsetof(datum_t, value) + ((vsize + 7) & ~(size_t)7);
+#if HASHTABLE_STATS
+    memset(&table->stats, 0, sizeof(table->stats));
+#endif
+    if (flags & HASHTABLE_ARENA)
+    {
+      table->arena = calloc(1, sizeof(arena_t));
+      if (table->arena == NULL)
+      {
+        free(table);
+        return NULL;
+      }
+    }
+    table->data = malloc(initsize * table->dsize);
+    if (table->data == NULL)
+    {
+      free(table->arena);
+      free(table);
+      return NULL;
+    }
+    memset(table->data, 0, initsize * table->dsize);
+    if (flat_engine(table))
+    {
+      table->ctrl = malloc(initsize + SW_GROUP);
+      if (table->engine == HASHTABLE_CUCKOO)
+        table->klog = malloc(2 * CK_LOG * sizeof(size_t));
+      if (table->ctrl == NULL ||
+          (table->engine == HASHTABLE_CUCKOO && table->klog == NULL))
+      {
+        free(table->klog);
+        free(table->ctrl);
+        free(table->data);
+        free(table->arena);
+        free(table);
+        return NULL;
+      }
+      memset(table->ctrl, SW_EMPTY, initsize + SW_GROUP);
+    }
+    STAT_ADD(table, allocs,
+             2 + (table->arena != NULL) + (table->ctrl != NULL) +
+             (table->klog != NULL));
+  }
+  return table;
+}
+
+void
+hashtable_clear(hashtable_t h)
+{
+  if (h->engine == HASHTABLE_FROZEN)
+    return;			/* Read-only */
+  if (flat_engine(h))
+  {
+    sw_clear(h);
+    if (h->arena)
+      arena_free(h->arena);
+    return;
+  }
+  /* The old buckets too, if there's an incremental grow going on.
+  ** With an arena and no destructor, there's nothing to do per datum.
+  */
+  for (int a = 0 ; a < 2 && (h->dfun || !h->arena) ; a++)
+  {
+    datum_t *data = (a ? h->odata : h->data);
+    size_t size = (a ? h->osize : h->size);
+
+    for (size_t i = 0 ; i < size ; i++)
+    {
+      datum_t *dp = datum_at(h, data, i);
+
+      if (datum_is_set(dp))
+      {
+        void *val = datum_value(dp);
+        datum_t *nextp = datum_next(dp);
+
+        datum_clear(h->arena, borrowed(h), dp);
+        if (h->dfun)
+          h->dfun (val);
+        dp = nextp;
+        while (dp)
+        {
+          nextp = datum_next(dp);
+          if (h->dfun)
+            h->dfun (datum_value(dp));
+          datum_free(h->arena, borrowed(h), dp);
+          dp = nextp;
+        }
+      }
+    }
+  }
+  free(h->odata);
+  h->odata = NULL;
+  h->osize = 0;
+  h->migrate = 0;
+  h->count = 0;
+  h->edits += 1;
+  if (h->arena)
+    arena_free(h->arena);	/* All the keys and nodes at once */
+  memset(h->data, 0, h->size * h->dsize);
+}
+
+void
+hashtable_destroy(hashtable_t h)
+{
+  hashtable_clear(h);		/* Also frees odata */
+  if (h->maplen)
+    munmap(h->frozen, h->maplen);
+  else
+    free(h->frozen);
+  free(h->arena);
+  free(h->ctrl);
+  free(h->klog);
+  free(h->data);
+  free(h);
+}
+
+/* Moves 'dp' into its bucket in 'data'. If the bucket is already used,
+** 'nodep' is linked into the chain with the contents of 'dp'.
+** Returns true if 'nodep' was used.
+*/
+static bool
+grow_move(hashtable_t h, datum_t *data, size_t size,
+          datum_t *dp, datum_t *nodep)
+{
+  datum_t *head = datum_at(h, data, bucket_index(h, datum_hash(dp), size));
+
+  if (!datum_is_set(head))
+  {
+    datum_copy(h, head, dp);
+    datum_set_next(head, NULL);
+    return false;
+  }
+  datum_copy(h, nodep, dp);
+  datum_set_next(nodep, datum_next(head));
+  datum_set_next(head, nodep);
+  return true;
+}
+
+/* The size to resize to, so that the load becomes minload, but at least
+** 'minsize'.
+*/
+static size_t
+resize_size(hashtable_t h, size_t minsize)
+{
+  size_t newsize = (size_t) (h->count / h->minload);
+
+  if (newsize < minsize)
+    newsize = minsize;
+  if (h->flags & HASHTABLE_POW2)
+    return pow2_size(newsize);
+  if (newsize == 0)
+    newsize = 101;
+  return newsize | 1;		/* Odd, like in hashtable_create() */
+}
+
+/* Moves all datums into a new bucket array of 'newsize' buckets, using
+** the cached hash values.
+** No keys are copied, and chain nodes are reused. The only allocation,
+** except the new array, is when more chain nodes are needed than there
+** were before, and that is done first, so that a failure leaves the table
+** untouched.
+** Returns true on sucess
+** Returns false on failure
+*/
+static bool
+hashtable_resize(hashtable_t h, size_t newsize)
+{
+  datum_t *data, *spare = NULL;	/* Free chain nodes */
+  uint8_t *used;
+  size_t i, oldslots = 0, newslots = 0;
+  uint64_t t0 = STAT_CLOCK();
+  data = calloc(newsize, h->dsize);
+  used = calloc(newsize / 8 + 1, 1);
+  if (data == NULL || used == NULL)
+  {
+    free(data);
+    free(used);
+    return false;
+  }
+  STAT_ADD(h, allocs, 2);
+  for (i = 0 ; i < h->size ; i++)
+  {
+    datum_t *dp = datum_at(h, h->data, i);
+
+    if (datum_is_set(dp))
+    {
+      oldslots += 1;
+      for ( ; dp ; dp = datum_next(dp))
+      {
+        size_t j = bucket_index(h, datum_hash(dp), newsize);
+
+        if (!(used[j / 8] & (1 << (j % 8))))
+        {
+          used[j / 8] |= 1 << (j % 8);
+          newslots += 1;
+        }
+      }
+    }
+  }
+  free(used);
+  /* Need count-newslots nodes, have count-oldslots */
+  for (i = oldslots ; i > newslots ; i--)
+  {
+    datum_t *newp;
+
+    STAT_ADD(h, allocs, node_allocates(h->arena));
+    newp = node_alloc(h->arena, h->dsize);
+    if (newp == NULL)
+    {
+      while (spare)
+      {
+        datum_t *nextp = datum_next(spare);
+
+        node_free(h->arena, spare);
+        spare = nextp;
+      }
+      free(data);
+      return false;
+    }
+    datum_set_next(newp, spare);
+    spare = newp;
+  }
+  /* Move the chain nodes first, and then the heads, so that the nodes
+  ** released are available when the heads need them.
+  */
+  for (i = 0 ; i < h->size ; i++)
+  {
+    datum_t *dp = datum_next(datum_at(h, h->data, i));
+
+    while (dp)
+    {
+      datum_t *nextp = datum_next(dp);
+
+      if (!grow_move(h, data, newsize, dp, dp))
+      {
+        datum_set_next(dp, spare);
+        spare = dp;
+      }
+      dp = nextp;
+    }
+  }
+  for (i = 0 ; i < h->size ; i++)
+  {
+    datum_t *dp = datum_at(h, h->data, i);
+
+    if (datum_is_set(dp))
+    {
+      datum_t *nextp = (spare ? datum_next(spare) : NULL);
+
+      if (grow_move(h, data, newsize, dp, spare))
+        spare = nextp;
+    }
+  }
+  while (spare)
+  {
+    datum_t *nextp = datum_next(spare);
+
+    node_free(h->arena, spare);
+    spare = nextp;
+  }
+  free(h->data);
+  h->data = data;
+  set_size(h, newsize);
+  h->moves += 1;
+  STAT_RESIZE(h, t0);
+  return true;
+}
+
+/*
+** Incremental grow. The old bucket array is kept in odata while the datums
+** are moved to the new one, a few buckets at a time by each operation.
+** Buckets before 'migrate' in the old array are empty. A new key goes into
+** its old bucket, if that's not moved yet, so the new array only has keys
+** whose old buckets are moved. Lookups then only need to search one of the
+** arrays, and iterators can tell which keys they have passed.
+*/
+
+/* The number of old buckets moved per put, get, and rem */
+#define MIGRATE_STEP 8
+
+/* Moves old bucket 'i' to the new array. The chain nodes are moved first,
+** and then the head. The head needs a node, unless one of the keys goes
+** into an empty bucket and leaves one over, so then that's allocated first.
+** Returns false if out of memory, in which case nothing is moved.
+*/
+static bool
+migrate_bucket(hashtable_t h, size_t i)
+{
+  datum_t *dp = datum_at(h, h->odata, i);
+  datum_t *nodep, *spare = NULL;
+  bool empty = false;		/* One goes into an empty bucket */
+
+  if (!datum_is_set(dp))
+    return true;
+  for (nodep = dp ; nodep && !empty ; nodep = datum_next(nodep))
+    empty = !datum_is_set(datum_at(h, h->data,
+                                   bucket_index(h, datum_hash(nodep),
+                                                h->size)));
+  if (!empty)
+  {
+    STAT_ADD(h, allocs, node_allocates(h->arena));
+    spare = node_alloc(h->arena, h->dsize);
+    if (spare == NULL)
+      return false;
+  }
+  nodep = datum_next(dp);
+  while (nodep)
+  {
+    datum_t *nextp = datum_next(nodep);
+
+    if (!grow_move(h, h->data, h->size, nodep, nodep))
+    {				/* Keep one node for the head */
+      if (spare)
+        node_free(h->arena, spare);
+      spare = nodep;
+    }
+    nodep = nextp;
+  }
+  datum_set_next(dp, NULL);
+  if (!grow_move(h, h->data, h->size, dp, spare) && spare)
+    node_free(h->arena, spare);
+  memset(dp, 0, h->dsize);
+  return true;
+}
+
+/* Moves at most 'n' old buckets, and frees the old array when done.
+** Returns false if out of memory.
+*/
+static bool
+hashtable_migrate(hashtable_t h, size_t n)
+{
+  while (h->migrate < h->osize && n-- > 0)
+  {
+    if (!migrate_bucket(h, h->migrate))
+      return false;
+    h->migrate += 1;
+  }
+  if (h->odata && h->migrate == h->osize)
+  {
+    free(h->odata);
+    h->odata = NULL;
+    h->osize = 0;
+    h->migrate = 0;
+  }
+  return true;
+}
+
+/* Starts an incremental resize. If the previous one isn't done yet, it's
+** finished first.
+** Returns true on sucess
+** Returns false on failure
+*/
+static bool
+hashtable_resize_start(hashtable_t h, size_t newsize)
+{
+  uint64_t t0 = STAT_CLOCK();
+  datum_t *data;
+
+  if (h->odata && !hashtable_migrate(h, SIZE_MAX))
+    return false;
+  data = calloc(newsize, h->dsize);
+  if (data == NULL)
+    return false;
+  h->odata = h->data;
+  h->osize = h->size;
+  h->migrate = 0;
+  h->data = data;
+  set_size(h, newsize);
+  h->moves += 1;
+  STAT_ADD(h, allocs, 1);
+  STAT_RESIZE(h, t0);
+  return true;
+}
+
+/* Searches the chain starting at 'dp'. */
+static bool
+bucket_find(hashtable_t h, datum_t *dp, const char *key, size_t len,
+            hashval_t hv, datum_t **dpp, datum_t **prevp)
+{
+  STAT_ADD(h, probes, 1);
+  if (datum_is_set(dp))
+  {
+    datum_t *p = dp;
+    datum_t *prev = NULL;
+
+    while (p)
+    {
+      if (datum_hash(p) == hv)
+      {
+        STAT_ADD(h, compares, 1);
+        if (datum_comp(p, key, len) == 0)
+        {
+          *dpp = p;
+          if (prevp)
+            *prevp = prev;
+          return true;
+        }
+      }
+      prev = p;
+      p = datum_next(p);
+      STAT_ADD(h, probes, (p != NULL));
+    }
+  }
+  return false;
+}
+
+/* Returns the bucket where keys with the hash value 'hv' are */
+static inline datum_t *
+chain_bucket(hashtable_t h, hashval_t hv)
+{
+  if (h->odata)
+  {				/* Still in the old array? */
+    size_t i = bucket_index(h, hv, h->osize);
+
+    if (i >= h->migrate)
+      return datum_at(h, h->odata, i);
+  }
+  return datum_at(h, h->data, bucket_index(h, hv, h->size));
+}
+
+/* Returns true if found, and *dpp pointing to the entry, *prevp pointing to prev.
+** Returns false if not found, and *dpp pointing the slot where it goes.
+*/
+static bool
+hashtable_find(hashtable_t h, const char *key, size_t len, hashval_t hv,
+               datum_t **dpp, datum_t **prevp)
+{
+  datum_t *dp = chain_bucket(h, hv);
+
+  STAT_ADD(h, searches, 1);
+  if (bucket_find(h, dp, key, len, hv, dpp, prevp))
+    return true;
+  *dpp = dp;
+  return false;
+}
+
+/* Returns hashtable_ret_error on failure.
+** Returns hashtable_ret_ok on success, and if key didn't exist.
+** Returns hashtable_ret_replaced on success, and if key was replaced.
+*/
+/* Inserts a key that's not in the table, first in the bucket 'dp'.
+** Returns false if out of memory.
+*/
+static bool
+chain_insert(hashtable_t h, datum_t *dp, const char *key, size_t len,
+             hashval_t hv, void *val)
+{
+  STAT_ADD(h, allocs, key_allocates(h, len));
+  if (datum_is_set(dp))
+  {				/* Push new value */
+    datum_t *newp;
+
+    STAT_ADD(h, allocs, node_allocates(h->arena));
+    newp = node_alloc(h->arena, h->dsize);
+    if (!newp)
+      return false;
+    datum_copy(h, newp, dp);		/* Move the old one, key and all */
+    memset(&dp->hkey, 0, sizeof(dp->hkey));
+    if (!datum_set(h->arena, borrowed(h), dp, key, len, hv, val,
+                   newp))	/* The new one, pointing to the old */
+    {
+      datum_copy(h, dp, newp);
+      node_free(h->arena, newp);
+      return false;
+    }
+  }
+  else
+  {				/* Just smack it into this slot */
+    if (!datum_set(h->arena, borrowed(h), dp, key, len, hv, val, NULL))
+      return false;
+  }
+  value_set(h, dp, val);
+  h->count += 1;
+  h->edits += 1;
+  return true;
+}
+
+static hashtable_ret_t
+hashtable_put_nogrow(hashtable_t h, const char *key, size_t len, hashval_t hv,
+                     void *val, void **oldvalp)
+{
+  datum_t *dp;
+
+  if (hashtable_find(h, key, len, hv, &dp, NULL))
+  {				/* Found */
+    if (oldvalp != NULL)
+      *oldvalp = datum_value(dp); /* Return old one */
+    else if (h->dfun)
+      h->dfun (datum_value(dp)); /* Clear old one */
+    value_set(h, dp, val);
+    return hashtable_ret_replaced;
+  }
+  if (!chain_insert(h, dp, key, len, hv, val))
+    return hashtable_ret_error;
+  return hashtable_ret_ok;
+}
+
+/* Shrinks the table when the load has dropped below shrinkload, to a size
+** where the load becomes minload, just like when growing. So the number
+** of keys has to change by a good margin before it resizes again, in
+** either direction. A failure is ignored, the table just stays larger.
+*/
+static void
+hashtable_shrink(hashtable_t h)
+{
+  if (h->size <= h->initsize || h->count >= h->shrinkload * h->size)
+    return;
+  if (h->engine == HASHTABLE_SWISS)
+  {
+    size_t newsize = pow2_size((size_t) (h->count / h->minload));
+
+    if (newsize < h->initsize)
+      newsize = h->initsize;
+    if (newsize < h->size)
+      (void)sw_resize(h, newsize);
+  }
+  else if (h->engine == HASHTABLE_CUCKOO)
+  {
+    size_t newsize = pow2_size((size_t) (h->count / h->minload));
+
+    if (newsize < h->initsize)
+      newsize = h->initsize;
+    if (newsize < h->size)
+      (void)ck_resize(h, newsize);
+  }
+  else if (h->flags & HASHTABLE_INCREMENTAL)
+    (void)hashtable_resize_start(h, resize_size(h, h->initsize));
+  else
+    (void)hashtable_resize(h, resize_size(h, h->initsize));
+}
+
+/* Returns hashtable_ret_error on failure.
+** Returns hashtable_ret_ok on success, and if key didn't exist.
+** Returns hashtable_ret_replaced on success, and if key was replaced.
+*/
+/* Grows the table if the next put would make the load reach maxload.
+** Returns false if out of memory.
+*/
+static bool
+chain_grow(hashtable_t h)
+{
+  size_t newsize;
+
+  if (h->count + 1 < h->growat)
+    return true;
+  newsize = resize_size(h, 0);
+  if (h->flags & HASHTABLE_INCREMENTAL)
+    return hashtable_resize_start(h, newsize);
+  return hashtable_resize(h, newsize);
+}
+
+static hashtable_ret_t
+put_hv(hashtable_t h, const char *key, size_t len, hashval_t hv,
+       void *val, void **oldvalp)
+{
+  if (h->vsize && oldvalp)
+    return hashtable_ret_error;	/* Inline values can't be handed back */
+  if (h->engine == HASHTABLE_SWISS)
+    return sw_put(h, key, len, hv, val, oldvalp);
+  if (h->engine == HASHTABLE_CUCKOO)
+    return ck_put(h, key, len, hv, val, oldvalp);
+  if (h->engine == HASHTABLE_FROZEN)
+    return hashtable_ret_error;	/* Read-only */
+  if (h->odata)
+    (void)hashtable_migrate(h, MIGRATE_STEP);
+  if (!chain_grow(h))
+    return hashtable_ret_error;
+  return hashtable_put_nogrow(h, key, len, hv, val, oldvalp);
+}
+
+/* Looks up the key, inserts it with a NULL value if it's not there, and
+** sets '*slotp' to point to the value, and '*insertedp' to whether it
+** was inserted.
+** Returns hashtable_ret_error on failure.
+** Returns hashtable_ret_ok on success.
+*/
+static hashtable_ret_t
+upsert_hv(hashtable_t h, const char *key, size_t len, hashval_t hv,
+          void ***slotp, bool *insertedp)
+{
+  datum_t *dp;
+
+  *insertedp = false;
+  if (h->engine == HASHTABLE_FROZEN)
+    return hashtable_ret_error;	/* Read-only */
+  if (flat_engine(h))
+  {
+    size_t i = (h->engine == HASHTABLE_SWISS ? sw_find(h, key, len, hv) :
+                ck_find(h, key, len, hv));
+
+    if (i < h->size)
+    {
+      *slotp = &datum_at(h, h->data, i)->value;
+      return hashtable_ret_ok;
+    }
+    i = (h->engine == HASHTABLE_SWISS ? sw_insert(h, key, len, hv, NULL) :
+         ck_insert(h, key, len, hv, NULL));
+    if (i == h->size)
+      return hashtable_ret_error;
+    *slotp = &datum_at(h, h->data, i)->value;
+    *insertedp = true;
+    return hashtable_ret_ok;
+  }
+  if (h->odata)
+    (void)hashtable_migrate(h, MIGRATE_STEP);
+  if (hashtable_find(h, key, len, hv, &dp, NULL))
+  {
+    *slotp = &dp->value;
+    return hashtable_ret_ok;
+  }
+  if (h->count + 1 >= h->growat)
+  {				/* The bucket moves if it grows */
+    if (!chain_grow(h))
+      return hashtable_ret_error;
+    dp = chain_bucket(h, hv);
+  }
+  if (!chain_insert(h, dp, key, len, hv, NULL))
+    return hashtable_ret_error;
+  *slotp = &dp->value;		/* The new key is first in the bucket */
+  *insertedp = true;
+  return hashtable_ret_ok;
+}
+
+/* Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if found, and '*valuep' updated to value.
+*/
+static hashtable_ret_t
+get_hv(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  datum_t *dp;
+
+  if (h->engine == HASHTABLE_SWISS)
+    return sw_get(h, key, len, hv, valp);
+  if (h->engine == HASHTABLE_CUCKOO)
+    return ck_get(h, key, len, hv, valp);
+  if (h->engine == HASHTABLE_FROZEN)
+    return fz_get(h, key, len, hv, valp);
+  if (h->odata)
+    (void)hashtable_migrate(h, MIGRATE_STEP);
+  if (hashtable_find(h, key, len, hv, &dp, NULL))
+  {
+    if (valp)
+      *valp = value_get(h, dp);
+    STAT_ADD(h, hits, 1);
+    return hashtable_ret_ok;
+  }
+  STAT_ADD(h, misses, 1);
+  return hashtable_ret_not_found;
+}
+
+/* Removes the datum 'dp' from its chain, where 'prevp' is the one before
+** it, or NULL if it's the head. The next one then takes its place.
+*/
+static void
+chain_rem(hashtable_t h, datum_t *dp, datum_t *prevp, void **valp)
+{
+  if (valp)
+    *valp = datum_value(dp);	/* Return old value */
+  else if (h->dfun)
+    h->dfun (datum_value(dp)); /* Destroy old value */
+  if (!prevp)
+  {                           /* No previous pointer */
+    datum_t *nextp = datum_next(dp);
+
+    datum_clear(h->arena, borrowed(h), dp);
+    if (nextp)
+    {				/* Move the next one up, key and all */
+      datum_copy(h, dp, nextp);
+      node_free(h->arena, nextp);
+    }
+  }
+  else
+  {				/* Has a previous pointer */
+    datum_set_next(prevp, datum_next(dp));
+    datum_free(h->arena, borrowed(h), dp);
+  }
+  h->count -= 1;
+  h->edits += 1;
+}
+
+/* Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if removed
+*/
+static hashtable_ret_t
+rem_hv(hashtable_t h, const char *key, size_t len, hashval_t hv, void **valp)
+{
+  datum_t *dp, *tmp;
+
+  if (h->engine == HASHTABLE_FROZEN || (h->vsize && valp))
+    return hashtable_ret_error;	/* Read-only, or an inline value */
+  if (flat_engine(h))
+  {
+    hashtable_ret_t ret = (h->engine == HASHTABLE_SWISS ?
+                           sw_rem(h, key, len, hv, valp) :
+                           ck_rem(h, key, len, hv, valp));
+
+    if (ret == hashtable_ret_ok)
+      hashtable_shrink(h);
+    return ret;
+  }
+  if (h->odata)
+    (void)hashtable_migrate(h, MIGRATE_STEP);
+  if (hashtable_find(h, key, len, hv, &dp, &tmp))
+  {
+    chain_rem(h, dp, tmp, valp);
+    hashtable_shrink(h);
+    return hashtable_ret_ok;
+  }
+  return hashtable_ret_not_found;
+}
+
+/* The hash value of the nul terminated 'key', with the length 'len'.
+** (A minimal perfect hash table has its own.)
+*/
+static hashval_t
+hash_str(hashtable_t h, const char *key, size_t len)
+{
+  if (h->frozen && h->frozen->mph)
+    return wy_hash(key, len, h->frozen->seed);
+  return (h->hfun_n ? h->hfun_n(key, len) : h->hfun(key));
+}
+
+/* The hash value of the binary 'key'. A string hash function gets a
+** nul terminated copy of it.
+** Returns false if out of memory.
+*/
+static bool
+hash_mem(hashtable_t h, const char *key, size_t len, hashval_t *hvp)
+{
+  char buf[256], *p = buf;
+
+  if (h->hfun_n || (h->frozen && h->frozen->mph))
+  {
+    *hvp = hash_str(h, key, len);
+    return true;
+  }
+  if (len >= sizeof(buf) && (p = malloc(len+1)) == NULL)
+    return false;
+  STAT_ADD(h, allocs, (p != buf));
+  memcpy(p, key, len);
+  p[len] = '\0';
+  *hvp = h->hfun(p);
+  if (p != buf)
+    free(p);
+  return true;
+}
+
+hashtable_ret_t
+hashtable_put(hashtable_t h, const char *key, void *val, void **oldvalp)
+{
+  size_t len;
+
+  if (key == NULL || key[0] == '\0' || (len = strlen(key)) > HKEY_MAXLEN)
+    return hashtable_ret_error;
+  return put_hv(h, key, len, hash_str(h, key, len), val, oldvalp);
+}
+
+hashtable_ret_t
+hashtable_get(hashtable_t h, const char *key, void **valp)
+{
+  size_t len = strlen(key);
+
+  return get_hv(h, key, len, hash_str(h, key, len), valp);
+}
+
+hashtable_ret_t
+hashtable_get_value(hashtable_t h, const char *key, void *valp)
+{
+  size_t len = strlen(key);
+  void *val;
+  hashtable_ret_t ret = get_hv(h, key, len, hash_str(h, key, len), &val);
+
+  if (ret == hashtable_ret_ok && valp)
+  {
+    if (h->vsize)
+      memcpy(valp, val, h->vsize);
+    else
+      memcpy(valp, &val, sizeof(void *));
+  }
+  return ret;
+}
+
+hashtable_ret_t
+hashtable_rem(hashtable_t h, const char *key, void **valp)
+{
+  size_t len = strlen(key);
+
+  return rem_hv(h, key, len, hash_str(h, key, len), valp);
+}
+
+hashtable_ret_t
+hashtable_upsert(hashtable_t h, const char *key,
+                 void ***slotp, bool *insertedp)
+{
+  size_t len;
+  bool inserted;
+
+  if (key == NULL || key[0] == '\0' || (len = strlen(key)) > HKEY_MAXLEN)
+    return hashtable_ret_error;
+  return upsert_hv(h, key, len, hash_str(h, key, len), slotp,
+                   (insertedp ? insertedp : &inserted));
+}
+
+hashtable_ret_t
+hashtable_upsert_n(hashtable_t h, const void *key, size_t len,
+                   void ***slotp, bool *insertedp)
+{
+  hashval_t hv;
+  bool inserted;
+
+  if (key == NULL || len == 0 || len > HKEY_MAXLEN ||
+      !hash_mem(h, key, len, &hv))
+    return hashtable_ret_error;
+  return upsert_hv(h, key, len, hv, slotp,
+                   (insertedp ? insertedp : &inserted));
+}
+
+hashtable_ret_t
+hashtable_put_n(hashtable_t h, const void *key, size_t len,
+                void *val, void **oldvalp)
+{
+  hashval_t hv;
+
+  if (key == NULL || len == 0 || len > HKEY_MAXLEN ||
+      !hash_mem(h, key, len, &hv))
+    return hashtable_ret_error;
+  return put_hv(h, key, len, hv, val, oldvalp);
+}
+
+hashtable_ret_t
+hashtable_get_n(hashtable_t h, const void *key, size_t len, void **valp)
+{
+  hashval_t hv;
+
+  if (!hash_mem(h, key, len, &hv))
+    return hashtable_ret_error;
+  return get_hv(h, key, len, hv, valp);
+}
+
+hashtable_ret_t
+hashtable_rem_n(hashtable_t h, const void *key, size_t len, void **valp)
+{
+  hashval_t hv;
+
+  if (!hash_mem(h, key, len, &hv))
+    return hashtable_ret_error;
+  return rem_hv(h, key, len, hv, valp);
+}
+
+/*
+** Precomputed hash values
+*/
+
+hashval_t
+hashtable_hash(hashtable_t h, const char *key)
+{
+  return hash_str(h, key, strlen(key));
+}
+
+/* A minimal perfect hash table has its own hash values, so it ignores the
+** given one.
+*/
+#define own_hash(H, KEY, LEN, HV) \
+  ((H)->frozen && (H)->frozen->mph ? hash_str((H), (KEY), (LEN)) : (HV))
+
+hashtable_ret_t
+hashtable_put_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void *val, void **oldvalp)
+{
+  size_t len;
+
+  if (key == NULL || key[0] == '\0' || (len = strlen(key)) > HKEY_MAXLEN)
+    return hashtable_ret_error;
+  return put_hv(h, key, len, own_hash(h, key, len, hv), val, oldvalp);
+}
+
+hashtable_ret_t
+hashtable_get_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void **valp)
+{
+  size_t len = strlen(key);
+
+  return get_hv(h, key, len, own_hash(h, key, len, hv), valp);
+}
+
+hashtable_ret_t
+hashtable_rem_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void **valp)
+{
+  size_t len = strlen(key);
+
+  return rem_hv(h, key, len, own_hash(h, key, len, hv), valp);
+}
+
+hashtable_ret_t
+hashtable_upsert_hash(hashtable_t h, const char *key, hashval_t hv,
+                      void ***slotp, bool *insertedp)
+{
+  size_t len;
+  bool inserted;
+
+  if (key == NULL || key[0] == '\0' || (len = strlen(key)) > HKEY_MAXLEN)
+    return hashtable_ret_error;
+  return upsert_hv(h, key, len, own_hash(h, key, len, hv), slotp,
+                   (insertedp ? insertedp : &inserted));
+}
+
+/*
+** Batched lookups. The keys are looked up in groups, one step at a time for
+** all keys in the group: first all are hashed and their buckets prefetched,
+** then all the heads are checked and the next chain nodes prefetched, and so
+** on. So the cache misses for the keys in a group overlap, instead of
+** waiting for one at a time.
+*/
+
+#define GET_MANY_GROUP 16
+
+static size_t
+get_group(hashtable_t h, const char *const *keys, size_t n,
+          void **vals, hashtable_ret_t *rets)
+{
+  size_t len[GET_MANY_GROUP];
+  hashval_t hv[GET_MANY_GROUP];
+  datum_t *p[GET_MANY_GROUP];
+  size_t i, active, found = 0;
+
+  for (i = 0 ; i < n ; i++)
+  {
+    len[i] = strlen(keys[i]);
+    hv[i] = hash_str(h, keys[i], len[i]);
+    if (h->engine == HASHTABLE_SWISS)
+    {
+      size_t pos = SW_H1(sw_mix(hv[i])) & (h->size - 1);
+
+      PREFETCH(h->ctrl + pos);
+      PREFETCH(datum_at(h, h->data, pos));
+    }
+    else if (h->engine == HASHTABLE_CUCKOO)
+    {				/* Just the first bucket, the likely one */
+      size_t pos = ck_bucket1(h->size, sw_mix(hv[i])) * CK_WAYS;
+
+      PREFETCH(h->ctrl + pos);
+      PREFETCH(datum_at(h, h->data, pos));
+    }
+    else if (h->engine == HASHTABLE_FROZEN && h->frozen->mph)
+      PREFETCH(fz_disp(h->frozen) + mph_bucket(h->frozen, hv[i]));
+    else if (h->engine == HASHTABLE_FROZEN)
+      PREFETCH(fz_first(h->frozen) + fz_bucket(h->frozen, hv[i]));
+    else
+    {
+      p[i] = datum_at(h, h->data, bucket_index(h, hv[i], h->size));
+      PREFETCH(p[i]);
+    }
+    rets[i] = hashtable_ret_not_found;
+  }
+  if (flat_engine(h))
+  {
+    for (i = 0 ; i < n ; i++)
+    {
+      size_t j = (h->engine == HASHTABLE_SWISS ?
+                  sw_find(h, keys[i], len[i], hv[i]) :
+                  ck_find(h, keys[i], len[i], hv[i]));
+
+      if (j < h->size)
+      {
+        if (vals)
+          vals[i] = value_get(h, datum_at(h, h->data, j));
+        rets[i] = hashtable_ret_ok;
+        found += 1;
+      }
+    }
+    STAT_ADD(h, hits, found);
+    STAT_ADD(h, misses, n - found);
+    return found;
+  }
+  if (h->engine == HASHTABLE_FROZEN)
+  {
+    for (i = 0 ; i < n ; i++)
+      if (fz_get(h, keys[i], len[i], hv[i],
+                 (vals ? vals + i : NULL)) == hashtable_ret_ok)
+      {
+        rets[i] = hashtable_ret_ok;
+        found += 1;
+      }
+    return found;
+  }
+  STAT_ADD(h, searches, n);
+  STAT_ADD(h, probes, n);
+  for (i = 0 ; i < n ; i++)
+    if (!datum_is_set(p[i]))
+      p[i] = NULL;
+  do
+  {
+    active = 0;
+    for (i = 0 ; i < n ; i++)
+    {
+      datum_t *dp = p[i];
+
+      if (dp == NULL)
+        continue;
+      if (datum_hash(dp) == hv[i])
+      {
+        STAT_ADD(h, compares, 1);
+        if (datum_comp(dp, keys[i], len[i]) == 0)
+        {
+          if (vals)
+            vals[i] = value_get(h, dp);
+          rets[i] = hashtable_ret_ok;
+          found += 1;
+          p[i] = NULL;
+          continue;
+        }
+      }
+      p[i] = datum_next(dp);
+      if (p[i])
+      {
+        PREFETCH(p[i]);
+        STAT_ADD(h, probes, 1);
+        active += 1;
+      }
+    }
+  } while (active);
+  STAT_ADD(h, hits, found);
+  STAT_ADD(h, misses, n - found);
+  return found;
+}
+
+size_t
+hashtable_get_many(hashtable_t h, const char *const *keys, size_t n,
+                   void **vals, hashtable_ret_t *rets)
+{
+  hashtable_ret_t rbuf[GET_MANY_GROUP];
+  size_t found = 0;
+
+  for (size_t g = 0 ; g < n ; g += GET_MANY_GROUP)
+  {
+    size_t m = (n - g < GET_MANY_GROUP ? n - g : GET_MANY_GROUP);
+    hashtable_ret_t *r = (rets ? rets + g : rbuf);
+    void **v = (vals ? vals + g : NULL);
+
+    if (h->odata)
+    {				/* Incremental grow, two arrays to search */
+      for (size_t i = 0 ; i < m ; i++)
+      {
+        size_t len = strlen(keys[g + i]);
+
+        r[i] = get_hv(h, keys[g + i], len, hash_str(h, keys[g + i], len),
+                      (v ? v + i : NULL));
+        if (r[i] == hashtable_ret_ok)
+          found += 1;
+      }
+    }
+    else
+      found += get_group(h, keys + g, m, v, r);
+  }
+  return found;
+}
+
+/*
+** Building a table from arrays, see hashtable_build().
+**
+** First each thread hashes a range of the array, keeping the hash values
+** and lengths, and counts its keys by part, where a part is a range of
+** buckets, one per thread. Then the threads sort the indexes of their keys
+** into the parts, and finally each thread fills in the buckets of its
+** part. Since no two threads touch the same bucket, and each has an arena
+** of its own, nothing is locked. The keys of a part are in the order of
+** the array, so a later duplicate replaces an earlier one, like with puts.
+** The values replaced by duplicates are only destroyed when the whole
+** build has succeeded, so that a failed build leaves them all to the
+** caller.
+*/
+
+#define BUILD_MIN_KEYS    16384	/* The fewest keys worth a thread */
+#define BUILD_MAX_THREADS 256
+
+#define BUILD_COUNT 0		/* The phases */
+#define BUILD_SORT  1
+#define BUILD_FILL  2
+
+typedef struct build_key_s
+{
+  hashval_t hv;
+  size_t len;
+} build_key_t;
+
+/* Values replaced by duplicate keys, to destroy at the end */
+typedef struct build_olds_s
+{
+  void **vals;
+  size_t n, max;
+} build_olds_t;
+
+typedef struct build_job_s
+{
+  struct build_s *bp;
+  unsigned t;			/* The thread, and its part */
+  arena_t arena;		/* HASHTABLE_ARENA: its keys and nodes */
+  build_olds_t olds;
+  size_t count;			/* Keys added */
+  size_t allocs;
+  bool failed;
+} build_job_t;
+
+typedef struct build_s
+{
+  hashtable_t h;
+  const char *const *keys;
+  void *const *vals;
+  size_t n;
+  unsigned nthreads;
+  int phase;
+  size_t *pos;			/* For each thread and part, the count, and
+				** then where its next key goes in 'order' */
+  size_t *first;		/* Where each part starts in 'order' */
+  build_key_t *hkeys;		/* The hash value and length of each key */
+  size_t *order;		/* The indexes of the keys, by part */
+  build_job_t *jobs;
+} build_t;
+
+/* The part of the bucket of 'hv' */
+#define build_part(H, HV, NPARTS) \
+  (bucket_index((H), (HV), (H)->size) * (NPARTS) / (H)->size)
+
+/* Sets '*lenp' to the length of 'key'.
+** Returns false if it's not a key that can be put.
+*/
+static inline bool
+build_key_len(const char *key, size_t *lenp)
+{
+  return (key != NULL && key[0] != '\0' &&
+          (*lenp = strlen(key)) <= HKEY_MAXLEN);
+}
+
+/* Returns false if out of memory */
+static bool
+build_olds_add(build_olds_t *op, void *val)
+{
+  if (op->n == op->max)
+  {
+    size_t max = (op->max ? 2 * op->max : 64);
+    void **vals = realloc(op->vals, max * sizeof(void *));
+
+    if (vals == NULL)
+      return false;
+    op->vals = vals;
+    op->max = max;
+  }
+  op->vals[op->n++] = val;
+  return true;
+}
+
+/* Destroys the replaced values if the build went 'ok' */
+static void
+build_olds_done(hashtable_t h, build_olds_t *op, bool ok)
+{
+  if (ok && h->dfun)
+    for (size_t i = 0 ; i < op->n ; i++)
+      h->dfun (op->vals[i]);
+  free(op->vals);
+  memset(op, 0, sizeof(*op));
+}
+
+/* Puts a key into the table, touching only its bucket, and the arena 'ap'
+** (if not NULL), and counting in 'jp' instead of the table.
+** Returns false if out of memory.
+*/
+static bool
+build_put(hashtable_t h, build_job_t *jp, arena_t *ap,
+          const char *key, size_t len, hashval_t hv, void *val)
+{
+  datum_t *head = datum_at(h, h->data, bucket_index(h, hv, h->size));
+  datum_t *dp = head;
+
+  if (datum_is_set(head))
+  {
+    for ( ; dp ; dp = datum_next(dp))
+      if (datum_hash(dp) == hv && datum_comp(dp, key, len) == 0)
+      {				/* A duplicate, replace the value */
+        if (h->dfun && !build_olds_add(&jp->olds, datum_value(dp)))
+          return false;
+        datum_set_value(dp, val);
+        return true;
+      }
+    jp->allocs += node_allocates(ap);
+    if ((dp = node_alloc(ap, h->dsize)) == NULL)
+      return false;
+    memset(dp, 0, h->dsize);
+  }
+  jp->allocs += (len > HKEY_SHORT && !borrowed(h) &&
+                 (ap == NULL || len + 1 > ap->left));
+  if (!datum_set(ap, borrowed(h), dp, key, len, hv, val, NULL))
+  {
+    if (dp != head)
+      node_free(ap, dp);
+    return false;
+  }
+  if (dp != head)
+  {				/* Second in the chain */
+    datum_set_next(dp, datum_next(head));
+    datum_set_next(head, dp);
+  }
+  jp->count += 1;
+  return true;
+}
+
+/* One thread's share of the current phase */
+static void *
+build_work(void *arg)
+{
+  build_job_t *jp = arg;
+  build_t *bp = jp->bp;
+  hashtable_t h = bp->h;
+  size_t *pos = bp->pos + (size_t)jp->t * bp->nthreads;
+
+  if (bp->phase == BUILD_FILL)
+  {
+    arena_t *ap = (h->arena ? &jp->arena : NULL);
+
+    for (size_t e = bp->first[jp->t] ; e < bp->first[jp->t + 1] ; e++)
+    {
+      size_t i = bp->order[e];
+
+      if (!build_put(h, jp, ap, bp->keys[i], bp->hkeys[i].len,
+                     bp->hkeys[i].hv, (bp->vals ? bp->vals[i] : NULL)))
+      {
+        jp->failed = true;
+        break;
+      }
+    }
+    return NULL;
+  }
+  for (size_t i = bp->n * jp->t / bp->nthreads ;
+       i < bp->n * (jp->t + 1) / bp->nthreads ;
+       i++)
+  {
+    build_key_t *kp = bp->hkeys + i;
+
+    if (bp->phase == BUILD_COUNT)
+    {
+      if (!build_key_len(bp->keys[i], &kp->len))
+      {
+        jp->failed = true;
+        break;
+      }
+      kp->hv = hash_str(h, bp->keys[i], kp->len);
+      pos[build_part(h, kp->hv, bp->nthreads)] += 1;
+    }
+    else
+      bp->order[pos[build_part(h, kp->hv, bp->nthreads)]++] = i;
+  }
+  return NULL;
+}
+
+/* Runs a phase in all threads, the first in this one. If a thread can't be
+** started, its share is done here too.
+** Returns false if any of them failed.
+*/
+static bool
+build_run(build_t *bp, int phase)
+{
+  pthread_t tids[BUILD_MAX_THREADS];
+  bool started[BUILD_MAX_THREADS];
+
+  bp->phase = phase;
+  for (unsigned t = 1 ; t < bp->nthreads ; t++)
+    started[t] = (pthread_create(tids + t, NULL, build_work, bp->jobs + t)
+                  == 0);
+  build_work(bp->jobs);
+  for (unsigned t = 1 ; t < bp->nthreads ; t++)
+    if (started[t])
+      pthread_join(tids[t], NULL);
+    else
+      build_work(bp->jobs + t);
+  for (unsigned t = 0 ; t < bp->nthreads ; t++)
+    if (bp->jobs[t].failed)
+      return false;
+  return true;
+}
+
+/* Puts the keys one at a time, for small arrays, and the flat engines,
+** where a key can end up outside the part of its bucket. All the keys are
+** checked first, so nothing is put if one is bad.
+*/
+static bool
+build_serial(hashtable_t h, const char *const *keys, void *const *vals,
+             size_t n, build_olds_t *op)
+{
+  size_t len;
+
+  for (size_t i = 0 ; i < n ; i++)
+    if (!build_key_len(keys[i], &len))
+    {
+      errno = EINVAL;
+      return false;
+    }
+  for (size_t i = 0 ; i < n ; i++)
+  {
+    hashtable_ret_t ret;
+    void *old;
+
+    len = strlen(keys[i]);
+    ret = put_hv(h, keys[i], len, hash_str(h, keys[i], len),
+                 (vals ? vals[i] : NULL), &old);
+    if (ret == hashtable_ret_error ||
+        (ret == hashtable_ret_replaced && h->dfun && !build_olds_add(op, old)))
+      return false;
+  }
+  return true;
+}
+
+/* The threads, and their parts, in 'bp' */
+static bool
+build_parallel(build_t *bp)
+{
+  hashtable_t h = bp->h;
+  unsigned nt = bp->nthreads;
+  size_t at = 0;
+  bool ok;
+
+  bp->pos = calloc((size_t)nt * nt, sizeof(size_t));
+  bp->first = malloc((nt + 1) * sizeof(size_t));
+  bp->hkeys = malloc(bp->n * sizeof(build_key_t));
+  bp->order = malloc(bp->n * sizeof(size_t));
+  bp->jobs = calloc(nt, sizeof(build_job_t));
+  ok = (bp->pos && bp->first && bp->hkeys && bp->order && bp->jobs);
+  if (ok)
+  {
+    for (unsigned t = 0 ; t < nt ; t++)
+    {
+      bp->jobs[t].bp = bp;
+      bp->jobs[t].t = t;
+    }
+    ok = build_run(bp, BUILD_COUNT);
+    if (!ok)
+      errno = EINVAL;		/* A bad key */
+  }
+  if (ok)
+  {				/* Part by part, thread by thread */
+    for (unsigned p = 0 ; p < nt ; p++)
+    {
+      bp->first[p] = at;
+      for (unsigned t = 0 ; t < nt ; t++)
+      {
+        size_t c = bp->pos[(size_t)t * nt + p];
+
+        bp->pos[(size_t)t * nt + p] = at;
+        at += c;
+      }
+    }
+    bp->first[nt] = at;
+    (void)build_run(bp, BUILD_SORT);
+    ok = build_run(bp, BUILD_FILL);
+    for (unsigned t = 0 ; t < nt ; t++)
+    {
+      if (h->arena)
+        arena_join(h->arena, &bp->jobs[t].arena);
+      h->count += bp->jobs[t].count;
+      STAT_ADD(h, allocs, bp->jobs[t].allocs);
+      build_olds_done(h, &bp->jobs[t].olds, ok);
+    }
+    h->edits += 1;
+  }
+  free(bp->pos);
+  free(bp->first);
+  free(bp->hkeys);
+  free(bp->order);
+  free(bp->jobs);
+  return ok;
+}
+
+hashtable_t
+hashtable_build(const char *const *keys, void *const *vals, size_t n,
+                unsigned nthreads,
+                float minload, float maxload,
+                hashfunc_t *hfun, hashdestfunc_t *dfun,
+                unsigned flags)
+{
+  hashtable_t h;
+  size_t size;
+  bool ok;
+
+  fix_loads(&minload, &maxload);
+  /* Never smaller than a default table, which 0 gives */
+  size = (size_t)(n / minload) + 1;
+  if (size < 101)
+    size = 0;
+  h = create_table(size, minload, maxload,
+                   hfun, builtin_hfun_n(hfun), dfun, 0, flags);
+  if (h == NULL)
+    return NULL;
+  if (nthreads == 0)
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    nthreads = (ncpu > 0 ? (unsigned)ncpu : 1);
+  }
+  if (nthreads > n / BUILD_MIN_KEYS)
+    nthreads = (unsigned)(n / BUILD_MIN_KEYS);
+  if (nthreads > BUILD_MAX_THREADS)
+    nthreads = BUILD_MAX_THREADS;
+  if (nthreads <= 1 || h->engine != HASHTABLE_CHAIN)
+  {
+    build_olds_t olds = { NULL, 0, 0 };
+
+    ok = build_serial(h, keys, vals, n, &olds);
+    build_olds_done(h, &olds, ok);
+  }
+  else
+  {
+    build_t b;
+
+    b.h = h;
+    b.keys = keys;
+    b.vals = vals;
+    b.n = n;
+    b.nthreads = nthreads;
+    ok = build_parallel(&b);
+  }
+  if (!ok)
+  {
+    int e = errno;
+
+    h->dfun = NULL;		/* The values are still the caller's */
+    hashtable_destroy(h);
+    errno = e;
+    return NULL;
+  }
+  return h;
+}
+
+void
+hashtable_set_shrinkload(hashtable_t h, float shrinkload)
+{
+  if (shrinkload < 0 || shrinkload > h->minload / 2)
+    shrinkload = h->minload / 2;
+  h->shrinkload = shrinkload;
+}
+
+/* Returns hashtable_ret_error on failure.
+** Returns hashtable_ret_ok on success.
+*/
+hashtable_ret_t
+hashtable_shrink_to_fit(hashtable_t h)
+{
+  bool ok;
+
+  if (h->engine == HASHTABLE_FROZEN)
+    ok = true;			/* Already as compact as it gets */
+  else if (h->engine == HASHTABLE_SWISS)
+    ok = sw_resize(h, pow2_size((size_t) ((h->count + 1) / h->minload)));
+  else if (h->engine == HASHTABLE_CUCKOO)
+    ok = ck_resize(h, pow2_size((size_t) ((h->count + 1) / h->minload)));
+  else
+  {
+    size_t newsize = resize_size(h, 0); /* The default, if empty */
+
+    ok = (h->odata == NULL || hashtable_migrate(h, SIZE_MAX));
+    if (ok && newsize < h->size)
+      ok = hashtable_resize(h, newsize);
+  }
+  return (ok ? hashtable_ret_ok : hashtable_ret_error);
+}
+
+void
+hashtable_info(hashtable_t h,
+	       size_t *sizep, size_t *countp, size_t *slotsp, size_t *cmaxp)
+{
+  if (sizep)
+    *sizep = h->size;
+  if (countp)
+    *countp = h->count;
+  if (flat_engine(h))
+  {
+    if (slotsp)
+      *slotsp = h->count;	/* Each key has a slot of its own */
+    if (cmaxp)
+    {
+      size_t cmax = 0;
+
+      for (size_t i = 0 ; i < h->size ; i++)
+        if (sw_is_full(h->ctrl[i]))
+        {
+          size_t c = (h->engine == HASHTABLE_SWISS ? sw_probe_length(h, i) :
+                      ck_probe_length(h, i));
+
+          if (c > cmax)
+            cmax = c;
+        }
+      *cmaxp = cmax;
+    }
+    return;
+  }
+  if (h->engine == HASHTABLE_FROZEN && h->frozen->mph)
+  {				/* Every key in a slot of its own */
+    if (slotsp)
+      *slotsp = h->count;
+    if (cmaxp)
+      *cmaxp = (h->count > 0);
+    return;
+  }
+  if (h->engine == HASHTABLE_FROZEN)
+  {
+    const uint64_t *first = fz_first(h->frozen);
+    size_t i, cmax = 0, scount = 0;
+
+    for (i = 0 ; i < h->size ; i++)
+      if (first[i + 1] > first[i])
+      {
+        scount += 1;
+        if (first[i + 1] - first[i] > cmax)
+          cmax = first[i + 1] - first[i];
+      }
+    if (slotsp)
+      *slotsp = scount;
+    if (cmaxp)
+      *cmaxp = cmax;
+    return;
+  }
+  if (slotsp || cmaxp)
+  {
+    size_t i, cmax = 0, scount = 0;
+
+    /* Both arrays if there's an incremental grow going on */
+    for (i = 0 ; i < h->osize + h->size ; i++)
+    {
+      datum_t *dp = (i < h->osize ? datum_at(h, h->odata, i) :
+                     datum_at(h, h->data, i - h->osize));
+
+      if (datum_is_set(dp))
+      {
+	scount += 1;
+	if (cmaxp)
+	{
+	  size_t c = 0;
+	  while (dp)
+	  {
+	    c += 1;
+	    dp = datum_next(dp);
+	  }
+	  if (c > cmax)
+	    cmax = c;
+	}
+      }
+    }
+    if (slotsp)
+      *slotsp = scount;
+    if (cmaxp)
+      *cmaxp = cmax;
+  }
+}
+
+/* Counts a chain of length 'c' in the histogram */
+static inline void
+hist_add(size_t *hist, size_t n, size_t c, size_t *cmaxp)
+{
+  hist[c < n ? c : n - 1] += 1;
+  if (c > *cmaxp)
+    *cmaxp = c;
+}
+
+size_t
+hashtable_histogram(hashtable_t h, size_t *hist, size_t n)
+{
+  size_t i, cmax = 0;
+
+  memset(hist, 0, n * sizeof(size_t));
+  if (h->engine == HASHTABLE_SWISS)
+  {
+    for (i = 0 ; i < h->size ; i++)
+      if (sw_is_full(h->ctrl[i]))
+        hist_add(hist, n, sw_probe_length(h, i), &cmax);
+  }
+  else if (h->engine == HASHTABLE_CUCKOO)
+  {
+    for (i = 0 ; i < h->size ; i++)
+      if (sw_is_full(h->ctrl[i]))
+        hist_add(hist, n, ck_probe_length(h, i), &cmax);
+  }
+  else if (h->engine == HASHTABLE_FROZEN && h->frozen->mph)
+  {				/* One key per slot */
+    for (i = 0 ; i < h->size ; i++)
+      hist_add(hist, n, (i < h->count), &cmax);
+  }
+  else if (h->engine == HASHTABLE_FROZEN)
+  {
+    const uint64_t *first = fz_first(h->frozen);
+
+    for (i = 0 ; i < h->size ; i++)
+      hist_add(hist, n, first[i + 1] - first[i], &cmax);
+  }
+  else
+  {
+    for (i = 0 ; i < h->osize + h->size ; i++)
+    {
+      datum_t *dp = (i < h->osize ? datum_at(h, h->odata, i) :
+                     datum_at(h, h->data, i - h->osize));
+      size_t c = 0;
+
+      if (datum_is_set(dp))
+        for ( ; dp ; dp = datum_next(dp))
+          c += 1;
+      hist_add(hist, n, c, &cmax);
+    }
+  }
+  return cmax;
+}
+
+void
+hashtable_stats(hashtable_t h, hashtable_stats_t *statsp)
+{
+#if HASHTABLE_STATS
+  *statsp = h->stats;
+#else
+  memset(statsp, 0, sizeof(*statsp));
+#endif
+  statsp->size = h->size;
+  statsp->count = h->count;
+}
+
+void
+hashtable_stats_reset(hashtable_t h)
 {
-  datum_t *dp;
+#if HASHTABLE_STATS
+  memset(&h->stats, 0, sizeof(h->stats));
+#else
+  (void)h;
+#endif
+}
+
+/* Starts at the first bucket. During an incremental grow, that's the
+** first old bucket that's not moved yet, and the new buckets come after
+** the old ones.
+*/
+static void
+iter_start(hashtable_t h, hashtable_iter_t *iterp)
+{
+  iterp->old = (h->odata != NULL);
+  iterp->i = (h->odata ? h->migrate : 0);
+  iterp->n = 0;
+  iterp->msize = h->osize;
+  iterp->mlo = iterp->mhi = iterp->i;
+  iterp->size = h->size;
+  iterp->moves = h->moves;
+  iterp->kicks = h->kicks;
+  iterp->nback = 0;
+}
+
+void
+hashtable_iter_init(hashtable_t h, hashtable_iter_t *iterp)
+{
+  memset(iterp, 0, sizeof(*iterp));
+  iter_start(h, iterp);
+}
 
-  if (hashtable_find(h, key, &dp, NULL))
+/* Called when keys have been moved since the iterator last moved, by a
+** resize (or by too many cuckoo puts to keep track of). It starts over from
+** the first bucket, remembering the buckets it had passed, in the old size,
+** so that the keys that were in them can be skipped. Those are only the
+** ones that are known to have been returned, so some may be returned
+** again, but none are missed. A key's chain bucket, and its two cuckoo
+** buckets, only depend on the hash value and the size, but where a swiss
+** table key ends up also depends on the other keys, so those are all
+** returned again. If it was already skipping keys, it forgets about that,
+** which is fine, since the ones it had passed since then were returned,
+** or skipped. (In the old buckets of an incremental grow, the ones it has
+** passed are the ones the new buckets would skip.)
+** If an incremental grow has started since, the buckets it was in are now
+** the old ones, so it just goes on, skipping the keys moved from the ones
+** it had passed.
+*/
+static void
+iter_moved(hashtable_t h, hashtable_iter_t *iterp)
+{
+  if (!iterp->old && h->odata && h->osize == iterp->size &&
+      h->moves == iterp->moves + 1)
   {
-    if (valp)
-      *valp = datum_value(dp);
-    return hashtable_ret_ok;
+    iterp->old = 1;
+    iterp->msize = h->osize;
+    iterp->mlo = 0;
+    iterp->mhi = iterp->i;
+    iterp->size = h->size;
+    iterp->moves = h->moves;
+    return;
   }
-  return hashtable_ret_not_found;
+  if (iterp->old)
+  {
+    iterp->fsize = iterp->msize;
+    iterp->flo = iterp->mlo;
+    iterp->fhi = iterp->mhi;
+  }
+  else
+  {
+    iterp->fsize = (h->engine == HASHTABLE_SWISS ? 0 : iterp->size);
+    iterp->flo = 0;
+    iterp->fhi = iterp->i;	/* A partly done chain counts as not passed */
+  }
+  iter_start(h, iterp);
 }
 
-/* Returns hashtable_ret_not_found if not found
-** Returns hashtable_ret_ok if removed
+/* Called when the incremental grow has moved the old bucket the iterator
+** is in. The keys of that one, and the ones up to where the grow is now,
+** are in the new buckets, and will be returned there. If it has passed
+** no buckets yet, it starts counting the passed ones from there.
 */
-hashtable_ret_t
-hashtable_rem(hashtable_t h, const char *key, void **valp)
+static void
+iter_overtaken(hashtable_t h, hashtable_iter_t *iterp)
 {
-  datum_t *dp, *tmp;
+  iterp->n = 0;
+  if (h->odata == NULL)
+  {				/* All moved */
+    iterp->old = 0;
+    iterp->i = 0;
+    return;
+  }
+  iterp->i = h->migrate;
+  if (iterp->mlo == iterp->mhi)
+    iterp->mlo = iterp->mhi = iterp->i;
+}
+
+/* Whether the old bucket the iterator is in is still there */
+#define iter_in_place(H, ITERP) \
+  (!(ITERP)->old || ((H)->odata && (H)->migrate <= (ITERP)->i))
+
+/* Follows the keys moved by cuckoo puts since the iterator last moved.
+** The ones that went from ahead of the position to behind it are kept in
+** 'back', to be returned next. If there are too many of them, or the moves
+** are no longer in the log, it starts over as after a resize.
+*/
+static void
+iter_kicks(hashtable_t h, hashtable_iter_t *iterp)
+{
+  const size_t nmax = sizeof(iterp->back) / sizeof(iterp->back[0]);
 
-  if (hashtable_find(h, key, &dp, &tmp))
+  if (h->kicks - iterp->kicks > CK_LOG)
   {
-    if (valp)
-      *valp = datum_value(dp);	/* Return old value */
-    else if (h->dfun)
-      h->dfun (datum_value(dp)); /* Destroy old value */
-    if (!tmp)
-    {                           /* No previous pointer */
-      tmp = datum_next(dp);
-      datum_clear(dp);
-      if (tmp)
+    iter_moved(h, iterp);
+    return;
+  }
+  for ( ; iterp->kicks < h->kicks ; iterp->kicks++)
+  {
+    const size_t *lp = h->klog + 2 * (iterp->kicks % CK_LOG);
+    size_t k = 0;
+
+    while (k < iterp->nback && iterp->back[k] != lp[0])
+      k += 1;
+    if (k < iterp->nback)
+    {				/* One of them moved again */
+      if (lp[1] < iterp->i)
+        iterp->back[k] = lp[1];
+      else
+        iterp->back[k] = iterp->back[--iterp->nback];
+    }
+    else if (lp[0] >= iterp->i && lp[1] < iterp->i)
+    {
+      if (iterp->nback == nmax)
       {
-        datum_set(dp, datum_key(tmp), datum_value(tmp), datum_next(tmp));
-        datum_free(tmp);
+        iter_moved(h, iterp);
+        return;
       }
+      iterp->back[iterp->nback++] = lp[1];
     }
-    else
-    {				/* Has a previous pointer */
-      datum_set_next(tmp, datum_next(dp));
-      datum_free(dp);
-    }
-    h->count -= 1;
-    return hashtable_ret_ok;
   }
-  return hashtable_ret_not_found;
 }
 
-void
-hashtable_info(hashtable_t h,
-	       size_t *sizep, size_t *countp, size_t *slotsp, size_t *cmaxp)
+/* Whether 'dp' was in the buckets passed before the keys were moved.
+** (For cuckoo tables, 'flo' is always 0.)
+*/
+static bool
+iter_seen_moved(hashtable_t h, hashtable_iter_t *iterp, datum_t *dp)
 {
-  if (sizep)
-    *sizep = h->size;
-  if (countp)
-    *countp = h->count;
-  if (slotsp || cmaxp)
+  size_t b;
+
+  if (h->engine == HASHTABLE_CUCKOO)
+  {				/* Both buckets passed */
+    size_t passed = iterp->fhi / CK_WAYS;
+    size_t b1 = ck_bucket1(iterp->fsize, sw_mix(datum_hash(dp)));
+
+    return (b1 < passed &&
+            ck_bucket2(iterp->fsize, datum_key(dp), datum_len(dp), b1) <
+            passed);
+  }
+  b = bucket_index(h, datum_hash(dp), iterp->fsize);
+  return (iterp->flo <= b && b < iterp->fhi);
+}
+
+/* Whether 'dp' was moved from an old bucket that the iterator had passed */
+static inline bool
+iter_seen_migrated(hashtable_t h, hashtable_iter_t *iterp, datum_t *dp)
+{
+  size_t b = bucket_index(h, datum_hash(dp), iterp->msize);
+
+  return (iterp->mlo <= b && b < iterp->mhi);
+}
+
+#define iter_seen(H, ITERP, DP) \
+  (((ITERP)->fsize != 0 && iter_seen_moved((H), (ITERP), (DP))) || \
+   ((ITERP)->mlo != (ITERP)->mhi && iter_seen_migrated((H), (ITERP), (DP))))
+
+/* Returns the next datum, or NULL when there are no more.
+** The position is a bucket 'i', and the number of keys 'n' in its chain
+** that are done, not a pointer, so that the table can be changed between
+** calls. The next datum in the chain is kept too, but only used if nothing
+** was put or removed since. During an incremental grow, the old buckets
+** that are not moved yet come first, and then the new ones, skipping the
+** keys moved from old buckets that were passed. For the flat engines, 'i'
+** is the next slot.
+*/
+static datum_t *
+iter_next_datum(hashtable_t h, hashtable_iter_t *iterp)
+{
+  bool on;			/* Nothing changed since the last one */
+
+  on = (iterp->cur != 0 && iterp->edits == h->edits &&
+        iterp->moves == h->moves);
+  if (iterp->moves != h->moves)
+    iter_moved(h, iterp);
+  else if (iterp->kicks != h->kicks)
+    iter_kicks(h, iterp);
+  if (!iter_in_place(h, iterp))
   {
-    size_t i, cmax = 0, scount = 0;
+    iter_overtaken(h, iterp);
+    on = false;
+  }
+  iterp->cur = 0;
+  if (flat_engine(h))
+  {
+    while (iterp->nback > 0)
+    {
+      size_t j = iterp->back[--iterp->nback];
 
-    for (i = 0 ; i < h->size ; i++)
+      if (sw_is_full(h->ctrl[j]))
+      {
+        iterp->cur = j + 1;
+        iterp->edits = h->edits;
+        return datum_at(h, h->data, j);
+      }
+    }
+    while (iterp->i < h->size)
     {
-      datum_t *dp = h->data + i;
+      size_t j = (iterp->i)++;
 
-      if (datum_is_set(dp))
+      if (sw_is_full(h->ctrl[j]) &&
+          !iter_seen(h, iterp, datum_at(h, h->data, j)))
       {
-	scount += 1;
-	if (cmaxp)
-	{
-	  size_t c = 0;
-	  while (dp)
-	  {
-	    c += 1;
-	    dp = datum_next(dp);
-	  }
-	  if (c > cmax)
-	    cmax = c;
-	}
+        iterp->cur = j + 1;
+        iterp->edits = h->edits;
+        return datum_at(h, h->data, j);
       }
     }
-    if (slotsp)
-      *slotsp = scount;
-    if (cmaxp)
-      *cmaxp = cmax;
+    return NULL;
+  }
+  for (;;)
+  {
+    datum_t *data = (iterp->old ? h->odata : h->data);
+    size_t size = (iterp->old ? h->osize : h->size);
+
+    for ( ; iterp->i < size ; iterp->i++, iterp->n = 0)
+    {
+      datum_t *dp;
+
+      if (on)
+        dp = (datum_t *)iterp->p;
+      else
+      {
+        dp = datum_at(h, data, iterp->i);
+        if (! datum_is_set(dp))
+          dp = NULL;
+        for (size_t k = 0 ; dp && k < iterp->n ; k++)
+          dp = datum_next(dp);
+      }
+      for ( ; dp ; dp = datum_next(dp))
+      {
+        iterp->n += 1;
+        if (!iter_seen(h, iterp, dp))
+        {
+          iterp->cur = 1;
+          iterp->p = datum_next(dp);
+          iterp->edits = h->edits;
+          return dp;
+        }
+      }
+      on = false;
+      if (iterp->old && iterp->mhi == iterp->i)
+        iterp->mhi += 1;	/* Passed, unless it was overtaken */
+    }
+    if (!iterp->old)
+      return NULL;
+    iterp->old = 0;		/* On to the new buckets */
+    iterp->i = 0;
+    iterp->n = 0;
   }
 }
 
-void
-hashtable_iter_init(hashtable_t h, hashtable_iter_t *iterp)
+hashtable_ret_t
+hashtable_iter_rem(hashtable_t h, hashtable_iter_t *iterp)
+{
+  if (h->engine == HASHTABLE_FROZEN)
+    return hashtable_ret_error;	/* Read-only */
+  /* Nothing added, removed or moved since it was returned */
+  if (iterp->cur == 0 || iterp->edits != h->edits ||
+      iterp->moves != h->moves || !iter_in_place(h, iterp))
+    return hashtable_ret_not_found;
+  if (h->engine == HASHTABLE_SWISS)
+    sw_rem_slot(h, iterp->cur - 1, NULL);
+  else if (h->engine == HASHTABLE_CUCKOO)
+    ck_rem_slot(h, iterp->cur - 1, NULL);
+  else
+  {				/* The n:th in the chain, the next takes its place */
+    datum_t *dp = datum_at(h, (iterp->old ? h->odata : h->data), iterp->i);
+    datum_t *prevp = NULL;
+
+    for (size_t k = 1 ; k < iterp->n ; k++)
+    {
+      prevp = dp;
+      dp = datum_next(dp);
+    }
+    chain_rem(h, dp, prevp, NULL);
+    iterp->n -= 1;
+  }
+  iterp->cur = 0;
+  return hashtable_ret_ok;
+}
+
+/* Returns the next key, its length and value, or false when there are
+** no more. The hash value is only set if 'hvp' is not NULL, since for a
+** frozen table with a minimal perfect hash, the key is hashed for it.
+*/
+static bool
+iter_next_kv(hashtable_t h, hashtable_iter_t *iterp,
+             const char **keyp, size_t *lenp, void **valuep, hashval_t *hvp)
 {
-  (void)h;			/* Unused */
-  iterp->i = 0;
-  iterp->p = NULL;
+  datum_t *dp;
+
+  if (h->engine == HASHTABLE_FROZEN)
+  {				/* Simply the entries in order */
+    const fentry_t *ep;
+
+    if (iterp->i >= h->count)
+      return false;
+    ep = fz_ents(h->frozen) + (iterp->i)++;
+    *keyp = fz_keys(h->frozen) + ep->koff;
+    *lenp = ep->len;
+    *valuep = fz_value(h->frozen, ep);
+    if (hvp && h->frozen->mph)	/* The table's own hash value */
+      *hvp = (h->hfun_n ? h->hfun_n(*keyp, ep->len) : h->hfun(*keyp));
+    else if (hvp)
+      *hvp = ep->hash;
+    return true;
+  }
+  dp = iter_next_datum(h, iterp);
+  if (dp == NULL)
+    return false;
+  *keyp = datum_key(dp);
+  *lenp = datum_len(dp);
+  *valuep = value_get(h, dp);
+  if (hvp != NULL)
+    *hvp = datum_hash(dp);
+  return true;
 }
 
 /* Returns true if a next value was found, with *keyp and *valuep
@@ -618,29 +3770,468 @@ bool
 hashtable_iter_next(hashtable_t h, hashtable_iter_t *iterp,
                     const char **keyp, void **valuep)
 {
-  datum_t *dp;
+  const char *key;
+  size_t len;
+  void *val;
+
+  if (!iter_next_kv(h, iterp, &key, &len, &val, NULL))
+    return false;
+  if (keyp != NULL)
+    *keyp = key;
+  if (valuep != NULL)
+    *valuep = val;
+  return true;
+}
+
+bool
+hashtable_iter_next_n(hashtable_t h, hashtable_iter_t *iterp,
+                      const void **keyp, size_t *lenp, void **valuep)
+{
+  const char *key;
+  size_t len;
+  void *val;
+
+  if (!iter_next_kv(h, iterp, &key, &len, &val, NULL))
+    return false;
+  if (keyp != NULL)
+    *keyp = key;
+  if (lenp != NULL)
+    *lenp = len;
+  if (valuep != NULL)
+    *valuep = val;
+  return true;
+}
+
+static uint64_t
+fz_hash_id(hashtable_t h)
+{
+  if (h->hfun_n == hash_mem_fast)
+    return FZ_HASH_FAST;
+  if (h->hfun_n == hash_mem_good)
+    return FZ_HASH_GOOD;
+  if (h->hfun_n == hash_mem_wy)
+    return FZ_HASH_WY;
+  return FZ_HASH_CUSTOM;
+}
+
+/* Finds a displacement for each MPH bucket, so that all keys get slots of
+** their own, and sets 'slotof[j]' to the slot of the j:th key, in iteration
+** order. The buckets are placed from the largest to the smallest, while
+** there are still many free slots. If two keys in a bucket happen to get
+** the same hash value, or a bucket doesn't fit, it starts over with a new
+** seed.
+** Returns false if out of memory, or no seed worked (with errno EINVAL).
+*/
+static bool
+mph_place(hashtable_t h, frozen_t *fz, uint32_t *slotof)
+{
+  size_t n = fz->count, nb = fz->mph, maxsize, b, i, j;
+  uint64_t limit = 16 * (uint64_t)n + 1024; /* Tries per bucket */
+  hashval_t *hvs = malloc(n * sizeof(hashval_t));
+  size_t *start = malloc((nb + 1) * sizeof(size_t));
+  size_t *order = malloc(nb * sizeof(size_t));
+  uint32_t *keys = malloc(n * sizeof(uint32_t));
+  uint8_t *taken = malloc(n);
+  size_t *bysize = NULL;
+  uint32_t *disp = fz_disp(fz);
+  hashtable_iter_t iter;
+  const char *key;
+  size_t len;
+  void *val;
+  bool ok = false;
 
-  if (iterp->p != NULL)
+  if (limit > UINT32_MAX)
+    limit = UINT32_MAX;
+  if (hvs == NULL || start == NULL || order == NULL || keys == NULL ||
+      taken == NULL)
+    goto done;
+  fz->seed = FIB_MULT;
+  for (int attempt = 0 ; attempt < MPH_SEEDS && !ok ; attempt++)
   {
-    dp = (datum_t *)iterp->p;
-    if (keyp != NULL)
-      *keyp = datum_key(dp);
-    if (valuep != NULL)
-      *valuep = datum_value(dp);
-    iterp->p = datum_next(dp);
-    return true;
+    if (attempt > 0)
+      fz->seed = wy_mix(fz->seed ^ Wy_secret[2], Wy_secret[3]);
+
+    /* The keys sorted by bucket */
+    memset(start, 0, (nb + 1) * sizeof(size_t));
+    j = 0;
+    hashtable_iter_init(h, &iter);
+    while (iter_next_kv(h, &iter, &key, &len, &val, NULL))
+    {
+      hvs[j] = wy_hash(key, len, fz->seed);
+      start[mph_bucket(fz, hvs[j]) + 1] += 1;
+      j += 1;
+    }
+    for (b = 1 ; b <= nb ; b++)
+      start[b] += start[b - 1];
+    for (j = 0 ; j < n ; j++)
+      keys[start[mph_bucket(fz, hvs[j])]++] = (uint32_t)j;
+    memmove(start + 1, start, nb * sizeof(size_t));
+    start[0] = 0;
+
+    /* The buckets sorted by decreasing size */
+    maxsize = 0;
+    for (b = 0 ; b < nb ; b++)
+      if (start[b + 1] - start[b] > maxsize)
+        maxsize = start[b + 1] - start[b];
+    free(bysize);
+    bysize = calloc(maxsize + 2, sizeof(size_t));
+    if (bysize == NULL)
+      goto done;
+    for (b = 0 ; b < nb ; b++)
+      bysize[maxsize - (start[b + 1] - start[b]) + 1] += 1;
+    for (i = 1 ; i <= maxsize + 1 ; i++)
+      bysize[i] += bysize[i - 1];
+    for (b = 0 ; b < nb ; b++)
+      order[bysize[maxsize - (start[b + 1] - start[b])]++] = b;
+
+    memset(taken, 0, n);
+    ok = true;
+    for (i = 0 ; i < nb && ok ; i++)
+    {
+      size_t size = start[order[i] + 1] - start[order[i]];
+      const uint32_t *kp = keys + start[order[i]];
+      uint64_t d;
+
+      disp[order[i]] = 0;
+      for (j = 0 ; j < size && ok ; j++)
+        for (size_t k = 0 ; k < j ; k++)
+          if (hvs[kp[j]] == hvs[kp[k]])
+            ok = false;		/* Never separable */
+      for (d = 0 ; d < limit && ok && size > 0 ; d++)
+      {
+        for (j = 0 ; j < size ; j++)
+        {
+          size_t slot = mph_slot(fz, hvs[kp[j]], (uint32_t)d);
+
+          if (taken[slot])
+            break;
+          taken[slot] = 1;
+          slotof[kp[j]] = (uint32_t)slot;
+        }
+        if (j == size)
+        {			/* They all fit */
+          disp[order[i]] = (uint32_t)d;
+          break;
+        }
+        while (j-- > 0)
+          taken[slotof[kp[j]]] = 0;
+      }
+      if (d == limit)
+        ok = false;
+    }
   }
-  while (iterp->i < h->size)
+  if (!ok)
+    errno = EINVAL;
+ done:
+  free(bysize);
+  free(taken);
+  free(keys);
+  free(order);
+  free(start);
+  free(hvs);
+  return ok;
+}
+
+/* Freezes the contents of 'h' into a new block. If 'vsize' > 0, the values
+** point to 'vsize' bytes each, which are copied into the block. If 'mph'
+** is true, it's a minimal perfect hash table.
+** Returns NULL if out of memory, or a minimal perfect hash function
+** couldn't be found, with errno set.
+*/
+static frozen_t *
+freeze(hashtable_t h, size_t vsize, bool mph)
+{
+  size_t log2 = 0, nb = 0, keybytes = 0, size = 0;
+  size_t index, voff, stride, bytes, n, i;
+  hashtable_iter_t iter;
+  const char *key;
+  size_t len;
+  void *val;
+  hashval_t hv;
+  frozen_t *fz;
+  uint32_t *slotof = NULL;
+  uint64_t *first;
+  fentry_t *ents;
+  char *keys;
+
+  hashtable_iter_init(h, &iter);
+  while (iter_next_kv(h, &iter, &key, &len, &val, NULL))
+    keybytes += len + 1;
+  if (mph)
   {
-    dp = h->data + (iterp->i)++;
-    if (! datum_is_set(dp))
-      continue;
-    if (keyp != NULL)
-      *keyp = datum_key(dp);
-    if (valuep != NULL)
-      *valuep = datum_value(dp);
-    iterp->p = datum_next(dp);
-    return true;
+    if (h->count > UINT32_MAX)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+    nb = (h->count + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS + (h->count == 0);
+    index = fz_index_bytes(0, nb);
   }
-  return false;
+  else
+  {
+    size = pow2_size(h->count);
+    log2 = size_log2(size);
+    index = fz_index_bytes(log2, 0);
+  }
+  stride = FZ_ALIGN(vsize);
+  voff = fz_voff(index, h->count, keybytes);
+  bytes = fz_bytes(index, h->count, keybytes, stride);
+  /* Zeroed, so that the padding is too, in a saved file */
+  fz = calloc(1, bytes);
+  if (fz == NULL)
+    return NULL;
+  fz->magic = FZ_MAGIC;
+  fz->bytes = bytes;
+  fz->log2 = log2;
+  fz->count = h->count;
+  fz->keybytes = keybytes;
+  fz->vsize = stride;
+  fz->hash = fz_hash_id(h);
+  fz->mph = nb;
+  first = fz_first(fz);
+  ents = fz_ents(fz);
+  keys = fz_keys(fz);
+
+  if (mph)
+  {
+    slotof = malloc(h->count * sizeof(uint32_t) + 1);
+    if (slotof == NULL || !mph_place(h, fz, slotof))
+    {
+      free(slotof);
+      free(fz);
+      return NULL;
+    }
+  }
+  else
+  {
+    /* Count the entries per bucket, shifted one step, so that the running
+    ** sum gives the start of each bucket, and use those as fill positions.
+    ** Then each one is the start of the next bucket, so shift them back.
+    */
+    hashtable_iter_init(h, &iter);
+    while (iter_next_kv(h, &iter, &key, &len, &val, &hv))
+      first[fz_bucket(fz, hv) + 1] += 1;
+    for (i = 1 ; i <= size ; i++)
+      first[i] += first[i - 1];
+  }
+  keybytes = 0;
+  n = 0;
+  hashtable_iter_init(h, &iter);
+  while (iter_next_kv(h, &iter, &key, &len, &val, (mph ? NULL : &hv)))
+  {
+    fentry_t *ep;
+
+    if (mph)
+    {
+      ep = ents + slotof[n];
+      ep->hash = wy_hash(key, len, fz->seed);
+    }
+    else
+    {
+      ep = ents + first[fz_bucket(fz, hv)]++;
+      ep->hash = hv;
+    }
+    ep->koff = keybytes;
+    ep->len = len;
+    memcpy(keys + keybytes, key, len + 1);
+    keybytes += len + 1;
+    if (vsize)
+    {				/* NULL values become zeros */
+      ep->value = voff + n * stride;
+      if (val)
+        memcpy((char *)fz + ep->value, val, vsize);
+    }
+    else
+      ep->value = (uint64_t)(uintptr_t)val;
+    n += 1;
+  }
+  if (!mph)
+  {
+    memmove(first + 1, first, size * sizeof(uint64_t));
+    first[0] = 0;
+  }
+  free(slotof);
+  return fz;
+}
+
+/* A frozen table for the block 'fz', which is mapped if 'maplen' > 0.
+** 'vsize' is the size of the value blobs, for hashtable_get_value().
+*/
+static hashtable_t
+fz_table(frozen_t *fz, hashfunc_t *hfun, hashfunc_n_t *hfun_n,
+         size_t vsize, size_t maplen)
+{
+  hashtable_t h = malloc(sizeof(struct hashtable_s));
+
+  if (h)
+  {
+    memset(h, 0, sizeof(struct hashtable_s));
+    h->engine = HASHTABLE_FROZEN;
+    if (fz->mph)
+      h->size = h->initsize = (fz->count > 0 ? fz->count : 1);
+    else
+      h->size = h->initsize = (size_t)1 << fz->log2;
+    h->count = fz->count;
+    h->minload = 0.5;
+    h->maxload = 0.8;
+    h->hfun = hfun;
+    h->hfun_n = hfun_n;
+    h->vsize = vsize;
+    h->dsize = sizeof(datum_t);
+    h->frozen = fz;
+    h->maplen = maplen;
+    STAT_ADD(h, allocs, (maplen ? 1 : 2));
+  }
+  return h;
+}
+
+hashtable_t
+hashtable_freeze(hashtable_t h)
+{
+  frozen_t *fz = freeze(h, h->vsize, false);
+  hashtable_t fh;
+
+  if (fz == NULL)
+    return NULL;
+  fh = fz_table(fz, h->hfun, h->hfun_n, h->vsize, 0);
+  if (fh == NULL)
+    free(fz);
+  return fh;
+}
+
+hashtable_t
+hashtable_freeze_mph(hashtable_t h)
+{
+  frozen_t *fz = freeze(h, h->vsize, true);
+  hashtable_t fh;
+
+  if (fz == NULL)
+    return NULL;
+  fh = fz_table(fz, h->hfun, h->hfun_n, h->vsize, 0);
+  if (fh == NULL)
+    free(fz);
+  return fh;
+}
+
+hashtable_ret_t
+hashtable_save(hashtable_t h, int fd, size_t vsize)
+{
+  frozen_t *fz = NULL;
+  const char *p;
+  size_t left;
+
+  if (h->vsize)
+    vsize = h->vsize;		/* Inline values are always blobs */
+  if (h->engine == HASHTABLE_FROZEN && h->frozen->vsize == FZ_ALIGN(vsize))
+    p = (const char *)h->frozen; /* Already the right format */
+  else
+  {
+    fz = freeze(h, vsize, h->frozen && h->frozen->mph);
+    if (fz == NULL)
+      return hashtable_ret_error;
+    p = (const char *)fz;
+  }
+  left = ((const frozen_t *)p)->bytes;
+  while (left > 0)
+  {
+    ssize_t n = write(fd, p, left);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      free(fz);
+      return hashtable_ret_error;
+    }
+    p += n;
+    left -= (size_t)n;
+  }
+  free(fz);
+  return hashtable_ret_ok;
+}
+
+/* Opens a saved table, with the hash function 'hfun' or 'hfun_n' (at
+** most one of them), if it's a custom one.
+*/
+static hashtable_t
+open_mmap(const char *path, hashfunc_t *hfun, hashfunc_n_t *hfun_n)
+{
+  static struct
+  {
+    hashfunc_t *hfun;
+    hashfunc_n_t *hfun_n;
+  } builtin[] = { { NULL, NULL },
+                  { hash_string_fast, hash_mem_fast },
+                  { hash_string_good, hash_mem_good },
+                  { hash_string_wy, hash_mem_wy } };
+  struct stat st;
+  frozen_t *fz;
+  hashtable_t h;
+  size_t bytes;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size < (off_t)sizeof(frozen_t) || (uintmax_t)st.st_size > SIZE_MAX)
+  {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  bytes = (size_t)st.st_size;
+  fz = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (fz == MAP_FAILED)
+    return NULL;
+  if (!fz_valid(fz, bytes) ||
+      (fz->hash == FZ_HASH_CUSTOM ?
+       hfun == NULL && hfun_n == NULL :
+       (hfun != NULL && hfun != builtin[fz->hash].hfun) ||
+       (hfun_n != NULL && hfun_n != builtin[fz->hash].hfun_n)))
+  {				/* Not a table, or the wrong hash function */
+    munmap(fz, bytes);
+    errno = EINVAL;
+    return NULL;
+  }
+  if (fz->hash != FZ_HASH_CUSTOM)
+  {
+    hfun = builtin[fz->hash].hfun;
+    hfun_n = builtin[fz->hash].hfun_n;
+  }
+  h = fz_table(fz, hfun, hfun_n, (size_t)fz->vsize, bytes);
+  if (h == NULL)
+  {
+    munmap(fz, bytes);
+    return NULL;
+  }
+  if (fz->count > 0 && fz->mph == 0)
+  {				/* A custom hash function must give the same */
+    const fentry_t *ep = fz_ents(fz);
+
+    if (ep->koff + ep->len >= fz->keybytes ||
+        hash_str(h, fz_keys(fz) + ep->koff, ep->len) != ep->hash)
+    {
+      hashtable_destroy(h);
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+  return h;
+}
+
+hashtable_t
+hashtable_open_mmap(const char *path, hashfunc_t *hfun)
+{
+  return open_mmap(path, hfun, NULL);
+}
+
+hashtable_t
+hashtable_open_mmap_n(const char *path, hashfunc_n_t *hfun)
+{
+  return open_mmap(path, NULL, hfun);
 }
@@ -10,15 +10,37 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct hashtable_s *hashtable_t;
 
+/* An iterator, a position in the table. The only pointer into the table
+** it holds is not used after the table is changed, so it can be kept
+** between calls while it is, see hashtable_iter_next().
+*/
 typedef struct hashtable_iter_s
 {
-    size_t i;
-    void *p;
+    size_t i;                   /* The bucket, or next slot */
+    size_t n;                   /* Chain engine: the keys of it done, */
+    int old;                    /* if it's an old bucket of a grow, and */
+    void *p;                    /* the next key's datum */
+    size_t cur;                 /* The current key, 1 + its slot, 0 if none */
+    size_t edits;               /* The table's edits, when 'cur' was set */
+    size_t size;                /* The table's size, and number of times */
+    size_t moves;               /* keys were moved, when last checked */
+    size_t fsize;               /* After keys were moved: the keys in */
+    size_t flo, fhi;            /* buckets 'flo' to 'fhi' of 'fsize' done */
+    size_t msize;               /* Incremental grow: keys moved from old */
+    size_t mlo, mhi;            /* buckets 'mlo' to 'mhi' are done */
+    size_t kicks;               /* Cuckoo: the keys moved by puts, and */
+    size_t back[4];             /* the slots of ones moved behind 'i' */
+    size_t nback;
 } hashtable_iter_t;
 
-typedef uint32_t hashval_t;
+/* 64 bits, so that tables can have more than 4G buckets */
+typedef uint64_t hashval_t;
 
 typedef enum hashtable_ret_e
   {
@@ -32,6 +54,10 @@ typedef enum hashtable_ret_e
 typedef hashval_t
 hashfunc_t(const char *s);
 
+/* The type for a hash function for binary keys of length 'len' */
+typedef hashval_t
+hashfunc_n_t(const void *key, size_t len);
+
 /* A type for a destructor function for the value data */
 typedef void
 hashdestfunc_t(void *);
@@ -41,15 +67,36 @@ extern hashval_t
 hash_string_fast(const char *s);
 
 /* This one is very good, esp. on difficults sets of keys, but
-** about twice as slow as hash_string_fast()
+** about twice as slow as hash_string_fast(). It only gives 32-bit values.
 */
 extern hashval_t
 hash_string_good(const char *s);
 
+/* wyhash, a very good and fast 64-bit hash function, that reads the key
+** a word at a time. It's the fastest of these for keys longer than a few
+** bytes.
+*/
+extern hashval_t
+hash_string_wy(const char *s);
+
+/* The same functions for binary keys. For keys without nul bytes, they
+** give the same values as the string versions.
+*/
+extern hashval_t
+hash_mem_fast(const void *key, size_t len);
+
+extern hashval_t
+hash_mem_good(const void *key, size_t len);
+
+extern hashval_t
+hash_mem_wy(const void *key, size_t len);
+
 /* Create a hashtable. The 'initsize' is the initial size of the table.
 ** When the load (the number of keys / the size), of the table reaches
 ** 'maxload', the table grows so that the load will become 'minload'.
 ** Default values for 'minload' and 'maxload' are 0.5 and 0.8 respectively.
+** When keys are removed, the table also shrinks, see
+** hashtable_set_shrinkload().
 ** 'hfun' is the string hashfunction to use (default is hash_string_fast).
 ** 'dfun' is the optional destructor function for value data. It's called
 ** for values that are removed from the table, and when the table is
@@ -59,6 +106,116 @@ extern hashtable_t
 hashtable_create(size_t initsize, float minload, float maxload,
 		 hashfunc_t *hfun,
 		 hashdestfunc_t *dfun);
+/* Flags for hashtable_create_ext(). The engine decides the table layout,
+** the rest of the API is the same regardless of engine.
+*/
+#define HASHTABLE_CHAIN      0x0000 /* Buckets with collision chains (default) */
+#define HASHTABLE_SWISS      0x0001 /* Open addressing, with 7-bit hash tags
+                                    ** probed 16 at a time (SIMD when
+                                    ** available). No allocation per
+                                    ** collision, and the size is always a
+                                    ** power of two. */
+#define HASHTABLE_FROZEN     0x0002 /* Read-only, compact, see
+                                    ** hashtable_freeze(). Can't be given
+                                    ** to hashtable_create_ext(). */
+#define HASHTABLE_CUCKOO     0x0003 /* Bucketized cuckoo hashing: every key
+                                    ** is in one of two buckets of 4 slots,
+                                    ** so a get never checks more than 8
+                                    ** slots. A put kicks keys on to their
+                                    ** other buckets to make room, or grows
+                                    ** the table. The size is always a
+                                    ** power of two. The second bucket
+                                    ** comes from a hash of the key itself,
+                                    ** which is computed even when the
+                                    ** hash value is given, see
+                                    ** hashtable_get_hash(). */
+#define HASHTABLE_ENGINE_MASK 0x000F
+#define HASHTABLE_INCREMENTAL 0x0010 /* Chain engine: grow incrementally.
+                                     ** The old and new buckets are kept
+                                     ** side by side, and each put, get and
+                                     ** rem moves a few buckets, instead of
+                                     ** moving all at once in one put. */
+#define HASHTABLE_ARENA      0x0020 /* Allocate long keys and chain nodes
+                                    ** from per table pools, freed all at
+                                    ** once when the table is cleared or
+                                    ** destroyed. The space of removed keys
+                                    ** is not reused until then. */
+#define HASHTABLE_POW2       0x0040 /* Chain engine: power of two sizes,
+                                    ** with the bucket taken from the top
+                                    ** bits of the hash value times a
+                                    ** constant, instead of a division. */
+#define HASHTABLE_BORROW     0x0080 /* Don't copy keys: the table only
+                                    ** points to the caller's keys, which
+                                    ** must stay unchanged for as long as
+                                    ** they are in the table. (Keys of up
+                                    ** to 7 bytes are still copied into
+                                    ** the table, which costs nothing.)
+                                    ** Binary keys are not nul terminated
+                                    ** by the table then, unless they
+                                    ** were already. */
+
+/* Like hashtable_create(), but with 'flags' (see above) selecting the
+** engine and other options.
+*/
+extern hashtable_t
+hashtable_create_ext(size_t initsize, float minload, float maxload,
+                     hashfunc_t *hfun,
+                     hashdestfunc_t *dfun,
+                     unsigned flags);
+
+/* Like hashtable_create_ext(), but with a hash function for binary keys.
+** (The default is hash_mem_fast.)
+** Tables created with a string hash function can also be used with binary
+** keys, but if it's not one of the builtin ones, the hashtable_*_n()
+** functions have to make a nul terminated copy of the key to hash it.
+*/
+extern hashtable_t
+hashtable_create_n(size_t initsize, float minload, float maxload,
+                   hashfunc_n_t *hfun,
+                   hashdestfunc_t *dfun,
+                   unsigned flags);
+
+/* Like hashtable_create_ext(), but the values are 'vsize' bytes each
+** (at least 1), which are stored inline, next to the key, instead of a
+** pointer. A put copies 'vsize' bytes from where 'val' points (or zeros,
+** if it's NULL), and a get sets '*valuep' to point to the bytes in the
+** table, which are only valid until the next change of the table, so
+** hashtable_get_value() is usually more convenient. The same goes for
+** iterators, and hashtable_upsert() points '*slotp' to the bytes.
+** Since there is nothing to hand back, hashtable_put() with an 'oldvalp',
+** and hashtable_rem() with a 'valuep', return hashtable_ret_error.
+** Values up to the size of a pointer take no extra space. Frozen copies
+** and saved tables keep the values as blobs of the same size.
+*/
+extern hashtable_t
+hashtable_create_inline(size_t initsize, float minload, float maxload,
+                        hashfunc_t *hfun,
+                        size_t vsize,
+                        unsigned flags);
+
+/* Builds a table of the 'n' keys in 'keys', with the values in 'vals' (or
+** all NULL, if 'vals' is NULL), like hashtable_create_ext() followed by a
+** hashtable_put() of each key in order, but sized for 'n' keys from the
+** start, so it never grows. For the chain engine, the keys are hashed and
+** sorted by bucket with 'nthreads' threads (0 for one per CPU), and then
+** each thread fills in a range of buckets of its own, without locking.
+** (Fewer threads are used for fewer keys.) The other engines put the keys
+** one at a time. It takes 24 bytes per key of temporary memory with
+** threads, and the hash function can be called by several of them at the
+** same time.
+** When a key is given more than once, the last value is kept, and the
+** destructor is called for the others, but only when the whole table has
+** been built.
+** Returns NULL if out of memory, or if a key is NULL or empty, with errno
+** set (EINVAL for a bad key). No values are destroyed then.
+*/
+extern hashtable_t
+hashtable_build(const char *const *keys, void *const *vals, size_t n,
+                unsigned nthreads,
+                float minload, float maxload,
+                hashfunc_t *hfun, hashdestfunc_t *dfun,
+                unsigned flags);
+
 /* Create with just default values */
 #define hashtable_create_default() hashtable_create(0, 0, 0, NULL, NULL)
 /* Create with default values and a destructor */
@@ -95,6 +252,17 @@ hashtable_put(hashtable_t h, const char *key, void *val, void **oldvalp);
 hashtable_ret_t
 hashtable_get(hashtable_t h, const char *key, void **valuep);
 
+/* Like hashtable_get(), but copies the value to 'valp' (unless NULL):
+** the 'vsize' bytes of an inline value (see hashtable_create_inline()),
+** otherwise the void * itself. For a table opened with
+** hashtable_open_mmap() with values saved as blobs, it's the blob size
+** rounded up to a multiple of 8.
+** Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if found, and the value copied.
+*/
+hashtable_ret_t
+hashtable_get_value(hashtable_t h, const char *key, void *valp);
+
 /* Removes the 'key' (and its value of course) from the table.
 ** If 'valuep' is not NULL, '*valuep' is set to the value and
 ** the destructor is not called even if there is one.
@@ -106,6 +274,113 @@ hashtable_get(hashtable_t h, const char *key, void **valuep);
 hashtable_ret_t
 hashtable_rem(hashtable_t h, const char *key, void **valuep);
 
+/* Looks up 'key', and inserts it with a NULL value if it's not in the
+** table, with a single search. '*slotp' is set to point to the value in
+** the table, so that the caller can read and update it in place, e.g.
+** to count keys:
+**
+**   if (hashtable_upsert(h, word, &slot, NULL) == hashtable_ret_ok)
+**     *slot = (void *)((uintptr_t)*slot + 1);
+**
+** The pointer is only valid until the next call with the table (since
+** keys can move on any change, and also on gets while an incremental grow
+** is in progress). If 'insertedp' is not NULL, '*insertedp' is set to
+** whether the key was inserted. The destructor is never called.
+** Returns hashtable_ret_error on failure.
+** Returns hashtable_ret_ok on success.
+*/
+extern hashtable_ret_t
+hashtable_upsert(hashtable_t h, const char *key,
+                 void ***slotp, bool *insertedp);
+
+/* Sets the load below which the table shrinks when keys are removed.
+** It shrinks so that the load becomes 'minload', the same as after a grow,
+** which gives a margin against resizing back and forth. The default is
+** 'minload' / 4, and it's never more than 'minload' / 2. 0 turns automatic
+** shrinking off. A table never shrinks automatically below the initial
+** size given to hashtable_create().
+*/
+extern void
+hashtable_set_shrinkload(hashtable_t h, float shrinkload);
+
+/* Shrinks the table to the size it would get after a grow with the current
+** number of keys, i.e. with the load 'minload', regardless of the initial
+** size. For swiss tables, deleted slots are also cleaned up. For tables
+** with incremental grow, any ongoing grow is finished, and the shrinking
+** is done at once.
+** Returns hashtable_ret_error on failure (the table is unchanged).
+** Returns hashtable_ret_ok on success.
+*/
+extern hashtable_ret_t
+hashtable_shrink_to_fit(hashtable_t h);
+
+/* Looks up 'n' keys at once. For each found key, 'vals[i]' is set to
+** its value, and 'rets[i]' to hashtable_ret_ok, otherwise 'rets[i]' is set
+** to hashtable_ret_not_found. Either 'vals' or 'rets' may be NULL.
+** The lookups are interleaved, so that the memory accesses for different
+** keys overlap, which is much faster than one hashtable_get() at a time
+** for tables that are larger than the cache.
+** Returns the number of keys found.
+*/
+extern size_t
+hashtable_get_many(hashtable_t h, const char *const *keys, size_t n,
+                   void **vals, hashtable_ret_t *rets);
+
+/* Binary keys. These work just like hashtable_put(), hashtable_get(),
+** hashtable_rem() and hashtable_upsert(), but the key is 'len' bytes (at
+** least 1) at 'key', which may contain any bytes, nul included. A key is
+** the same as a string key when it's the same bytes, without the
+** terminating nul.
+** They also return hashtable_ret_error if out of memory. (See
+** hashtable_create_n().)
+*/
+extern hashtable_ret_t
+hashtable_put_n(hashtable_t h, const void *key, size_t len,
+                void *val, void **oldvalp);
+
+extern hashtable_ret_t
+hashtable_get_n(hashtable_t h, const void *key, size_t len, void **valuep);
+
+extern hashtable_ret_t
+hashtable_rem_n(hashtable_t h, const void *key, size_t len, void **valuep);
+
+extern hashtable_ret_t
+hashtable_upsert_n(hashtable_t h, const void *key, size_t len,
+                   void ***slotp, bool *insertedp);
+
+/* Precomputed hash values. hashtable_hash() returns the hash value of
+** 'key' for the table, and the *_hash() functions below work just like
+** hashtable_put(), hashtable_get(), hashtable_rem() and hashtable_upsert(),
+** but take that value instead of hashing the key again. So a key can be
+** hashed once, and then used with any number of tables that have the same
+** hash function, or hashed before taking a lock.
+** 'hv' must be the value the table's own hash function gives for the key,
+** or the key won't be found. (Minimal perfect hash tables have hash values
+** of their own, so they ignore 'hv', see hashtable_freeze_mph().)
+** The exception is HASHTABLE_CUCKOO tables, which still hash the key
+** itself (with a seeded hash) for its second bucket, whenever it's not
+** found in its first: on misses, for keys that are in their second
+** bucket, and when making room for a new key.
+*/
+extern hashval_t
+hashtable_hash(hashtable_t h, const char *key);
+
+extern hashtable_ret_t
+hashtable_put_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void *val, void **oldvalp);
+
+extern hashtable_ret_t
+hashtable_get_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void **valuep);
+
+extern hashtable_ret_t
+hashtable_rem_hash(hashtable_t h, const char *key, hashval_t hv,
+                   void **valuep);
+
+extern hashtable_ret_t
+hashtable_upsert_hash(hashtable_t h, const char *key, hashval_t hv,
+                      void ***slotp, bool *insertedp);
+
 /* Returns some info about a hashtable.
 ** Each pointer will be set if it's non-NULL.
 ** '*sizep' is set to the size of the table.
@@ -119,15 +394,133 @@ hashtable_rem(hashtable_t h, const char *key, void **valuep);
 ** The current load of the table is:      *countp / *sizep
 ** The average collision chain length is: *countp / *slotsp
 ** The number of collisions is:           *countp - *slotsp
+** For HASHTABLE_SWISS tables, '*slotsp' is the same as '*countp', and
+** '*cmaxp' is the longest probe sequence, counted in groups of 16 slots.
+** It's the same for HASHTABLE_CUCKOO tables, where '*cmaxp' is 2 if any
+** key is in its second bucket.
 */
 extern void
 hashtable_info(hashtable_t h,
 	       size_t *sizep, size_t *countp, size_t *slotsp, size_t *cmaxp);
 
-/* Initialize an iterator.
-** WARNING: Do not add or delete anything from a hashtable while an
-**          iterator is in use!
+/* Counts the collision chains by length: 'hist[k]' is set to the number
+** of buckets with k keys, for k < 'n' - 1, and 'hist[n - 1]' to the number
+** of buckets with n - 1 keys or more. 'n' must be at least 1.
+** For HASHTABLE_SWISS tables, it's the number of keys with each probe
+** length instead, counted in groups of 16 slots like in hashtable_info(),
+** so 'hist[0]' is 0, and for HASHTABLE_CUCKOO tables the number of keys
+** in their first and second buckets. While an incremental grow is in
+** progress, the buckets of both the old and the new array are counted.
+** The table is scanned once, like for the '*cmaxp' of hashtable_info().
+** Returns the longest chain.
+*/
+extern size_t
+hashtable_histogram(hashtable_t h, size_t *hist, size_t n);
+
+/* Operation counters, kept by each table as it's used, so that they can be
+** read at any time without scanning anything.
+** The average number of probes per search is: probes / searches
+** The average number of key compares is:      compares / searches
 */
+typedef struct hashtable_stats_s
+{
+  size_t size;			/* The size of the table */
+  size_t count;			/* The number of keys */
+  size_t hits;			/* Gets that found the key */
+  size_t misses;		/* Gets that didn't */
+  size_t searches;		/* Key searches, by gets, puts and removes */
+  size_t probes;		/* Buckets and chain nodes, groups of slots,
+				** or frozen entries looked at by searches */
+  size_t compares;		/* Keys compared (when the hash matched) */
+  size_t resizes;		/* Grows and shrinks */
+  uint64_t resize_ns;		/* Nanoseconds spent in them */
+  size_t allocs;		/* Memory allocations */
+} hashtable_stats_t;
+
+/* Gets the counters of a table. The counting can be compiled out of the
+** library by defining HASHTABLE_STATS to 0, and then only the size and
+** count are set, the rest are 0.
+** The time of an incremental grow (HASHTABLE_INCREMENTAL) only includes
+** allocating the new array, not moving the keys, which is spread out
+** over later operations.
+*/
+extern void
+hashtable_stats(hashtable_t h, hashtable_stats_t *statsp);
+
+/* Sets all the counters to 0 */
+extern void
+hashtable_stats_reset(hashtable_t h);
+
+/* Makes a frozen, read-only copy of a table. It's laid out compactly in
+** one block of memory, with the keys of a bucket next to each other, and
+** no pointers to follow, so lookups are fast and take few cache misses.
+** It uses the same hash function as 'h', and has the same keys and values,
+** but no destructor: the values still belong to 'h' (or whoever put them
+** there), and must outlive the copy.
+** The usual functions for lookups, info and iteration work with a frozen
+** table, and hashtable_destroy() frees it, but hashtable_put() and
+** hashtable_rem() return hashtable_ret_error, and hashtable_clear() does
+** nothing.
+** Since nothing changes in a frozen table, any number of threads can use
+** it at the same time without locking. (See also snapshot.h)
+** Returns NULL if out of memory.
+*/
+extern hashtable_t
+hashtable_freeze(hashtable_t h);
+
+/* Like hashtable_freeze(), but the copy has a minimal perfect hash
+** function, built for its keys: there are exactly as many slots as keys,
+** and a lookup reads one small index entry and then exactly one slot, and
+** compares one key. Building it takes a few times longer than
+** hashtable_freeze(), and it's limited to 2^32 - 1 keys. It uses its own
+** (seeded wyhash) hash values, so it works even if the table's hash
+** function gives the same value for different keys.
+** hashtable_info() gives the number of keys as size, and 1 as the longest
+** chain. It can be saved like any frozen table.
+** Returns NULL if out of memory, or if it can't be built, with errno set.
+*/
+extern hashtable_t
+hashtable_freeze_mph(hashtable_t h);
+
+/* Writes the table to the file descriptor 'fd', in the same format as a
+** frozen table in memory, so that hashtable_open_mmap() can use it
+** directly. (A frozen table is written as it is, other tables are frozen
+** first.) Pointers can't be saved, so if 'vsize' is 0, the values are
+** written as they are, which only makes sense if they are really integers
+** (or offsets into something else that's saved). Otherwise each value
+** points to 'vsize' bytes, which are saved with it. (NULL values are saved
+** as all zeros.)
+** The file format depends on the byte order; it's only meant to be read
+** on the same kind of machine.
+** Returns hashtable_ret_error on failure, with errno set.
+** Returns hashtable_ret_ok on success.
+*/
+extern hashtable_ret_t
+hashtable_save(hashtable_t h, int fd, size_t vsize);
+
+/* Opens a table saved by hashtable_save() by mapping the file into memory.
+** Nothing is read or allocated until it's used, so opening is immediate,
+** even for huge tables. It's a frozen table (see hashtable_freeze()), and
+** when values were saved as blobs, a lookup gives a pointer to the value in
+** the mapping, which must not be written to, and is only valid until the
+** table is destroyed.
+** 'hfun' must be the hash function of the saved table, if it was not
+** one of the builtin ones; otherwise it can be NULL.
+** Only the size and header of the file are checked, so it must be a
+** trusted file.
+** Returns NULL on failure, with errno set (EINVAL if the file isn't a
+** saved table, or 'hfun' is wrong).
+*/
+extern hashtable_t
+hashtable_open_mmap(const char *path, hashfunc_t *hfun);
+
+/* Like hashtable_open_mmap(), but for a table with a custom hash function
+** for binary keys, see hashtable_create_n().
+*/
+extern hashtable_t
+hashtable_open_mmap_n(const char *path, hashfunc_n_t *hfun);
+
+/* Initialize an iterator. */
 extern void
 hashtable_iter_init(hashtable_t h, hashtable_iter_t *iterp);
 
@@ -135,9 +528,45 @@ hashtable_iter_init(hashtable_t h, hashtable_iter_t *iterp);
 ** 'valuep' may be NULL.
 ** Returns true when there was a next value, false when the end of the table
 ** was reached. Values are returned in some arbitrary order.
-** WARNING: Do not add or delete anything from a hashtable while an
-**          iterator is in use!
+** The iterator can be kept, and resumed later, and keys can be put into the
+** table in between, even if it grows, and removed with hashtable_iter_rem().
+** The keys that are in the table the whole time are returned at least once,
+** and ones that are put or removed meanwhile may or may not be returned.
+** When the table has been resized (or with HASHTABLE_CUCKOO, after more
+** puts that moved other keys than it keeps track of), the iterator starts
+** over, skipping the keys it can tell were returned already, so some keys
+** can be returned twice.
+** For HASHTABLE_SWISS tables, it can't tell, so all are returned again.
+** With HASHTABLE_INCREMENTAL, keys in the old bucket it's at can also be
+** returned twice, when an ongoing grow moves that bucket.
+** Removing keys that were already returned with hashtable_rem() can make it
+** miss a key, so use hashtable_iter_rem() for those.
+** Don't use the key and value pointers from before a change to the table.
 */
 extern bool
 hashtable_iter_next(hashtable_t h, hashtable_iter_t *iterp,
                     const char **keyp, void **valuep);
+
+/* Like hashtable_iter_next(), but also sets '*lenp' to the length of the
+** key, when 'lenp' is not NULL. (Keys are nul terminated anyway, except
+** binary keys in HASHTABLE_BORROW tables, which are as they were put.)
+*/
+extern bool
+hashtable_iter_next_n(hashtable_t h, hashtable_iter_t *iterp,
+                      const void **keyp, size_t *lenp, void **valuep);
+
+/* Removes the key last returned by hashtable_iter_next() from the table,
+** like hashtable_rem() with a NULL 'valuep' (so the destructor is called),
+** but without looking it up again. The iteration continues with the key
+** after it. The table doesn't shrink here, but it can on a later remove.
+** Returns hashtable_ret_error for a frozen table.
+** Returns hashtable_ret_not_found if there's no current key: it was already
+**         removed, or keys have been put or removed since it was returned.
+** Returns hashtable_ret_ok if removed
+*/
+extern hashtable_ret_t
+hashtable_iter_rem(hashtable_t h, hashtable_iter_t *iterp);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,777 @@
+/* hashtable.hpp
+**
+** A C++17 front end, header only: htab::map<Key, Value, Hash, KeyEq>.
+**
+** It's the same design as the chain engine in hashtable.c, with power of
+** two sizes and Fibonacci hashing (HASHTABLE_POW2): an array of buckets,
+** where the first datum of each bucket is in the array itself, and the
+** rest are chain nodes. But the keys and values are typed and stored in
+** the datums, and the hash function and key compare are template
+** parameters, so they are inlined instead of called through pointers.
+**
+** - Values can be move-only, and try_emplace() constructs the key and the
+**   value in place, from its arguments, only if the key isn't there.
+** - With a transparent hash and compare (like the defaults for std::string
+**   keys), lookups take anything they accept, e.g. a std::string_view or a
+**   const char *, without making a temporary key. try_emplace() only makes
+**   the key from it when inserting.
+** - The default hash function for strings gives the same values as
+**   hash_string_fast(). Integers and pointers are used as they are, since
+**   the Fibonacci hashing of the bucket index mixes them anyway.
+**
+** Just like with the C tables, any change may move keys and values, so
+** iterators, pointers and references are only valid until the next
+** insert or erase. Iterating gives references to the key and the value,
+** as 'first' and 'second', e.g.
+**
+**   for (auto [key, val] : m)
+**     ...
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hashtable.h"
+
+namespace htab
+{
+
+/* The default hash functions */
+
+struct string_hash
+{
+  using is_transparent = void;
+
+  /* The same as hash_mem_fast() */
+  hashval_t
+  operator()(std::string_view s) const noexcept
+  {
+    hashval_t val = 0;
+
+    for (char c : s)
+      val += (val << 3) + c;
+    return val;
+  }
+};
+
+struct string_equal
+{
+  using is_transparent = void;
+
+  bool
+  operator()(std::string_view a, std::string_view b) const noexcept
+  {
+    return a == b;
+  }
+};
+
+template <class K, class = void>
+struct hash
+{
+  hashval_t
+  operator()(const K &k) const
+  {
+    return std::hash<K>{}(k);
+  }
+};
+
+template <class K>
+struct hash<K, std::enable_if_t<std::is_integral_v<K> || std::is_enum_v<K>>>
+{
+  hashval_t
+  operator()(K k) const noexcept
+  {
+    return static_cast<hashval_t>(k);
+  }
+};
+
+template <class K>
+struct hash<K *>
+{
+  hashval_t
+  operator()(const K *p) const noexcept
+  {
+    return static_cast<hashval_t>(reinterpret_cast<std::uintptr_t>(p));
+  }
+};
+
+template <> struct hash<std::string> : string_hash {};
+template <> struct hash<std::string_view> : string_hash {};
+
+/* Like std::equal_to, but noexcept when == is */
+template <class K>
+struct equal_to
+{
+  bool
+  operator()(const K &a, const K &b) const noexcept(noexcept(a == b))
+  {
+    return a == b;
+  }
+};
+
+template <> struct equal_to<std::string> : string_equal {};
+template <> struct equal_to<std::string_view> : string_equal {};
+
+namespace detail
+{
+
+template <class F, class = void>
+struct is_transparent : std::false_type {};
+
+template <class F>
+struct is_transparent<F, std::void_t<typename F::is_transparent>>
+  : std::true_type {};
+
+/* The argument type of lookups: anything if transparent, otherwise Key */
+template <bool Transparent>
+struct key_arg
+{
+  template <class K, class Key> using type = Key;
+};
+
+template <>
+struct key_arg<true>
+{
+  template <class K, class Key> using type = K;
+};
+
+} /* namespace detail */
+
+
+template <class Key, class Value,
+          class Hash = htab::hash<Key>, class KeyEq = htab::equal_to<Key>>
+class map
+{
+  static_assert(std::is_nothrow_move_constructible_v<Key> &&
+                std::is_nothrow_move_constructible_v<Value>,
+                "keys and values are moved when the table grows");
+
+  static constexpr bool transparent =
+    detail::is_transparent<Hash>::value && detail::is_transparent<KeyEq>::value;
+
+  template <class K>
+  using key_arg = typename detail::key_arg<transparent>::template type<K, Key>;
+
+  static constexpr std::uint64_t fib_mult = UINT64_C(0x9E3779B97F4A7C15);
+
+  /* A bucket, or a chain node. The key and value are only constructed
+  ** when 'set'.
+  */
+  struct datum
+  {
+    hashval_t hash = 0;
+    datum *next = nullptr;
+    bool set = false;
+    union
+    {
+      std::pair<Key, Value> kv;
+    };
+
+    datum() noexcept {}
+    ~datum() {}
+  };
+
+public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEq;
+
+  template <bool Const>
+  class iter
+  {
+    friend class map;
+    using map_ptr = std::conditional_t<Const, const map *, map *>;
+    using value_ref = std::conditional_t<Const, const Value &, Value &>;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::pair<const Key, Value>;
+    using reference = std::pair<const Key &, value_ref>;
+
+    struct pointer
+    {
+      reference ref;
+      const reference *operator->() const noexcept { return &ref; }
+    };
+
+    iter() noexcept = default;
+
+    /* An iterator converts to a const_iterator */
+    template <bool C = Const, class = std::enable_if_t<C>>
+    iter(const iter<false> &it) noexcept
+      : m_(it.m_), i_(it.i_), dp_(it.dp_)
+    {}
+
+    reference
+    operator*() const noexcept
+    {
+      return reference(dp_->kv.first, dp_->kv.second);
+    }
+
+    pointer
+    operator->() const noexcept
+    {
+      return pointer{ **this };
+    }
+
+    iter &
+    operator++() noexcept
+    {
+      if (dp_->next)
+        dp_ = dp_->next;
+      else
+        advance(i_ + 1);
+      return *this;
+    }
+
+    iter
+    operator++(int) noexcept
+    {
+      iter it = *this;
+
+      ++*this;
+      return it;
+    }
+
+    bool operator==(const iter &it) const noexcept { return dp_ == it.dp_; }
+    bool operator!=(const iter &it) const noexcept { return dp_ != it.dp_; }
+
+  private:
+    iter(map_ptr m, size_type i, datum *dp) noexcept
+      : m_(m), i_(i), dp_(dp)
+    {}
+
+    /* To the first used bucket from 'i', or the end */
+    void
+    advance(size_type i) noexcept
+    {
+      while (i < m_->size_ && !m_->data_[i].set)
+        i += 1;
+      i_ = i;
+      dp_ = (i < m_->size_ ? &m_->data_[i] : nullptr);
+    }
+
+    template <bool> friend class iter;
+
+    map_ptr m_ = nullptr;
+    size_type i_ = 0;
+    datum *dp_ = nullptr;
+  };
+
+  using iterator = iter<false>;
+  using const_iterator = iter<true>;
+
+  /* 'initsize' is a hint like for hashtable_create(), the loads are the
+  ** same as there too.
+  */
+  explicit
+  map(size_type initsize = 0, float minload = 0.5, float maxload = 0.8,
+      const Hash &hash = Hash(), const KeyEq &eq = KeyEq())
+    : hash_(hash), eq_(eq)
+  {
+    if (maxload < 0.5 || 1.0 <= maxload)
+      maxload = 0.8;
+    if (minload < 0.2 || maxload <= minload)
+      minload = 0.5;
+    if (minload >= maxload)
+      minload = maxload / 2;
+    minload_ = minload;
+    maxload_ = maxload;
+    resize(pow2_size(initsize ? initsize : 101));
+  }
+
+  map(const map &m)
+    : map(m.size_, m.minload_, m.maxload_, m.hash_, m.eq_)
+  {
+    for (auto [key, val] : m)
+      try_emplace(key, val);
+  }
+
+  /* Takes the buckets of 'm', which is left empty, with no buckets until
+  ** a key is inserted. Nothing is allocated, so containers of maps move
+  ** them instead of copying.
+  */
+  map(map &&m) noexcept(std::is_nothrow_move_constructible_v<Hash> &&
+                        std::is_nothrow_move_constructible_v<KeyEq>)
+    : hash_(std::move(m.hash_)), eq_(std::move(m.eq_)),
+      data_(m.data_), size_(m.size_), count_(m.count_), growat_(m.growat_),
+      shift_(m.shift_), minload_(m.minload_), maxload_(m.maxload_)
+  {
+    m.data_ = nullptr;
+    m.size_ = 0;
+    m.count_ = 0;
+    m.growat_ = 0;		/* So the next insert makes buckets */
+    m.shift_ = 63;		/* Any valid shift */
+  }
+
+  map &
+  operator=(const map &m)
+  {
+    map copy(m);
+
+    swap(copy);
+    return *this;
+  }
+
+  /* 'm' is left empty, like after a move construction */
+  map &
+  operator=(map &&m) noexcept(std::is_nothrow_move_constructible_v<Hash> &&
+                              std::is_nothrow_move_constructible_v<KeyEq>)
+  {
+    map old(std::move(m));
+
+    swap(old);
+    return *this;
+  }
+
+  ~map()
+  {
+    clear();
+    delete[] data_;
+  }
+
+  void
+  swap(map &m) noexcept
+  {
+    std::swap(hash_, m.hash_);
+    std::swap(eq_, m.eq_);
+    std::swap(data_, m.data_);
+    std::swap(size_, m.size_);
+    std::swap(count_, m.count_);
+    std::swap(growat_, m.growat_);
+    std::swap(shift_, m.shift_);
+    std::swap(minload_, m.minload_);
+    std::swap(maxload_, m.maxload_);
+  }
+
+  size_type size() const noexcept { return count_; }
+  bool empty() const noexcept { return count_ == 0; }
+  size_type bucket_count() const noexcept { return size_; }
+
+  iterator
+  begin() noexcept
+  {
+    iterator it(this, 0, nullptr);
+
+    it.advance(0);
+    return it;
+  }
+
+  const_iterator
+  begin() const noexcept
+  {
+    const_iterator it(this, 0, nullptr);
+
+    it.advance(0);
+    return it;
+  }
+
+  iterator end() noexcept { return iterator(this, size_, nullptr); }
+  const_iterator end() const noexcept
+  {
+    return const_iterator(this, size_, nullptr);
+  }
+
+  template <class K = Key>
+  iterator
+  find(const key_arg<K> &key)
+  {
+    hashval_t hv = hash_(key);
+    size_type i = bucket(hv);
+
+    return iterator(this, i, find_datum(i, key, hv));
+  }
+
+  template <class K = Key>
+  const_iterator
+  find(const key_arg<K> &key) const
+  {
+    hashval_t hv = hash_(key);
+    size_type i = bucket(hv);
+
+    return const_iterator(this, i, find_datum(i, key, hv));
+  }
+
+  /* Like hashtable_get(): a pointer to the value, or nullptr */
+  template <class K = Key>
+  Value *
+  get(const key_arg<K> &key)
+    noexcept(noexcept(hash_(key)) &&
+             noexcept(eq_(std::declval<const Key &>(), key)))
+  {
+    hashval_t hv = hash_(key);
+    datum *dp = find_datum(bucket(hv), key, hv);
+
+    return (dp ? &dp->kv.second : nullptr);
+  }
+
+  template <class K = Key>
+  const Value *
+  get(const key_arg<K> &key) const
+    noexcept(noexcept(hash_(key)) &&
+             noexcept(eq_(std::declval<const Key &>(), key)))
+  {
+    hashval_t hv = hash_(key);
+    datum *dp = find_datum(bucket(hv), key, hv);
+
+    return (dp ? &dp->kv.second : nullptr);
+  }
+
+  template <class K = Key>
+  bool
+  contains(const key_arg<K> &key) const
+  {
+    return get<K>(key) != nullptr;
+  }
+
+  template <class K = Key>
+  size_type
+  count(const key_arg<K> &key) const
+  {
+    return (contains<K>(key) ? 1 : 0);
+  }
+
+  /* Inserts the key with a value constructed from 'args', if it's not in
+  ** the table. Nothing is constructed, copied or moved if it is. With a
+  ** transparent hash and compare, 'key' can be anything that they take
+  ** and that a Key can be constructed from.
+  ** Returns the iterator for the key, and whether it was inserted.
+  */
+  template <class K, class... Args>
+  std::pair<iterator, bool>
+  try_emplace(K &&key, Args &&...args)
+  {
+    using KA = std::conditional_t<transparent, std::decay_t<K>, Key>;
+    const KA &k = key;
+    hashval_t hv = hash_(k);
+    size_type i = bucket(hv);
+    datum *dp = find_datum(i, k, hv);
+
+    if (dp)
+      return { iterator(this, i, dp), false };
+    if (count_ + 1 >= growat_)
+    {
+      resize(pow2_size(static_cast<size_type>((count_ + 1) / minload_)));
+      i = bucket(hv);
+    }
+    dp = insert_datum(i, hv, std::piecewise_construct,
+                      std::forward_as_tuple(std::forward<K>(key)),
+                      std::forward_as_tuple(std::forward<Args>(args)...));
+    return { iterator(this, i, dp), true };
+  }
+
+  template <class K, class V>
+  std::pair<iterator, bool>
+  insert_or_assign(K &&key, V &&val)
+  {
+    auto r = try_emplace(std::forward<K>(key), std::forward<V>(val));
+
+    if (!r.second)
+      r.first.dp_->kv.second = std::forward<V>(val);
+    return r;
+  }
+
+  template <class K>
+  Value &
+  operator[](K &&key)
+  {
+    return try_emplace(std::forward<K>(key)).first.dp_->kv.second;
+  }
+
+  /* Returns the number of keys removed, 0 or 1 */
+  template <class K = Key>
+  size_type
+  erase(const key_arg<K> &key)
+  {
+    hashval_t hv = hash_(key);
+    datum *dp, *prev = nullptr;
+
+    if (count_ == 0)
+      return 0;			/* Maybe no buckets, after a move */
+    dp = &data_[bucket(hv)];
+    if (!dp->set)
+      return 0;
+    for ( ; dp ; prev = dp, dp = dp->next)
+      if (dp->hash == hv && eq_(dp->kv.first, key))
+        break;
+    if (dp == nullptr)
+      return 0;
+    if (prev)
+    {				/* A chain node */
+      prev->next = dp->next;
+      dp->kv.~pair();
+      delete dp;
+    }
+    else if (dp->next)
+    {				/* Move the next one up, key and all */
+      datum *np = dp->next;
+
+      dp->kv.~pair();
+      new (&dp->kv) std::pair<Key, Value>(std::move(np->kv));
+      dp->hash = np->hash;
+      dp->next = np->next;
+      np->kv.~pair();
+      delete np;
+    }
+    else
+    {
+      dp->kv.~pair();
+      dp->set = false;
+    }
+    count_ -= 1;
+    return 1;
+  }
+
+  void
+  clear() noexcept
+  {
+    for (size_type i = 0 ; i < size_ && count_ > 0 ; i++)
+    {
+      datum *dp = &data_[i];
+
+      if (!dp->set)
+        continue;
+      for (datum *np = dp->next ; np ; )
+      {
+        datum *next = np->next;
+
+        np->kv.~pair();
+        delete np;
+        np = next;
+        count_ -= 1;
+      }
+      dp->kv.~pair();
+      dp->set = false;
+      dp->next = nullptr;
+      count_ -= 1;
+    }
+  }
+
+  /* Grows so that 'n' keys fit without growing again */
+  void
+  reserve(size_type n)
+  {
+    size_type size = pow2_size(static_cast<size_type>(n / minload_));
+
+    if (size > size_)
+      resize(size);
+  }
+
+private:
+  /* A power of two, at least 16, like for HASHTABLE_POW2 */
+  static size_type
+  pow2_size(size_type n) noexcept
+  {
+    size_type size = 16;
+
+    while (size < n)
+      size <<= 1;
+    return size;
+  }
+
+  size_type
+  bucket(hashval_t hv) const noexcept
+  {
+    return static_cast<size_type>((hv * fib_mult) >> shift_);
+  }
+
+  template <class K>
+  datum *
+  find_datum(size_type i, const K &key, hashval_t hv) const
+  {
+    datum *dp;
+
+    if (count_ == 0)
+      return nullptr;		/* Maybe no buckets, after a move */
+    dp = &data_[i];
+    if (!dp->set)
+      return nullptr;
+    for ( ; dp ; dp = dp->next)
+      if (dp->hash == hv && eq_(dp->kv.first, key))
+        return dp;
+    return nullptr;
+  }
+
+  /* Constructs a new key and value in the bucket 'i', which must have
+  ** room for it (no grow). The new node goes second in the chain, so that
+  ** nothing already there is moved.
+  */
+  template <class... Args>
+  datum *
+  insert_datum(size_type i, hashval_t hv, Args &&...args)
+  {
+    datum *head = &data_[i];
+    datum *dp = head;
+
+    if (head->set)
+      dp = new datum;
+    try
+    {
+      new (&dp->kv) std::pair<Key, Value>(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      if (dp != head)
+        delete dp;
+      throw;
+    }
+    dp->hash = hv;
+    if (dp == head)
+    {
+      dp->set = true;
+      dp->next = nullptr;
+    }
+    else
+    {
+      dp->set = true;
+      dp->next = head->next;
+      head->next = dp;
+    }
+    count_ += 1;
+    return dp;
+  }
+
+  /* Moves everything to 'newsize' buckets. The chain nodes are reused, and
+  ** any more that are needed are allocated first, so that nothing can fail
+  ** after the keys start moving.
+  */
+  void
+  resize(size_type newsize)
+  {
+    datum *data = new datum[newsize];
+    unsigned shift = 64;
+    datum *spare = nullptr;
+
+    for (size_type s = newsize ; s > 1 ; s >>= 1)
+      shift -= 1;
+    try
+    {
+      std::vector<bool> used(newsize);
+      size_type heads = 0, nodes = 0;
+
+      for (size_type i = 0 ; i < size_ ; i++)
+        for (datum *dp = (data_[i].set ? &data_[i] : nullptr) ;
+             dp ;
+             dp = dp->next)
+        {
+          size_type j = static_cast<size_type>((dp->hash * fib_mult) >> shift);
+
+          if (!used[j])
+          {
+            used[j] = true;
+            heads += 1;
+          }
+          nodes += (dp != &data_[i]);
+        }
+      for (size_type n = nodes ; n + heads < count_ ; n++)
+      {
+        datum *dp = new datum;
+
+        dp->next = spare;
+        spare = dp;
+      }
+    }
+    catch (...)
+    {
+      free_nodes(spare);
+      delete[] data;
+      throw;
+    }
+
+    /* The chain nodes first, so that they are on the spare list before
+    ** the keys in the buckets need them.
+    */
+    for (size_type i = 0 ; i < size_ ; i++)
+      for (datum *np = data_[i].next ; np ; )
+      {
+        datum *next = np->next;
+
+        move_datum(data, shift, np, true, spare);
+        np = next;
+      }
+    for (size_type i = 0 ; i < size_ ; i++)
+      if (data_[i].set)
+        move_datum(data, shift, &data_[i], false, spare);
+    free_nodes(spare);
+    delete[] data_;
+    data_ = data;
+    size_ = newsize;
+    shift_ = shift;
+    growat_ = static_cast<size_type>(newsize * maxload_);
+  }
+
+  /* Moves 'dp' to its bucket in 'data'. If it was in a bucket ('node' is
+  ** false) and the new bucket is taken, a node is taken from 'spare', and
+  ** if it was a node and the new bucket is empty, the node goes there.
+  */
+  void
+  move_datum(datum *data, unsigned shift, datum *dp, bool node,
+             datum *&spare) noexcept
+  {
+    datum *head = &data[(dp->hash * fib_mult) >> shift];
+
+    if (head->set && node)
+    {				/* Just relink it */
+      dp->next = head->next;
+      head->next = dp;
+      return;
+    }
+    if (head->set)
+    {
+      datum *np = spare;
+
+      spare = np->next;
+      np->next = head->next;
+      head->next = np;
+      head = np;
+    }
+    new (&head->kv) std::pair<Key, Value>(std::move(dp->kv));
+    head->hash = dp->hash;
+    head->set = true;
+    dp->kv.~pair();
+    dp->set = false;
+    dp->next = nullptr;
+    if (node)
+    {
+      dp->next = spare;
+      spare = dp;
+    }
+  }
+
+  static void
+  free_nodes(datum *dp) noexcept
+  {
+    while (dp)
+    {
+      datum *next = dp->next;
+
+      delete dp;
+      dp = next;
+    }
+  }
+
+  Hash hash_;
+  KeyEq eq_;
+  datum *data_ = nullptr;
+  size_type size_ = 0;
+  size_type count_ = 0;
+  size_type growat_ = 0;	/* Grow when count + 1 reaches this */
+  unsigned shift_ = 64;		/* 64 - log2(size_) */
+  float minload_ = 0.5;
+  float maxload_ = 0.8;
+};
+
+} /* namespace htab */
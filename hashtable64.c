@@ -0,0 +1,322 @@
+/* hashtable64.c
+**
+** A hashtable with 64-bit integer keys, see hashtable64.h.
+**
+** The slots are (key, value) pairs, 16 bytes, so four of them share a
+** cache line, and a probe usually stays within one. The key 0 marks an
+** empty slot, so the real key 0 is kept in the table struct instead.
+** The home slot of a key is the low bits of the mixed key. Since probing is
+** linear, a remove can move the following keys of the run back, each one
+** as far as it can go without passing its home slot, which leaves no
+** deleted slots behind.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "hashtable64.h"
+
+#define H64_EMPTY 0		/* The key of an empty slot */
+#define H64_MIN   16		/* The smallest size */
+
+typedef struct slot64_s
+{
+  uint64_t key;
+  void *value;
+} slot64_t;
+
+struct hashtable64_s
+{
+  size_t size;			/* Always a power of two */
+  size_t count;			/* Keys in the slots, not the key 0 */
+  size_t growat;		/* Grow when count + 1 reaches this */
+  float maxload;
+  hashdestfunc_t *dfun;
+  bool haszero;			/* The key 0 is in the table */
+  void *zero;			/* and this is its value */
+  slot64_t *slots;
+};
+
+/* The finalizer of MurmurHash3: every bit of the key affects every bit of
+** the result, so sequential keys and keys that differ only in the high
+** bits spread over the whole table.
+*/
+static inline uint64_t
+h64_mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= UINT64_C(0xFF51AFD7ED558CCD);
+  x ^= x >> 33;
+  x *= UINT64_C(0xC4CEB9FE1A85EC53);
+  x ^= x >> 33;
+  return x;
+}
+
+#define h64_home(H, KEY) ((size_t)h64_mix(KEY) & ((H)->size - 1))
+
+static void
+h64_set_size(hashtable64_t h, size_t size)
+{
+  h->size = size;
+  h->growat = (size_t)(size * h->maxload);
+}
+
+/* Returns the slot of 'key', or an empty slot where it goes */
+static inline size_t
+h64_find(hashtable64_t h, uint64_t key)
+{
+  size_t mask = h->size - 1;
+  size_t i = (size_t)h64_mix(key) & mask;
+
+  while (h->slots[i].key != key && h->slots[i].key != H64_EMPTY)
+    i = (i + 1) & mask;
+  return i;
+}
+
+/* Rehashes into 'newsize' slots.
+** Returns false if out of memory.
+*/
+static bool
+h64_resize(hashtable64_t h, size_t newsize)
+{
+  slot64_t *slots = calloc(newsize, sizeof(slot64_t));
+  slot64_t *old = h->slots;
+  size_t osize = h->size;
+
+  if (slots == NULL)
+    return false;
+  h->slots = slots;
+  h64_set_size(h, newsize);
+  for (size_t i = 0 ; i < osize ; i++)
+    if (old[i].key != H64_EMPTY)
+      slots[h64_find(h, old[i].key)] = old[i];
+  free(old);
+  return true;
+}
+
+hashtable64_t
+hashtable64_create(size_t initsize, float maxload, hashdestfunc_t *dfun)
+{
+  hashtable64_t h = malloc(sizeof(struct hashtable64_s));
+  size_t size = H64_MIN;
+
+  if (h == NULL)
+    return NULL;
+  if (maxload < 0.2 || 1.0 <= maxload)
+    maxload = 0.7;
+  while (size < initsize)
+    size <<= 1;
+  h->maxload = maxload;
+  h64_set_size(h, size);
+  h->count = 0;
+  h->dfun = dfun;
+  h->haszero = false;
+  h->zero = NULL;
+  h->slots = calloc(size, sizeof(slot64_t));
+  if (h->slots == NULL)
+  {
+    free(h);
+    return NULL;
+  }
+  return h;
+}
+
+void
+hashtable64_clear(hashtable64_t h)
+{
+  if (h->dfun)
+  {
+    for (size_t i = 0 ; i < h->size ; i++)
+      if (h->slots[i].key != H64_EMPTY)
+        h->dfun (h->slots[i].value);
+    if (h->haszero)
+      h->dfun (h->zero);
+  }
+  memset(h->slots, 0, h->size * sizeof(slot64_t));
+  h->count = 0;
+  h->haszero = false;
+  h->zero = NULL;
+}
+
+void
+hashtable64_destroy(hashtable64_t h)
+{
+  hashtable64_clear(h);
+  free(h->slots);
+  free(h);
+}
+
+hashtable_ret_t
+hashtable64_put(hashtable64_t h, uint64_t key, void *val, void **oldvalp)
+{
+  size_t i;
+
+  if (key == H64_EMPTY)
+  {
+    bool had = h->haszero;
+
+    if (had)
+    {
+      if (oldvalp != NULL)
+        *oldvalp = h->zero;
+      else if (h->dfun)
+        h->dfun (h->zero);
+    }
+    h->haszero = true;
+    h->zero = val;
+    return (had ? hashtable_ret_replaced : hashtable_ret_ok);
+  }
+  i = h64_find(h, key);
+  if (h->slots[i].key == key)
+  {				/* Found */
+    if (oldvalp != NULL)
+      *oldvalp = h->slots[i].value;
+    else if (h->dfun)
+      h->dfun (h->slots[i].value);
+    h->slots[i].value = val;
+    return hashtable_ret_replaced;
+  }
+  if (h->count + 1 >= h->growat)
+  {
+    if (!h64_resize(h, h->size * 2))
+      return hashtable_ret_error;
+    i = h64_find(h, key);
+  }
+  h->slots[i].key = key;
+  h->slots[i].value = val;
+  h->count += 1;
+  return hashtable_ret_ok;
+}
+
+hashtable_ret_t
+hashtable64_get(hashtable64_t h, uint64_t key, void **valuep)
+{
+  size_t i;
+
+  if (key == H64_EMPTY)
+  {
+    if (!h->haszero)
+      return hashtable_ret_not_found;
+    if (valuep)
+      *valuep = h->zero;
+    return hashtable_ret_ok;
+  }
+  i = h64_find(h, key);
+  if (h->slots[i].key != key)
+    return hashtable_ret_not_found;
+  if (valuep)
+    *valuep = h->slots[i].value;
+  return hashtable_ret_ok;
+}
+
+hashtable_ret_t
+hashtable64_rem(hashtable64_t h, uint64_t key, void **valuep)
+{
+  size_t mask = h->size - 1;
+  size_t i, j;
+  void *val;
+
+  if (key == H64_EMPTY)
+  {
+    if (!h->haszero)
+      return hashtable_ret_not_found;
+    val = h->zero;
+    h->haszero = false;
+    h->zero = NULL;
+  }
+  else
+  {
+    i = h64_find(h, key);
+    if (h->slots[i].key != key)
+      return hashtable_ret_not_found;
+    val = h->slots[i].value;
+    /* Move each following key of the run into the hole, if that's not
+    ** before its home slot, i.e. if the hole is between its home and it.
+    */
+    for (j = (i + 1) & mask ;
+         h->slots[j].key != H64_EMPTY ;
+         j = (j + 1) & mask)
+    {
+      size_t home = h64_home(h, h->slots[j].key);
+
+      if (((j - home) & mask) >= ((j - i) & mask))
+      {
+        h->slots[i] = h->slots[j];
+        i = j;
+      }
+    }
+    h->slots[i].key = H64_EMPTY;
+    h->slots[i].value = NULL;
+    h->count -= 1;
+  }
+  if (valuep)
+    *valuep = val;
+  else if (h->dfun)
+    h->dfun (val);
+  return hashtable_ret_ok;
+}
+
+void
+hashtable64_info(hashtable64_t h,
+                 size_t *sizep, size_t *countp, size_t *cmaxp)
+{
+  if (sizep)
+    *sizep = h->size;
+  if (countp)
+    *countp = h->count + h->haszero;
+  if (cmaxp)
+  {
+    size_t mask = h->size - 1, cmax = 0;
+
+    for (size_t i = 0 ; i < h->size ; i++)
+      if (h->slots[i].key != H64_EMPTY)
+      {
+        size_t c = ((i - h64_home(h, h->slots[i].key)) & mask) + 1;
+
+        if (c > cmax)
+          cmax = c;
+      }
+    *cmaxp = cmax;
+  }
+}
+
+/* The slots in order, and then the key 0, at index 'size' */
+void
+hashtable64_iter_init(hashtable64_t h, hashtable64_iter_t *iterp)
+{
+  (void)h;
+  iterp->i = 0;
+}
+
+bool
+hashtable64_iter_next(hashtable64_t h, hashtable64_iter_t *iterp,
+                      uint64_t *keyp, void **valuep)
+{
+  while (iterp->i < h->size)
+  {
+    slot64_t *sp = h->slots + (iterp->i)++;
+
+    if (sp->key != H64_EMPTY)
+    {
+      if (keyp)
+        *keyp = sp->key;
+      if (valuep)
+        *valuep = sp->value;
+      return true;
+    }
+  }
+  if (iterp->i == h->size)
+  {
+    iterp->i += 1;
+    if (h->haszero)
+    {
+      if (keyp)
+        *keyp = 0;
+      if (valuep)
+        *valuep = h->zero;
+      return true;
+    }
+  }
+  return false;
+}
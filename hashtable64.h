@@ -0,0 +1,95 @@
+/* hashtable64.h
+**
+** A hashtable with 64-bit integer keys.
+**
+** For keys that are numbers, like ids, there's no need to format them as
+** strings for a hashtable_t. This table keeps the keys themselves, inline
+** with the values, in one flat array: a lookup mixes the key, and compares
+** integers from there on, usually in a single cache line. Nothing is
+** allocated per key. (Smaller integers, like uint32_t, can just be used as
+** 64-bit keys.)
+**
+** It's open addressing with linear probing, where an empty slot has the
+** key 0. The key 0 itself can be used too, it's kept on the side. A remove
+** shifts the following keys back into the hole, so there are never any
+** deleted slots to skip. The size is a power of two, and the table never
+** shrinks.
+*/
+
+#pragma once
+
+#include "hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hashtable64_s *hashtable64_t;
+
+typedef struct hashtable64_iter_s
+{
+  size_t i;
+} hashtable64_iter_t;
+
+/* Create a table. The 'initsize' is a hint, like for hashtable_create().
+** When the load reaches 'maxload' (default 0.7), the table doubles in size.
+** 'dfun' is the optional destructor function for value data.
+** Returns NULL if out of memory.
+*/
+extern hashtable64_t
+hashtable64_create(size_t initsize, float maxload, hashdestfunc_t *dfun);
+
+/* Removes all keys, calling the destructor for each value, if there is one */
+extern void
+hashtable64_clear(hashtable64_t h);
+
+/* Destroys a table, calling the destructor for each value, if there is one */
+extern void
+hashtable64_destroy(hashtable64_t h);
+
+/* Puts the key-value pair into the table, like hashtable_put().
+** Returns hashtable_ret_error if out of memory.
+** Returns hashtable_ret_ok on success, and if key didn't exist.
+** Returns hashtable_ret_replaced on success, and if key was replaced.
+*/
+extern hashtable_ret_t
+hashtable64_put(hashtable64_t h, uint64_t key, void *val, void **oldvalp);
+
+/* Looks up the value for 'key', like hashtable_get().
+** Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if found, and '*valuep' updated to value.
+*/
+extern hashtable_ret_t
+hashtable64_get(hashtable64_t h, uint64_t key, void **valuep);
+
+/* Removes the 'key' from the table, like hashtable_rem().
+** Returns hashtable_ret_not_found if not found
+** Returns hashtable_ret_ok if removed
+*/
+extern hashtable_ret_t
+hashtable64_rem(hashtable64_t h, uint64_t key, void **valuep);
+
+/* Sets the same things as hashtable_info(), except the number of slots
+** used, which is the count. '*cmaxp' is the longest probe sequence, in
+** slots.
+*/
+extern void
+hashtable64_info(hashtable64_t h,
+                 size_t *sizep, size_t *countp, size_t *cmaxp);
+
+/* Iterating over the keys, like hashtable_iter_init() and
+** hashtable_iter_next(), but an iterator can't be kept while the table is
+** changed: a put can grow the table, and a remove moves later keys back,
+** possibly behind the iterator, so keys can be missed or returned twice.
+** Don't put or remove keys until the iteration is done.
+*/
+extern void
+hashtable64_iter_init(hashtable64_t h, hashtable64_iter_t *iterp);
+
+extern bool
+hashtable64_iter_next(hashtable64_t h, hashtable64_iter_t *iterp,
+                      uint64_t *keyp, void **valuep);
+
+#ifdef __cplusplus
+}
+#endif
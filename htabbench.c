@@ -0,0 +1,494 @@
+/* htabbench.c
+**
+** A benchmark for the hash tables. For each combination of hash function,
+** engine and table size, it fills a table and then runs a workload on it
+** a number of times, and writes one CSV line per run to stdout:
+**
+**   hash,engine,keys,zipf,miss,write,run,ops,ns_op,p50_ns,p99_ns,p999_ns
+**
+** The workload is a sequence of operations, generated before it's timed.
+** Keys are picked with uniform or Zipf distributed popularity. A lookup is
+** for a key that's not in the table with the miss percentage, and a write
+** is a put or a remove (half each) of a table key. 'ns_op' is the total
+** time divided by the number of operations. Every SAMPLE:th operation is
+** also timed by itself, for the percentiles (with the overhead of reading
+** the clock subtracted).
+**
+** Options:
+**  -H fast,good,wy      Hash functions
+**  -E chain,pow2,incr,arena,swiss,cuckoo,frozen,mph
+**                       Engines (frozen and mph are read-only, so they're
+**                       skipped when there are writes)
+**  -n 1000,16000,...    Table sizes (number of keys)
+**  -z S                 Zipf skew (0 is uniform, the default)
+**  -m PCT               Percentage of lookups that miss
+**  -w PCT               Percentage of operations that write
+**  -o N                 Operations per run
+**  -r N                 Runs per combination
+**  -k FILE              Take the keys from FILE, one per line, instead of
+**                       generating them
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hashtable.h"
+
+#define SAMPLE 16		/* Time every SAMPLE:th operation by itself */
+
+typedef enum { op_get, op_put, op_rem } optype_t;
+
+typedef struct op_s
+{
+  optype_t type;
+  const char *key;
+} op_t;
+
+static struct
+{
+  const char *name;
+  hashfunc_t *hfun;
+} Hashes[] = { { "fast", hash_string_fast },
+               { "good", hash_string_good },
+               { "wy", hash_string_wy } };
+
+#define FROZEN (-1)
+#define MPH    (-2)
+
+static struct
+{
+  const char *name;
+  int flags;			/* Or FROZEN, MPH */
+} Engines[] = { { "chain", HASHTABLE_CHAIN },
+                { "pow2", HASHTABLE_CHAIN | HASHTABLE_POW2 },
+                { "incr", HASHTABLE_CHAIN | HASHTABLE_INCREMENTAL },
+                { "arena", HASHTABLE_CHAIN | HASHTABLE_ARENA },
+                { "swiss", HASHTABLE_SWISS },
+                { "cuckoo", HASHTABLE_CUCKOO },
+                { "frozen", FROZEN },
+                { "mph", MPH } };
+
+#define NELEM(A) (sizeof(A) / sizeof((A)[0]))
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-H hashes] [-E engines] [-n sizes] [-z skew]\n"
+          "          [-m miss%%] [-w write%%] [-o ops] [-r runs] [-k keyfile]\n",
+          prog);
+  exit(1);
+}
+
+static uint64_t Rng = 0x9E3779B97F4A7C15;
+
+/* splitmix64 */
+static uint64_t
+rng_next(void)
+{
+  uint64_t z = (Rng += UINT64_C(0x9E3779B97F4A7C15));
+
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1) */
+static double
+rng_double(void)
+{
+  return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The least time it takes to read the clock twice */
+static uint64_t
+clock_overhead(void)
+{
+  uint64_t min = UINT64_MAX;
+
+  for (int i = 0 ; i < 10000 ; i++)
+  {
+    uint64_t t0 = now_ns(), t1 = now_ns();
+
+    if (t1 - t0 < min)
+      min = t1 - t0;
+  }
+  return min;
+}
+
+/* Is 'name' in the comma separated 'list'? */
+static int
+in_list(const char *list, const char *name)
+{
+  size_t len = strlen(name);
+
+  while (*list)
+  {
+    if (strncmp(list, name, len) == 0 && (list[len] == ',' || !list[len]))
+      return 1;
+    list = strchr(list, ',');
+    if (list == NULL)
+      break;
+    list += 1;
+  }
+  return 0;
+}
+
+static char *
+xstrdup(const char *s)
+{
+  char *p = strdup(s);
+
+  if (p == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static void *
+xmalloc(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* Keys from a file, or generated: 'n' keys for the table, followed by 'n'
+** that are not in it. Generated keys have different lengths, like real
+** ones.
+*/
+static char **
+make_keys(const char *keyfile, size_t *np)
+{
+  size_t n = *np, count = 0;
+  char **keys = xmalloc(2 * n * sizeof(char *));
+  char buf[256];
+
+  if (keyfile)
+  {
+    FILE *fp = fopen(keyfile, "r");
+
+    if (fp == NULL)
+    {
+      perror(keyfile);
+      exit(1);
+    }
+    while (count < 2 * n && fgets(buf, sizeof(buf), fp))
+    {
+      size_t len = strlen(buf);
+
+      if (len > 0 && buf[len-1] == '\n')
+        buf[--len] = '\0';
+      if (len > 0)
+        keys[count++] = xstrdup(buf);
+    }
+    fclose(fp);
+    /* Half of them for the table, half for misses */
+    if (count < 2 * n)
+    {
+      n = count / 2;
+      for (size_t i = 0 ; i < n ; i++)
+      {				/* Every other one for misses */
+        char *tmp = keys[n + i];
+
+        keys[n + i] = keys[2 * i + 1];
+        keys[2 * i + 1] = tmp;
+      }
+    }
+    *np = n;
+    return keys;
+  }
+  for (size_t i = 0 ; i < 2 * n ; i++)
+  {
+    snprintf(buf, sizeof(buf), "%s%lu-%lx", (i & 1 ? "key/" : ""),
+             (unsigned long)i, (unsigned long)(rng_next() >> (rng_next() & 63)));
+    keys[i] = xstrdup(buf);
+  }
+  return keys;
+}
+
+/* The cumulative Zipf distribution over 'n' ranks with skew 's' */
+static double *
+zipf_cdf(size_t n, double s)
+{
+  double *cdf = xmalloc(n * sizeof(double));
+  double sum = 0;
+
+  for (size_t i = 0 ; i < n ; i++)
+    cdf[i] = (sum += 1.0 / pow((double)(i + 1), s));
+  for (size_t i = 0 ; i < n ; i++)
+    cdf[i] /= sum;
+  return cdf;
+}
+
+/* A key index in [0, n), with the given popularity distribution. The
+** ranks are mapped through 'perm', so that the popular keys are spread out.
+*/
+static size_t
+pick(size_t n, const double *cdf, const size_t *perm)
+{
+  size_t lo = 0, hi;
+  double u;
+
+  if (cdf == NULL)
+    return (size_t)(rng_double() * n);
+  u = rng_double();
+  hi = n - 1;
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return perm[lo];
+}
+
+static op_t *
+make_ops(char **keys, size_t n, size_t nops,
+         double zipf, double miss, double write)
+{
+  op_t *ops = xmalloc(nops * sizeof(op_t));
+  double *cdf = (zipf > 0 ? zipf_cdf(n, zipf) : NULL);
+  size_t *perm = xmalloc(n * sizeof(size_t));
+
+  for (size_t i = 0 ; i < n ; i++)
+    perm[i] = i;
+  for (size_t i = n ; i > 1 ; i--)
+  {
+    size_t j = rng_next() % i, tmp = perm[i - 1];
+
+    perm[i - 1] = perm[j];
+    perm[j] = tmp;
+  }
+  for (size_t i = 0 ; i < nops ; i++)
+  {
+    size_t k = pick(n, cdf, perm);
+
+    if (rng_double() < write)
+    {
+      ops[i].type = (rng_next() & 1 ? op_put : op_rem);
+      ops[i].key = keys[k];
+    }
+    else
+    {
+      ops[i].type = op_get;
+      ops[i].key = (rng_double() < miss ? keys[n + k] : keys[k]);
+    }
+  }
+  free(perm);
+  free(cdf);
+  return ops;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static volatile uintptr_t Sink;
+
+static inline void
+run_op(hashtable_t h, const op_t *op)
+{
+  void *val = NULL;
+
+  switch (op->type)
+  {
+  case op_get:
+    if (hashtable_get(h, op->key, &val) == hashtable_ret_ok)
+      Sink += (uintptr_t)val;
+    break;
+  case op_put:
+    (void)hashtable_put(h, op->key, (void *)op->key, NULL);
+    break;
+  case op_rem:
+    (void)hashtable_rem(h, op->key, NULL);
+    break;
+  }
+}
+
+/* Runs the operations, and returns the total time. The sampled latencies
+** are put in 'lat'.
+*/
+static uint64_t
+run(hashtable_t h, const op_t *ops, size_t nops, uint64_t *lat,
+    uint64_t overhead)
+{
+  uint64_t start = now_ns();
+
+  for (size_t i = 0 ; i < nops ; i++)
+    if (i % SAMPLE == 0)
+    {
+      uint64_t t0 = now_ns(), t1;
+
+      run_op(h, ops + i);
+      t1 = now_ns();
+      lat[i / SAMPLE] = (t1 - t0 > overhead ? t1 - t0 - overhead : 0);
+    }
+    else
+      run_op(h, ops + i);
+  return now_ns() - start;
+}
+
+/* A table of the engine with the first 'n' keys */
+static hashtable_t
+fill(int e, int hf, char **keys, size_t n)
+{
+  int flags = Engines[e].flags;
+  hashtable_t h = hashtable_create_ext(0, 0, 0, Hashes[hf].hfun, NULL,
+                                       (flags < 0 ? 0 : (unsigned)flags));
+
+  if (h == NULL)
+  {
+    fprintf(stderr, "hashtable_create_ext() failed\n");
+    exit(1);
+  }
+  for (size_t i = 0 ; i < n ; i++)
+    if (hashtable_put(h, keys[i], keys[i], NULL) == hashtable_ret_error)
+    {
+      fprintf(stderr, "hashtable_put() failed\n");
+      exit(1);
+    }
+  if (flags < 0)
+  {
+    hashtable_t fh = (flags == MPH ?
+                      hashtable_freeze_mph(h) : hashtable_freeze(h));
+
+    if (fh == NULL)
+    {
+      fprintf(stderr, "hashtable_freeze() failed\n");
+      exit(1);
+    }
+    hashtable_destroy(h);
+    h = fh;
+  }
+  return h;
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *hashes = "fast,good,wy";
+  const char *engines = "chain,swiss";
+  const char *sizes = "1000,16000,256000,4000000";
+  const char *keyfile = NULL;
+  double zipf = 0, miss = 0, write = 0;
+  size_t nops = 1000000, runs = 5;
+  uint64_t overhead;
+  int c;
+
+  while ((c = getopt(argc, argv, "H:E:n:z:m:w:o:r:k:")) != -1)
+    switch (c)
+    {
+    case 'H': hashes = optarg; break;
+    case 'E': engines = optarg; break;
+    case 'n': sizes = optarg; break;
+    case 'z': zipf = atof(optarg); break;
+    case 'm': miss = atof(optarg) / 100; break;
+    case 'w': write = atof(optarg) / 100; break;
+    case 'o': nops = strtoul(optarg, NULL, 10); break;
+    case 'r': runs = strtoul(optarg, NULL, 10); break;
+    case 'k': keyfile = optarg; break;
+    default: usage(argv[0]);
+    }
+  if (optind < argc || nops == 0 || runs == 0 || zipf < 0 ||
+      miss < 0 || miss > 1 || write < 0 || write > 1)
+    usage(argv[0]);
+
+  overhead = clock_overhead();
+  printf("hash,engine,keys,zipf,miss,write,run,ops,"
+         "ns_op,p50_ns,p99_ns,p999_ns\n");
+  for (const char *sp = sizes ; sp ; sp = strchr(sp, ','), sp = (sp ? sp + 1 : NULL))
+  {
+    size_t n = strtoul(sp, NULL, 10);
+    char **keys;
+    op_t *ops;
+    uint64_t *lat;
+    size_t nlat = (nops + SAMPLE - 1) / SAMPLE;
+
+    if (n == 0)
+      continue;
+    keys = make_keys(keyfile, &n);
+    if (n == 0)
+    {
+      fprintf(stderr, "No keys\n");
+      exit(1);
+    }
+    ops = make_ops(keys, n, nops, zipf, miss, write);
+    lat = xmalloc(nlat * sizeof(uint64_t));
+
+    for (size_t hf = 0 ; hf < NELEM(Hashes) ; hf++)
+    {
+      if (!in_list(hashes, Hashes[hf].name))
+        continue;
+      for (size_t e = 0 ; e < NELEM(Engines) ; e++)
+      {
+        double best = 0;
+
+        if (!in_list(engines, Engines[e].name))
+          continue;
+        if (Engines[e].flags < 0 && write > 0)
+        {
+          fprintf(stderr, "%s is read-only, skipped\n", Engines[e].name);
+          continue;
+        }
+        for (size_t r = 0 ; r < runs ; r++)
+        {
+          /* A fresh table each run, since writes change it */
+          hashtable_t h = fill((int)e, (int)hf, keys, n);
+          uint64_t total = run(h, ops, nops, lat, overhead);
+          double ns_op = (double)total / nops;
+
+          qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+          printf("%s,%s,%lu,%g,%g,%g,%lu,%lu,%.2f,%lu,%lu,%lu\n",
+                 Hashes[hf].name, Engines[e].name, (unsigned long)n,
+                 zipf, miss * 100, write * 100,
+                 (unsigned long)r + 1, (unsigned long)nops, ns_op,
+                 (unsigned long)lat[nlat / 2],
+                 (unsigned long)lat[(size_t)(nlat * 0.99)],
+                 (unsigned long)lat[(size_t)(nlat * 0.999)]);
+          fflush(stdout);
+          if (r == 0 || ns_op < best)
+            best = ns_op;
+          hashtable_destroy(h);
+        }
+        fprintf(stderr, "%-5s %-6s %9lu keys: %7.2f ns/op (best of %lu)\n",
+                Hashes[hf].name, Engines[e].name, (unsigned long)n, best,
+                (unsigned long)runs);
+      }
+    }
+    free(lat);
+    free(ops);
+    for (size_t i = 0 ; i < 2 * n ; i++)
+      free(keys[i]);
+    free(keys);
+  }
+  exit(0);
+}
@@ -0,0 +1,202 @@
+/*
+** A simple unit test for the C++ front end, hashtable.hpp.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "hashtable.hpp"
+
+static void
+check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "Failed: %s\n", what);
+        exit(1);
+    }
+}
+
+/* A key type that counts how many times it's constructed */
+static int Constructed = 0;
+
+struct counted
+{
+    std::string s;
+
+    explicit counted(std::string_view v) : s(v) { Constructed += 1; }
+    counted(counted &&c) noexcept = default;
+};
+
+struct counted_hash
+{
+    using is_transparent = void;
+
+    hashval_t operator()(std::string_view s) const noexcept
+    {
+        return htab::string_hash()(s);
+    }
+    hashval_t operator()(const counted &c) const noexcept
+    {
+        return (*this)(std::string_view(c.s));
+    }
+};
+
+struct counted_eq
+{
+    using is_transparent = void;
+
+    bool operator()(const counted &a, std::string_view b) const noexcept
+    {
+        return a.s == b;
+    }
+    bool operator()(const counted &a, const counted &b) const noexcept
+    {
+        return a.s == b.s;
+    }
+};
+
+int
+main()
+{
+    /*
+    ** String keys, many of them, with the same hash values as the C tables
+    */
+    {
+        htab::map<std::string, int> m(10);
+        char buf[32];
+        size_t n = 0;
+
+        printf("### New map, string keys\n");
+        check(htab::string_hash()("some key") == hash_string_fast("some key"),
+              "hash values differ from hash_string_fast");
+        for (int i = 0 ; i < 20000 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            check(m.try_emplace(buf, i).second, "try_emplace");
+        }
+        check(m.size() == 20000, "size after inserts");
+        check(!m.try_emplace(std::string("key-7"), -1).second &&
+              m["key-7"] == 7, "try_emplace of an existing key");
+        for (int i = 0 ; i < 20000 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            /* No std::string is made for these */
+            check(m.get(std::string_view(buf)) != nullptr &&
+                  *m.get(buf) == i && m.find(buf)->second == i,
+                  "lookup");
+        }
+        check(m.get("not-a-key") == nullptr && !m.contains("key-20000") &&
+              m.find("key-x") == m.end(), "lookup of missing keys");
+        for (auto [key, val] : m)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", val);
+            check(key == buf, "iteration");
+            n += 1;
+        }
+        check(n == 20000, "iteration count");
+        for (int i = 0 ; i < 20000 ; i += 2)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            check(m.erase(buf) == 1, "erase");
+        }
+        check(m.erase("key-0") == 0 && m.size() == 10000, "size after erase");
+        for (int i = 1 ; i < 20000 ; i += 2)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            check(m.get(buf) && *m.get(buf) == i && !m.get(buf + 1),
+                  "lookup after erase");
+        }
+        m.insert_or_assign("key-1", 100);
+        m["new"] += 5;
+        check(m["key-1"] == 100 && m["new"] == 5, "insert_or_assign");
+
+        htab::map<std::string, int> c(m), d;
+        d = std::move(c);
+        check(d.size() == m.size() && *d.get("new") == 5 && c.empty(),
+              "copy and move");
+        /* A moved from map has no buckets, but works */
+        check(c.begin() == c.end() && !c.get("new") && c.erase("new") == 0 &&
+              c.find("new") == c.end(), "moved from map");
+        c["again"] = 1;
+        check(c.size() == 1 && *c.get("again") == 1, "reusing a moved map");
+
+        /* Moves don't allocate, so a vector of maps moves them */
+        static_assert(std::is_nothrow_move_constructible_v<
+                      htab::map<std::string, int>> &&
+                      std::is_nothrow_move_assignable_v<
+                      htab::map<std::string, int>>,
+                      "maps are moved without throwing");
+        std::vector<htab::map<std::string, int>> v(1);
+        htab::map<std::string, int> *first = &v[0];
+
+        v[0]["kept"] = 3;
+        const int *kept = v[0].get("kept");
+        v.reserve(v.capacity() + 1);
+        check(&v[0] != first && v[0].get("kept") == kept,
+              "moved by the vector");
+        m.clear();
+        check(m.empty() && m.begin() == m.end() && d.size() == 10001,
+              "clear");
+        printf("    Buckets: %lu  Count: %lu\n",
+               (unsigned long)d.bucket_count(), (unsigned long)d.size());
+        printf("### String keys ok\n\n");
+    }
+
+    /*
+    ** Integer keys and move-only values
+    */
+    {
+        htab::map<uint64_t, std::unique_ptr<int>> m;
+        const htab::map<uint64_t, std::unique_ptr<int>> &cm = m;
+
+        printf("### New map, integer keys, move-only values\n");
+        /* Multiples of a power of two, that collide without mixing */
+        for (uint64_t i = 0 ; i < 5000 ; i++)
+            check(m.try_emplace(i << 20, std::make_unique<int>((int)i)).second,
+                  "try_emplace");
+        for (uint64_t i = 0 ; i < 5000 ; i++)
+            check(cm.get(i << 20) && **cm.get(i << 20) == (int)i,
+                  "lookup");
+        check(cm.count(1) == 0 && cm.find(1) == cm.end(), "missing key");
+        /* get() is noexcept only if the hash and the compare are */
+        using std_eq_map =
+            htab::map<int, int, htab::hash<int>, std::equal_to<int>>;
+        static_assert(noexcept(cm.get(1)) &&
+                      !noexcept(std::declval<std_eq_map &>().get(1)),
+                      "get() noexcept");
+        for (uint64_t i = 0 ; i < 5000 ; i += 3)
+            check(m.erase(i << 20) == 1, "erase");
+        m[7 << 20] = std::make_unique<int>(-7);
+        check(**m.get(7 << 20) == -7 && m.size() == 3333, "replace");
+        printf("    Buckets: %lu  Count: %lu\n",
+               (unsigned long)m.bucket_count(), (unsigned long)m.size());
+        printf("### Integer keys ok\n\n");
+    }
+
+    /*
+    ** Keys are only made when inserted
+    */
+    {
+        htab::map<counted, std::string, counted_hash, counted_eq> m;
+
+        printf("### New map, heterogeneous keys\n");
+        m.reserve(1000);
+        for (int i = 0 ; i < 3 ; i++)
+            m.try_emplace(std::string_view("only-once"), 3, 'x');
+        check(Constructed == 1 && *m.get("only-once") == "xxx",
+              "key constructed once");
+        check(m.contains(std::string_view("only-once")) && Constructed == 1,
+              "lookup without a key");
+        printf("### Heterogeneous keys ok\n\n");
+    }
+
+    printf("Ok\n");
+    exit(0);
+}
@@ -0,0 +1,283 @@
+/* htabhash.c
+**
+** Analyzes how well the builtin hash functions spread a set of keys.
+** Reads keys, one per line, from a file or standard input, puts them into
+** a table (with the same settings as htabtest), and for each hash function
+** reports:
+** - The chain length distribution, against the ideal (Poisson) one for a
+**   perfectly random hash function at the same load.
+** - Chi-square of the keys per bucket against the uniform distribution,
+**   with the degrees of freedom and the z score (which is within a few
+**   units of 0 for a good hash function).
+** - The average number of probes for hits and misses, measured with
+**   hashtable_stats(), against the ideal. (For misses, each key is looked
+**   up with a byte appended.)
+** - Avalanche: how often each output bit flips when one input bit is
+**   flipped, over a sample of the keys. Ideally that's half of the time,
+**   for every output bit.
+** Options: -p for power of two sizes, -a N to sample N keys for the
+** avalanche test (default 1000).
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "hashtable.h"
+
+#define HIST_MAX 12		/* Chain lengths shown */
+
+static struct
+{
+  const char *name;
+  hashfunc_t *hfun;
+  hashfunc_n_t *hfun_n;
+} Hashes[] = { { "fast", hash_string_fast, hash_mem_fast },
+               { "good", hash_string_good, hash_mem_good },
+               { "wy", hash_string_wy, hash_mem_wy } };
+
+#define NELEM(A) (sizeof(A) / sizeof((A)[0]))
+
+/* The ideal number of buckets with 'k' keys, out of 'size' buckets with
+** the load 'load'.
+*/
+static double
+poisson(size_t size, double load, size_t k)
+{
+  return size * exp(k * log(load) - load - lgamma(k + 1.0));
+}
+
+static void
+chains(hashtable_t h, size_t size, size_t count)
+{
+  size_t n = HIST_MAX + 1, cmax;
+  size_t *hist = malloc(n * sizeof(size_t));
+  double load = (double)count / size, chi2 = 0, df, rest = 0;
+
+  if (hist == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  cmax = hashtable_histogram(h, hist, n);
+  if (cmax >= n)
+  {				/* All of it for chi-square */
+    n = cmax + 1;
+    hist = realloc(hist, n * sizeof(size_t));
+    if (hist == NULL)
+    {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    (void)hashtable_histogram(h, hist, n);
+  }
+  printf("  Chain    Buckets   Expected\n");
+  for (size_t k = 0 ; k < n ; k++)
+  {
+    double e = poisson(size, load, k);
+
+    chi2 += hist[k] * (k - load) * (k - load) / load;
+    if (k < HIST_MAX && k <= cmax)
+      printf("  %5lu %10lu %10.1f\n",
+             (unsigned long)k, (unsigned long)hist[k], e);
+    else if (k >= HIST_MAX)
+      rest += hist[k];
+  }
+  if (cmax >= HIST_MAX)
+    printf("  %4lu+ %10.0f\n", (unsigned long)HIST_MAX, rest);
+  df = size - 1.0;
+  printf("  Chain max:   %lu\n", (unsigned long)cmax);
+  printf("  Chi-square:  %.1f (df %.0f, z %.2f)\n",
+         chi2, df, (chi2 - df) / sqrt(2 * df));
+  free(hist);
+}
+
+/* Looks up all the keys, or with a byte appended if 'miss', and returns
+** the average number of probes, or -1 if the library doesn't count them.
+*/
+static double
+probes(hashtable_t h, char **keys, size_t count, int miss)
+{
+  hashtable_stats_t st;
+  char buf[130];
+
+  hashtable_stats_reset(h);
+  for (size_t i = 0 ; i < count ; i++)
+    if (miss)
+    {
+      snprintf(buf, sizeof(buf), "%s\x01", keys[i]);
+      (void)hashtable_get(h, buf, NULL);
+    }
+    else
+      (void)hashtable_get(h, keys[i], NULL);
+  hashtable_stats(h, &st);
+  if (st.searches == 0)
+    return -1;
+  return (double)st.probes / st.searches;
+}
+
+static void
+print_probes(const char *s, double observed, double expected)
+{
+  if (observed < 0)
+    printf("  %s probes: - (expected %.3f)\n", s, expected);
+  else
+    printf("  %s probes: %.3f (expected %.3f)\n", s, observed, expected);
+}
+
+static void
+avalanche(hashfunc_n_t *hfun_n, char **keys, size_t count, size_t samples)
+{
+  size_t flips[64] = { 0 };
+  size_t trials = 0, total = 0, used = 0;
+  size_t step = (count > samples ? count / samples : 1);
+  double bias = 0;
+
+  for (size_t i = 0 ; i < count ; i += step)
+  {
+    unsigned char buf[128];
+    size_t len = strlen(keys[i]);
+    hashval_t hv;
+
+    memcpy(buf, keys[i], len);
+    hv = hfun_n(buf, len);
+    for (size_t bit = 0 ; bit < 8 * len ; bit++)
+    {
+      hashval_t diff;
+
+      buf[bit / 8] ^= 1 << (bit % 8);
+      diff = hv ^ hfun_n(buf, len);
+      buf[bit / 8] ^= 1 << (bit % 8);
+      for (int b = 0 ; b < 64 ; b++)
+        if (diff & ((hashval_t)1 << b))
+        {
+          flips[b] += 1;
+          total += 1;
+        }
+      trials += 1;
+    }
+  }
+  if (trials == 0)
+    return;
+  for (int b = 0 ; b < 64 ; b++)
+    if (flips[b] > 0)
+    {
+      double p = (double)flips[b] / trials;
+
+      used += 1;
+      if (fabs(p - 0.5) > bias)
+        bias = fabs(p - 0.5);
+    }
+  printf("  Avalanche:   %.2f of %lu output bits flip per input bit "
+         "(ideal %.1f),\n"
+         "               worst bit bias %.3f, over %lu flips\n",
+         (double)total / trials, (unsigned long)used, used / 2.0,
+         bias, (unsigned long)trials);
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t count = 0, size = 0, samples = 1000;
+  char buf[128];
+  char **a = NULL;
+  unsigned flags = HASHTABLE_CHAIN;
+  FILE *fp = stdin;
+  int argi;
+
+  for (argi = 1 ; argi < argc && argv[argi][0] == '-' ; argi++)
+  {
+    if (strcmp(argv[argi], "-p") == 0)
+      flags |= HASHTABLE_POW2;
+    else if (strcmp(argv[argi], "-a") == 0 && argi + 1 < argc)
+      samples = strtoul(argv[++argi], NULL, 10);
+    else
+      break;
+  }
+  if (argi < argc - 1 || (argi < argc && argv[argi][0] == '-') ||
+      samples == 0)
+  {
+    fprintf(stderr, "Usage: %s [-p] [-a samples] [keyfile]\n", argv[0]);
+    exit(1);
+  }
+  if (argi < argc && (fp = fopen(argv[argi], "r")) == NULL)
+  {
+    perror(argv[argi]);
+    exit(1);
+  }
+
+  while (fgets(buf, sizeof(buf), fp))
+  {
+    size_t len = strlen(buf);
+
+    if (len > 0 && buf[len-1] == '\n')
+      buf[--len] = '\0';
+    if (len == 0)
+      continue;
+    if (count >= size)
+    {
+      size += 100;
+      a = realloc(a, size * sizeof(char *));
+      if (!a)
+      {
+        fprintf(stderr, "realloc(a, %lu) failed\n",
+                (unsigned long)size * sizeof(char *));
+        exit(1);
+      }
+    }
+    a[count] = strdup(buf);
+    if (!a[count])
+    {
+      fprintf(stderr, "strdup(\"%s\") failed\n", buf);
+      exit(1);
+    }
+    count += 1;
+  }
+  if (fp != stdin)
+    fclose(fp);
+  if (count == 0)
+  {
+    fprintf(stderr, "No keys\n");
+    exit(1);
+  }
+
+  for (size_t hf = 0 ; hf < NELEM(Hashes) ; hf++)
+  {
+    hashtable_t h = hashtable_create_ext(count, 0.5, 0.8,
+                                         Hashes[hf].hfun, NULL, flags);
+    size_t tsize, tcount;
+    double load;
+
+    if (!h)
+    {
+      fprintf(stderr, "hashtable_create() failed\n");
+      exit(1);
+    }
+    for (size_t i = 0 ; i < count ; i++)
+      if (hashtable_put(h, a[i], NULL, NULL) == hashtable_ret_error)
+      {
+        fprintf(stderr, "hashtable_put(h, \"%s\") failed\n", a[i]);
+        exit(1);
+      }
+    hashtable_info(h, &tsize, &tcount, NULL, NULL);
+    load = (double)tcount / tsize;
+    printf("%s: size %lu, count %lu, load %.2f\n", Hashes[hf].name,
+           (unsigned long)tsize, (unsigned long)tcount, load);
+    chains(h, tsize, tcount);
+    /* A hit on the k:th key in a chain takes k probes, a miss on a chain
+    ** of k keys takes k probes, but at least 1.
+    */
+    print_probes("Hit ", probes(h, a, count, 0),
+                 1 + (tcount - 1) / (2.0 * tsize));
+    print_probes("Miss", probes(h, a, count, 1), load + exp(-load));
+    avalanche(Hashes[hf].hfun_n, a, count, samples);
+    putchar('\n');
+    hashtable_destroy(h);
+  }
+
+  for (size_t i = 0 ; i < count ; i++)
+    free(a[i]);
+  free(a);
+  exit(0);
+}
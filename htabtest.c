@@ -6,6 +6,10 @@
 ** The times the time it takes to put them into a hashtable,
 ** lookup each one, and then remove them all, from the table.
 ** Also prints some statistics about the table.
+** Options: -g to use hash_string_good, -w to use hash_string_wy,
+** -s to use the swiss table engine, -c for the cuckoo engine,
+** -i for incremental grow, -p for power of two sizes,
+** -f to look them up in a frozen copy, -m in a minimal perfect hash copy.
 */
 
 #include <stdlib.h>
@@ -32,11 +36,34 @@ main(int argc, char **argv)
   char buf[128];
   size_t size = 0;
   char **a = NULL;
-  hashtable_t h;
+  hashtable_t h, fh = NULL;
+  int freeze = 0;
   hashfunc_t *hfun = hash_string_fast;
+  unsigned flags = HASHTABLE_CHAIN;
 
-  if (argc == 2 && strcmp(argv[1], "-g") == 0)
-    hfun = hash_string_good;
+  for (int argi = 1 ; argi < argc ; argi++)
+  {
+    if (strcmp(argv[argi], "-g") == 0)
+      hfun = hash_string_good;
+    else if (strcmp(argv[argi], "-w") == 0)
+      hfun = hash_string_wy;
+    else if (strcmp(argv[argi], "-s") == 0)
+      flags = (flags & ~HASHTABLE_ENGINE_MASK) | HASHTABLE_SWISS;
+    else if (strcmp(argv[argi], "-c") == 0)
+      flags = (flags & ~HASHTABLE_ENGINE_MASK) | HASHTABLE_CUCKOO;
+    else if (strcmp(argv[argi], "-i") == 0)
+      flags |= HASHTABLE_INCREMENTAL;
+    else if (strcmp(argv[argi], "-p") == 0)
+      flags |= HASHTABLE_POW2;
+    else if (strcmp(argv[argi], "-f") == 0 || strcmp(argv[argi], "-m") == 0)
+      freeze = argv[argi][1];
+    else
+    {
+      fprintf(stderr, "Usage: %s [-g|-w] [-s|-c] [-i] [-p] [-f|-m] < keyfile\n",
+              argv[0]);
+      exit(1);
+    }
+  }
 
   count = 0;
   while (fgets(buf, sizeof(buf), stdin))
@@ -68,8 +95,9 @@ main(int argc, char **argv)
     count += 1;
   }
 
-  h = hashtable_create(count, 0.5, 0.8,
-		       hfun, NULL);
+  /* The index of each key is its value, stored inline */
+  h = hashtable_create_inline(count, 0.5, 0.8,
+			      hfun, sizeof(size_t), flags);
 
   if (!h)
   {
@@ -79,7 +107,7 @@ main(int argc, char **argv)
   gettimeofday(&t0, NULL);
   for (i = 0 ; i < count ; i++)
   {
-      switch (hashtable_put(h, a[i], (void *)i, NULL))
+      switch (hashtable_put(h, a[i], &i, NULL))
       {
       case hashtable_ret_error:
 	fprintf(stderr, "hashtable_put(h, \"%s\", %lu) failed\n",
@@ -128,14 +156,30 @@ main(int argc, char **argv)
           printf("%s\n", key);
   }
 
+  if (freeze)
+  {
+    gettimeofday(&t0, NULL);
+    fh = (freeze == 'm' ? hashtable_freeze_mph(h) : hashtable_freeze(h));
+    gettimeofday(&t1, NULL);
+    if (!fh)
+    {
+      fprintf(stderr, "hashtable_freeze() failed\n");
+      exit(1);
+    }
+    print_time("Freeze:", &t0, &t1);
+  }
+
   i = count;
   gettimeofday(&t0, NULL);
   while (i--)
   {
     size_t val;
 
-    if (hashtable_get(h, a[i], (void **)&val) == hashtable_ret_not_found)
+    if (hashtable_get_value((fh ? fh : h), a[i], &val) ==
+        hashtable_ret_not_found)
       printf("GET: No \"%s\" found\n", a[i]);
+    else if (val >= count || strcmp(a[val], a[i]) != 0)
+      printf("GET: Wrong value for \"%s\": %lu\n", a[i], (unsigned long)val);
   }
   gettimeofday(&t1, NULL);
   print_time("Find:  ", &t0, &t1);
@@ -150,6 +194,8 @@ main(int argc, char **argv)
   gettimeofday(&t1, NULL);
   print_time("Delete:", &t0, &t1);
 
+  if (fh)
+    hashtable_destroy(fh);
   hashtable_destroy(h);
   for (i = 0 ; i < count ; i++)
       free(a[i]);
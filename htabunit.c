@@ -8,7 +8,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "hashtable.h"
+#include "hashtable64.h"
+#include "chashtable.h"
+#include "snapshot.h"
+
+#define NELEM(A) ((int)(sizeof(A) / sizeof((A)[0])))
+
+/* The engines, and the flags that change their layout, for the tests that
+** are run with each
+*/
+static const unsigned Engines[] =
+    {
+     HASHTABLE_CHAIN, HASHTABLE_SWISS, HASHTABLE_INCREMENTAL,
+     HASHTABLE_POW2 | HASHTABLE_ARENA, HASHTABLE_CUCKOO
+    };
 
 static char *Words[] =
     {
@@ -17,6 +35,38 @@ static char *Words[] =
      NULL
     };
 
+/* The number of the library's allocations that succeed before the rest
+** fail (htabunit is linked with --wrap=malloc), and the failures
+*/
+static size_t MallocsLeft = SIZE_MAX;
+static size_t MallocFailed = 0;
+
+extern void *__real_malloc(size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    if (MallocsLeft == 0)
+    {
+        MallocFailed += 1;
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (MallocsLeft != SIZE_MAX)
+        MallocsLeft -= 1;
+    return __real_malloc(size);
+}
+
+/* A destructor that only counts */
+static size_t Destroyed = 0;
+
+static void
+count_dest(void *val)
+{
+    (void)val;
+    Destroyed += 1;
+}
+
 static void
 print_info(hashtable_t h)
 {
@@ -30,6 +80,20 @@ print_info(hashtable_t h)
            ((float)count) / size);
 }
 
+/* A string hash function that isn't one of the builtin ones */
+static hashval_t
+custom_hash(const char *s)
+{
+    return hash_string_fast(s) * 31;
+}
+
+/* And one for binary keys */
+static hashval_t
+custom_hash_n(const void *key, size_t len)
+{
+    return hash_mem_fast(key, len) * 37;
+}
+
 static void
 perrex(const char *fmt, ...)
 {
@@ -41,12 +105,258 @@ perrex(const char *fmt, ...)
     exit(1);
 }
 
+/*
+** Put, get, remove and iterate over 'n' generated keys, checking the
+** results along the way. The table must be empty and without destructor.
+*/
+static void
+test_many(hashtable_t h, size_t n)
+{
+    char **keys = malloc(n * sizeof(char *));
+    size_t i, count;
+    const char *key;
+    char *val;
+    hashtable_iter_t iter;
+
+    if (keys == NULL)
+        perrex("Out of memory\n");
+    for (i = 0 ; i < n ; i++)
+    {
+        char buf[32];
+
+        snprintf(buf, sizeof(buf), "%s%lu", (i & 1 ? "key-" : ""),
+                 (unsigned long)i * 7919);
+        keys[i] = strdup(buf);
+        if (keys[i] == NULL)
+            perrex("Out of memory\n");
+        if (hashtable_put(h, keys[i], keys[i], NULL) != hashtable_ret_ok)
+            perrex("Failed to put key %s\n", keys[i]);
+    }
+    for (i = 0 ; i < n ; i++)
+        if (hashtable_get(h, keys[i], (void **)&val) != hashtable_ret_ok ||
+            val != keys[i])
+            perrex("Failed to get key %s\n", keys[i]);
+    if (hashtable_get(h, "not-a-key", (void **)&val) != hashtable_ret_not_found)
+        perrex("Found not-a-key in table, shouldn't have.\n");
+    {
+        void **vals = malloc(n * sizeof(void *));
+        hashtable_ret_t *rets = malloc(n * sizeof(hashtable_ret_t));
+        char *mkey = keys[n / 2];
+
+        if (vals == NULL || rets == NULL)
+            perrex("Out of memory\n");
+        keys[n / 2] = "not-a-key";
+        if (hashtable_get_many(h, (const char *const *)keys, n, vals, rets)
+            != n - 1)
+            perrex("Failed to get many keys\n");
+        keys[n / 2] = mkey;
+        for (i = 0 ; i < n ; i++)
+            if (i == n / 2
+                ? rets[i] != hashtable_ret_not_found
+                : (rets[i] != hashtable_ret_ok || vals[i] != keys[i]))
+                perrex("Wrong result from get many for key %s\n", keys[i]);
+        free(vals);
+        free(rets);
+    }
+    for (i = 0 ; i < n ; i += 2)
+        if (hashtable_rem(h, keys[i], (void **)&val) != hashtable_ret_ok ||
+            val != keys[i])
+            perrex("Failed to remove key %s\n", keys[i]);
+    for (i = 0 ; i < n ; i++)
+    {
+        hashtable_ret_t ret = hashtable_get(h, keys[i], NULL);
+
+        if (ret != (i & 1 ? hashtable_ret_ok : hashtable_ret_not_found))
+            perrex("Wrong result for key %s after removal\n", keys[i]);
+    }
+    count = 0;
+    hashtable_iter_init(h, &iter);
+    while (hashtable_iter_next(h, &iter, &key, (void **)&val))
+    {
+        count += 1;
+        if (strcmp(key, val) != 0)
+            perrex("Key-val mismatch: %s != %s\n", key, val);
+    }
+    if (count != n / 2)
+        perrex("Iterator found %lu keys, expected %lu\n",
+               (unsigned long)count, (unsigned long)n / 2);
+    for (i = 0 ; i < n ; i += 2)
+        if (hashtable_put(h, keys[i], keys[i], NULL) != hashtable_ret_ok)
+            perrex("Failed to put key %s again\n", keys[i]);
+    for (i = 0 ; i < n ; i++)
+        if (hashtable_put(h, keys[i], keys[i], NULL) != hashtable_ret_replaced)
+            perrex("Failed to replace key %s\n", keys[i]);
+    print_info(h);
+    hashtable_clear(h);
+    for (i = 0 ; i < n ; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+#define CONC_THREADS 4
+#define CONC_KEYS    20000
+
+typedef struct conc_arg_s
+{
+    chashtable_t h;
+    unsigned id;
+    bool fail;
+} conc_arg_t;
+
+/* Puts its own keys, removes every other one, and puts them back again */
+static void *
+conc_writer(void *arg)
+{
+    conc_arg_t *a = arg;
+    char buf[32];
+    size_t i;
+
+    for (i = 0 ; i < CONC_KEYS ; i++)
+    {
+        snprintf(buf, sizeof(buf), "w%u-%lu", a->id, (unsigned long)i);
+        if (chashtable_put(a->h, buf, (void *)(uintptr_t)(i + 1), NULL) !=
+            hashtable_ret_ok)
+            a->fail = true;
+    }
+    for (i = 0 ; i < CONC_KEYS ; i += 2)
+    {
+        snprintf(buf, sizeof(buf), "w%u-%lu", a->id, (unsigned long)i);
+        if (chashtable_rem(a->h, buf, NULL) != hashtable_ret_ok)
+            a->fail = true;
+    }
+    for (i = 0 ; i < CONC_KEYS ; i += 2)
+    {
+        snprintf(buf, sizeof(buf), "w%u-%lu", a->id, (unsigned long)i);
+        if (chashtable_put(a->h, buf, (void *)(uintptr_t)(i + 1), NULL) !=
+            hashtable_ret_ok)
+            a->fail = true;
+    }
+    return NULL;
+}
+
+/* Looks up the keys of one writer while it's working. Any key found must
+** have the right value.
+*/
+static void *
+conc_reader(void *arg)
+{
+    conc_arg_t *a = arg;
+    char buf[32];
+    void *val;
+
+    for (int round = 0 ; round < 4 ; round++)
+        for (size_t i = 0 ; i < CONC_KEYS ; i++)
+        {
+            snprintf(buf, sizeof(buf), "w%u-%lu", a->id, (unsigned long)i);
+            if (chashtable_get(a->h, buf, &val) == hashtable_ret_ok &&
+                val != (void *)(uintptr_t)(i + 1))
+                a->fail = true;
+        }
+    return NULL;
+}
+
+/* Saves 'h' to a temporary file, with 'vsize' byte values, and opens it
+** again with 'hfun', or 'hfun_n' if it's not NULL. The file is removed
+** (the mapping stays valid).
+*/
+static hashtable_t
+save_open(hashtable_t h, size_t vsize,
+          hashfunc_t *hfun, hashfunc_n_t *hfun_n)
+{
+    char path[] = "/tmp/htabunitXXXXXX";
+    int fd = mkstemp(path);
+    hashtable_t oh;
+
+    if (fd < 0)
+        perrex("Failed to create temporary file\n");
+    if (hashtable_save(h, fd, vsize) != hashtable_ret_ok)
+        perrex("Failed to save table: %s\n", strerror(errno));
+    close(fd);
+    oh = (hfun_n ? hashtable_open_mmap_n(path, hfun_n) :
+          hashtable_open_mmap(path, hfun));
+    unlink(path);
+    return oh;
+}
+
+#define SNAP_KEYS     1000
+#define SNAP_VERSIONS 20
+
+/* A frozen table where all 'SNAP_KEYS' keys have the value 'version' */
+static hashtable_t
+snap_version(uintptr_t version)
+{
+    hashtable_t h = hashtable_create_ext(0, 0, 0, NULL, NULL, HASHTABLE_SWISS);
+    hashtable_t fh;
+    char buf[32];
+
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    for (int i = 0 ; i < SNAP_KEYS ; i++)
+    {
+        snprintf(buf, sizeof(buf), "snap-%d", i);
+        if (hashtable_put(h, buf, (void *)version, NULL) != hashtable_ret_ok)
+            perrex("Failed to put key %s\n", buf);
+    }
+    fh = hashtable_freeze(h);
+    if (fh == NULL)
+        perrex("Failed to freeze table\n");
+    hashtable_destroy(h);
+    return fh;
+}
+
+/* Reads while versions are published. All keys of a version must have the
+** same value, and versions only increase.
+*/
+static void *
+snap_reader(void *arg)
+{
+    snapshot_t s = arg;
+    uintptr_t last = 0;
+    char buf[32];
+
+    for (;;)
+    {
+        unsigned ticket;
+        hashtable_t t = snapshot_enter(s, &ticket);
+        hashtable_iter_t iter;
+        uintptr_t version;
+        void *val;
+        size_t n = 0;
+
+        if (hashtable_get(t, "snap-0", &val) != hashtable_ret_ok)
+            return "key missing";
+        version = (uintptr_t)val;
+        if (version < last)
+            return "version went backwards";
+        for (int i = 0 ; i < SNAP_KEYS ; i += 7)
+        {
+            snprintf(buf, sizeof(buf), "snap-%d", i);
+            if (hashtable_get(t, buf, &val) != hashtable_ret_ok ||
+                (uintptr_t)val != version)
+                return "inconsistent version";
+        }
+        hashtable_iter_init(t, &iter);
+        while (hashtable_iter_next(t, &iter, NULL, &val))
+            if ((uintptr_t)val != version)
+                return "inconsistent iteration";
+            else
+                n += 1;
+        snapshot_exit(s, ticket);
+        if (n != SNAP_KEYS)
+            return "wrong number of keys";
+        if (version == SNAP_VERSIONS)
+            return NULL;
+        last = version;
+    }
+}
+
 int
 main()
 {
     int i;
     char *val;
     hashtable_t h;
+    hashtable_iter_t iter;
 
     /*
     ** Small table, default values, fast, test grow
@@ -133,7 +443,6 @@ main()
     */
     int count = 0;
     const char *key;
-    hashtable_iter_t iter;
     hashtable_iter_init(h, &iter);
     while (hashtable_iter_next(h, &iter, &key, (void **)&val))
     {
@@ -205,6 +514,1530 @@ main()
 
     hashtable_destroy(h);
 
+    /*
+    ** Many keys, growing a small table several times
+    */
+    h = hashtable_create(10, 0.5, 0.8, NULL, NULL);
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    printf("### New table, many keys\n");
+    test_many(h, 5000);
+    printf("### Many keys ok\n");
+    putchar('\n');
+
+    hashtable_destroy(h);
+
+    h = hashtable_create(10, 0.5, 0.8, hash_string_wy, NULL);
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    printf("### New table, WY hash function, many keys\n");
+    test_many(h, 5000);
+    if (hash_string_wy("abcdefghijklmnopqrstuvwxyz0123456789") !=
+        hash_mem_wy("abcdefghijklmnopqrstuvwxyz0123456789_", 36))
+        perrex("hash_string_wy() and hash_mem_wy() differ\n");
+    printf("### Many keys ok\n");
+    putchar('\n');
+
+    hashtable_destroy(h);
+
+    /*
+    ** Power of two sizes, also with incremental grow
+    */
+    for (i = 0 ; i < 2 ; i++)
+    {
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL, HASHTABLE_POW2 |
+                                 (i ? HASHTABLE_INCREMENTAL : 0));
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, power of two sizes%s\n",
+               (i ? ", incremental grow" : ""));
+        print_info(h);
+        test_many(h, 5000);
+        printf("### Power of two sizes ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Incremental grow
+    */
+    h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL, HASHTABLE_INCREMENTAL);
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    printf("### New table, incremental grow\n");
+    test_many(h, 5000);
+    printf("### Incremental grow ok\n");
+    putchar('\n');
+
+    hashtable_destroy(h);
+
+    /*
+    ** Binary keys, with the builtin length hash, and a custom string hash
+    ** function (which needs copies of the keys)
+    */
+    for (i = 0 ; i < 3 ; i++)
+    {
+        unsigned char bkey[16];
+        size_t len;
+        const void *kp;
+        int n;
+
+        if (i == 0)
+            h = hashtable_create_n(0, 0, 0, NULL, NULL, HASHTABLE_CHAIN);
+        else if (i == 1)
+            h = hashtable_create_n(0, 0, 0, hash_mem_good, NULL, HASHTABLE_SWISS);
+        else
+            h = hashtable_create(0, 0, 0, custom_hash, NULL);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, binary keys (%d)\n", i);
+        for (n = 0 ; n < 1000 ; n++)
+        {
+            /* Keys of different lengths, with nul bytes, and that are
+            ** prefixes of each other.
+            */
+            memset(bkey, 0, sizeof(bkey));
+            bkey[0] = n % 251;
+            bkey[2] = n / 251;
+            if (hashtable_put_n(h, bkey, 1 + n % 12, (void *)bkey,
+                                NULL) != hashtable_ret_ok)
+                perrex("Failed to put binary key %d\n", n);
+        }
+        for (n = 0 ; n < 1000 ; n++)
+        {
+            memset(bkey, 0, sizeof(bkey));
+            bkey[0] = n % 251;
+            bkey[2] = n / 251;
+            if (hashtable_get_n(h, bkey, 1 + n % 12, NULL) != hashtable_ret_ok)
+                perrex("Failed to get binary key %d\n", n);
+            if (hashtable_get_n(h, bkey, 13, NULL) != hashtable_ret_not_found)
+                perrex("Found binary key %d with the wrong length\n", n);
+        }
+        n = 0;
+        hashtable_iter_init(h, &iter);
+        while (hashtable_iter_next_n(h, &iter, &kp, &len, NULL))
+        {
+            n += 1;
+            if (len < 1 || len > 12 || ((const char *)kp)[len] != '\0')
+                perrex("Iterator returned a bad key length %lu\n",
+                       (unsigned long)len);
+        }
+        if (n != 1000)
+            perrex("Iterator found %d binary keys, expected 1000\n", n);
+        /* String and binary keys are the same thing */
+        if (hashtable_put(h, "string key", Words[0], NULL) != hashtable_ret_ok)
+            perrex("Failed to put string key\n");
+        if (hashtable_get_n(h, "string key", 10, (void **)&val) != hashtable_ret_ok ||
+            val != Words[0])
+            perrex("Failed to get string key as binary\n");
+        if (hashtable_rem_n(h, "string key", 10, NULL) != hashtable_ret_ok)
+            perrex("Failed to remove string key as binary\n");
+        for (n = 0 ; n < 1000 ; n++)
+        {
+            memset(bkey, 0, sizeof(bkey));
+            bkey[0] = n % 251;
+            bkey[2] = n / 251;
+            if (hashtable_rem_n(h, bkey, 1 + n % 12, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove binary key %d\n", n);
+        }
+        print_info(h);
+        printf("### Binary keys ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Arena allocation, with both engines
+    */
+    for (i = 0 ; i < 2 ; i++)
+    {
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 HASHTABLE_ARENA |
+                                 (i ? HASHTABLE_SWISS : HASHTABLE_CHAIN));
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, arena, %s engine\n", (i ? "SWISS" : "CHAIN"));
+        test_many(h, 5000);
+        test_many(h, 3000);
+        printf("### Arena ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Borrowed keys, with all engines
+    */
+    for (i = 0 ; i < NELEM(Engines) ; i++)
+    {
+        char *pool = malloc(3000 * 32), *p = pool;
+        hashtable_iter_t it;
+        const char *key;
+        size_t n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 Engines[i] | HASHTABLE_BORROW);
+        if (h == NULL || pool == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, borrowed keys, engine 0x%x\n", Engines[i]);
+        test_many(h, 5000);
+        /* Long keys are used where they are, short ones copied */
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(p, 32, (n & 1 ? "%lu" : "borrowed-key-%lu"),
+                     (unsigned long)n);
+            if (hashtable_put(h, p, p, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", p);
+            p += 32;
+        }
+        for (n = 0 ; n < 3000 ; n += 3)
+            if (hashtable_rem(h, pool + 32 * n, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", pool + 32 * n);
+        hashtable_iter_init(h, &it);
+        n = 0;
+        while (hashtable_iter_next(h, &it, &key, (void **)&val))
+        {
+            if (strcmp(key, val) != 0 ||
+                (strlen(key) > 7 ? key != val : key == val))
+                perrex("Wrong key %s\n", key);
+            n += 1;
+        }
+        if (n != 2000)
+            perrex("Iterator found %lu keys\n", (unsigned long)n);
+        print_info(h);
+        printf("### Borrowed keys ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+        free(pool);
+    }
+
+    /*
+    ** Shrinking, automatic and explicit
+    */
+    for (i = 0 ; i < 2 ; i++)
+    {
+        size_t size, n = 0;
+        char buf[32];
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 (i ? HASHTABLE_SWISS : HASHTABLE_CHAIN));
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, shrinking, %s engine\n", (i ? "SWISS" : "CHAIN"));
+        for (n = 0 ; n < 2000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+            if (hashtable_put(h, buf, NULL, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        print_info(h);
+        while (n-- > 10)
+        {
+            snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+            if (hashtable_rem(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        print_info(h);
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        if (size > 64)
+            perrex("Table did not shrink, size %lu\n", (unsigned long)size);
+        hashtable_set_shrinkload(h, 0);
+        for (n = 10 ; n < 2000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+            if (hashtable_put(h, buf, NULL, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        while (n-- > 100)
+        {
+            snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+            if (hashtable_rem(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        print_info(h);
+        if (hashtable_shrink_to_fit(h) != hashtable_ret_ok)
+            perrex("Failed to shrink table\n");
+        print_info(h);
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        if (size > 256)
+            perrex("Table did not shrink to fit, size %lu\n",
+                   (unsigned long)size);
+        for (n = 0 ; n < 100 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+            if (hashtable_get(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to get key %s\n", buf);
+        }
+        /* An empty table keeps the smallest size it's created with */
+        hashtable_clear(h);
+        if (hashtable_shrink_to_fit(h) != hashtable_ret_ok)
+            perrex("Failed to shrink table\n");
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        if (size < 16)
+            perrex("Empty table shrunk to size %lu\n", (unsigned long)size);
+        printf("### Shrinking ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** The swiss table engine
+    */
+    h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL, HASHTABLE_SWISS);
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    printf("### New table, SWISS engine\n");
+    print_info(h);
+    test_many(h, 5000);
+    printf("### Swiss table ok\n");
+    print_info(h);
+    putchar('\n');
+
+    hashtable_destroy(h);
+
+    /*
+    ** The cuckoo engine, with all 17576 keys of three letters, which
+    ** hash_string_fast gives only a few thousand different hash values
+    */
+    h = hashtable_create_ext(10, 0.5, 0.8, hash_string_fast, NULL,
+                             HASHTABLE_CUCKOO);
+    if (h == NULL)
+        perrex("Failed to create hash table\n");
+    printf("### New table, CUCKOO engine\n");
+    test_many(h, 5000);
+    {
+        size_t hist[4], count, cmax;
+        char buf[4] = { 0 };
+        int n;
+
+        for (n = 0 ; n < 17576 ; n++)
+        {
+            buf[0] = 'a' + n / 676;
+            buf[1] = 'a' + n / 26 % 26;
+            buf[2] = 'a' + n % 26;
+            if (hashtable_put(h, buf, (void *)(uintptr_t)n, NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        for (n = 0 ; n < 17576 ; n += 2)
+        {
+            buf[0] = 'a' + n / 676;
+            buf[1] = 'a' + n / 26 % 26;
+            buf[2] = 'a' + n % 26;
+            if (hashtable_rem(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        for (n = 0 ; n < 17576 ; n++)
+        {
+            void *v;
+
+            buf[0] = 'a' + n / 676;
+            buf[1] = 'a' + n / 26 % 26;
+            buf[2] = 'a' + n % 26;
+            if (n & 1
+                ? (hashtable_get(h, buf, &v) != hashtable_ret_ok ||
+                   (uintptr_t)v != (uintptr_t)n)
+                : hashtable_get(h, buf, &v) != hashtable_ret_not_found)
+                perrex("Wrong result for key %s\n", buf);
+        }
+        hashtable_info(h, NULL, &count, NULL, &cmax);
+        if (count != 17576 / 2 || cmax > 2 ||
+            hashtable_histogram(h, hist, 4) != cmax || hist[0] != 0 ||
+            hist[1] + hist[2] != count || hist[3] != 0)
+            perrex("Keys outside of their two buckets\n");
+        if (hashtable_shrink_to_fit(h) != hashtable_ret_ok ||
+            hashtable_get(h, "zzz", NULL) != hashtable_ret_ok)
+            perrex("Failed to shrink to fit\n");
+    }
+    printf("### Cuckoo table ok\n");
+    print_info(h);
+    putchar('\n');
+
+    hashtable_destroy(h);
+
+    /*
+    ** Counting keys with upsert, with different engines
+    */
+    for (i = 0 ; i < NELEM(Engines) ; i++)
+    {
+        hashtable_t fh;
+        size_t count, inserts = 0;
+        char buf[32];
+        void **slot;
+        bool inserted;
+        int n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL, Engines[i]);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, upsert, engine 0x%x\n", Engines[i]);
+        /* Key k % 1000 is counted 3 times (4 for k < 100) */
+        for (n = 0 ; n < 3100 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "upsert-key-%d", n % 1000);
+            if ((n & 1
+                 ? hashtable_upsert(h, buf, &slot, &inserted)
+                 : hashtable_upsert_n(h, buf, strlen(buf), &slot, &inserted))
+                != hashtable_ret_ok)
+                perrex("Failed to upsert key %s\n", buf);
+            if (inserted != (n < 1000) || (inserted && *slot != NULL))
+                perrex("Wrong upsert of key %s\n", buf);
+            inserts += inserted;
+            *slot = (void *)((uintptr_t)*slot + 1);
+        }
+        hashtable_info(h, NULL, &count, NULL, NULL);
+        if (count != 1000 || inserts != 1000)
+            perrex("Wrong count after upserts: %lu\n", (unsigned long)count);
+        for (n = 0 ; n < 1000 ; n++)
+        {
+            void *val;
+
+            snprintf(buf, sizeof(buf), "upsert-key-%d", n);
+            if (hashtable_get(h, buf, &val) != hashtable_ret_ok ||
+                (uintptr_t)val != (n < 100 ? 4u : 3u))
+                perrex("Wrong count for key %s\n", buf);
+        }
+        if (hashtable_upsert(h, "", &slot, NULL) != hashtable_ret_error)
+            perrex("Upserted an empty key\n");
+        fh = hashtable_freeze(h);
+        if (fh == NULL)
+            perrex("Failed to freeze table\n");
+        if (hashtable_upsert(fh, "upsert-key-0", &slot, NULL) !=
+            hashtable_ret_error)
+            perrex("Upserted into a frozen table\n");
+        hashtable_destroy(fh);
+        print_info(h);
+        printf("### Upsert ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Inline values, of a struct and of a short integer
+    */
+    for (i = 0 ; i < NELEM(Engines) ; i++)
+    {
+        struct rec_s { uint64_t n; char tag[16]; } rec, *rp;
+        hashtable_t fh, sh;
+        hashtable_iter_t iter;
+        size_t left, seen = 0;
+        const char *key;
+        char buf[48];
+        uint16_t u16;
+        void **slot, *val, *old;
+        bool inserted;
+        int n;
+
+        if (hashtable_create_inline(0, 0, 0, NULL, 0, Engines[i]) != NULL)
+            perrex("Created a table with 0 byte inline values\n");
+        h = hashtable_create_inline(10, 0.5, 0.8, NULL, sizeof(rec),
+                                    Engines[i]);
+        sh = hashtable_create_inline(10, 0.5, 0.8, hash_string_wy,
+                                     sizeof(u16), Engines[i]);
+        if (h == NULL || sh == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, inline values, engine 0x%x\n", Engines[i]);
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (n & 1 ? "a-long-inline-value-key" : "iv"), n);
+            memset(&rec, 0, sizeof(rec));
+            rec.n = n;
+            snprintf(rec.tag, sizeof(rec.tag), "t%d", n);
+            u16 = (uint16_t)(n * 7);
+            if (hashtable_put(h, buf, &rec, NULL) != hashtable_ret_ok ||
+                hashtable_put(sh, buf, &u16, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        /* The first 100 replaced, the value copied again */
+        for (n = 0 ; n < 100 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (n & 1 ? "a-long-inline-value-key" : "iv"), n);
+            rec.n = n + 10000;
+            snprintf(rec.tag, sizeof(rec.tag), "t%d", n);
+            if (hashtable_put(h, buf, &rec, NULL) != hashtable_ret_replaced)
+                perrex("Failed to replace key %s\n", buf);
+        }
+        if (hashtable_put(h, "iv-0", &rec, &old) != hashtable_ret_error ||
+            hashtable_rem(h, "iv-0", &old) != hashtable_ret_error)
+            perrex("Handed back an inline value\n");
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (n & 1 ? "a-long-inline-value-key" : "iv"), n);
+            memset(&rec, 0xff, sizeof(rec));
+            if (hashtable_get_value(h, buf, &rec) != hashtable_ret_ok ||
+                hashtable_get(h, buf, &val) != hashtable_ret_ok ||
+                hashtable_get_value(sh, buf, &u16) != hashtable_ret_ok)
+                perrex("Failed to get key %s\n", buf);
+            rp = val;
+            if (rec.n != (uint64_t)(n < 100 ? n + 10000 : n) ||
+                rp->n != rec.n || strcmp(rec.tag, rp->tag) != 0 ||
+                u16 != (uint16_t)(n * 7))
+                perrex("Wrong value for key %s\n", buf);
+        }
+        /* Upsert points to the bytes, zeroed when inserted */
+        if (hashtable_upsert(h, "iv-new", &slot, &inserted) !=
+            hashtable_ret_ok || !inserted)
+            perrex("Failed to upsert key iv-new\n");
+        rp = (struct rec_s *)slot;
+        if (rp->n != 0 || rp->tag[0] != '\0' || rp->tag[15] != '\0')
+            perrex("Upserted inline value not zeroed\n");
+        strcpy(rp->tag, "new");
+        if (hashtable_upsert(h, "iv-2", &slot, &inserted) !=
+            hashtable_ret_ok || inserted)
+            perrex("Failed to upsert key iv-2\n");
+        ((struct rec_s *)slot)->n += 1;
+        if (hashtable_get_value(h, "iv-new", &rec) != hashtable_ret_ok ||
+            strcmp(rec.tag, "new") != 0 ||
+            hashtable_get_value(h, "iv-2", &rec) != hashtable_ret_ok ||
+            rec.n != 10003 ||
+            hashtable_get_value(h, "iv-none", &rec) != hashtable_ret_not_found)
+            perrex("Wrong value after upsert\n");
+        /* Iterators give pointers to the bytes too */
+        hashtable_iter_init(h, &iter);
+        while (hashtable_iter_next(h, &iter, &key, &val))
+        {
+            rp = val;
+            if (strcmp(key, "iv-new") != 0 &&
+                (snprintf(buf, sizeof(buf), "t%lu",
+                          (unsigned long)(rp->n % 10000 -
+                                          (strcmp(key, "iv-2") == 0))),
+                 strcmp(buf, rp->tag) != 0))
+                perrex("Wrong value for key %s in iteration\n", key);
+            seen += 1;
+        }
+        if (seen != 3001)
+            perrex("Iterated over %lu keys\n", (unsigned long)seen);
+        /* Frozen copies keep the values */
+        fh = hashtable_freeze(h);
+        if (fh == NULL)
+            perrex("Failed to freeze table\n");
+        for (n = 0 ; n < 3000 ; n += 7)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (n & 1 ? "a-long-inline-value-key" : "iv"), n);
+            if (hashtable_get_value(fh, buf, &rec) != hashtable_ret_ok ||
+                rec.n % 10000 != (uint64_t)n + (n == 2))
+                perrex("Wrong value for key %s in frozen table\n", buf);
+        }
+        hashtable_destroy(fh);
+        for (n = 0 ; n < 3000 ; n += 2)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (n & 1 ? "a-long-inline-value-key" : "iv"), n);
+            if (hashtable_rem(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        hashtable_info(h, NULL, &left, NULL, NULL);
+        if (left != 1501 ||
+            hashtable_get_value(h, "a-long-inline-value-key-2999", &rec) !=
+            hashtable_ret_ok || rec.n != 2999)
+            perrex("Wrong contents after removing\n");
+        print_info(h);
+        printf("### Inline values ok\n");
+        putchar('\n');
+
+        hashtable_destroy(sh);
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Sweeping with a kept iterator, removing keys, while other keys are
+    ** put and the table grows
+    */
+    for (i = 0 ; i < NELEM(Engines) ; i++)
+    {
+        unsigned char seen[3000] = { 0 };
+        hashtable_iter_t iter;
+        hashtable_t fh;
+        size_t count, added = 0, again = 0;
+        const char *key;
+        char buf[32];
+        void *val;
+        int n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL, Engines[i]);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, sweep, engine 0x%x\n", Engines[i]);
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "sweep-%d", n);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)(n + 1), NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        hashtable_iter_init(h, &iter);
+        if (hashtable_iter_rem(h, &iter) != hashtable_ret_not_found)
+            perrex("Removed before the first key\n");
+        for (bool more = true ; more ; )
+        {
+            /* 100 keys per tick, removing every third of the first keys */
+            for (int k = 0 ; k < 100 ; k++)
+            {
+                uintptr_t v;
+
+                if (!hashtable_iter_next(h, &iter, &key, &val))
+                {
+                    more = false;
+                    break;
+                }
+                v = (uintptr_t)val;
+                if (v == 0)
+                    continue;	/* Put during the sweep */
+                snprintf(buf, sizeof(buf), "sweep-%lu", (unsigned long)v - 1);
+                if (strcmp(key, buf) != 0)
+                    perrex("Key-val mismatch: %s != %s\n", key, buf);
+                again += seen[v - 1];
+                seen[v - 1] = 1;
+                if ((v - 1) % 3 == 0)
+                {
+                    if (hashtable_iter_rem(h, &iter) != hashtable_ret_ok ||
+                        hashtable_iter_rem(h, &iter) !=
+                        hashtable_ret_not_found)
+                        perrex("Failed to remove key %s\n", key);
+                }
+            }
+            /* Between the ticks, the table grows */
+            for (int k = 0 ; k < 30 ; k++, added++)
+            {
+                snprintf(buf, sizeof(buf), "added-%lu", (unsigned long)added);
+                if (hashtable_put(h, buf, NULL, NULL) != hashtable_ret_ok)
+                    perrex("Failed to put key %s\n", buf);
+            }
+            if (more && hashtable_iter_rem(h, &iter) != hashtable_ret_not_found)
+                perrex("Removed a key after puts\n");
+        }
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "sweep-%d", n);
+            if (!seen[n] ||
+                hashtable_get(h, buf, NULL) !=
+                (n % 3 == 0 ? hashtable_ret_not_found : hashtable_ret_ok))
+                perrex("Key %s missed by the sweep\n", buf);
+        }
+        hashtable_info(h, NULL, &count, NULL, NULL);
+        if (count != 2000 + added)
+            perrex("Wrong count after sweep: %lu\n", (unsigned long)count);
+        printf("    Added: %lu  Returned twice: %lu\n",
+               (unsigned long)added, (unsigned long)again);
+
+        /* Removing everything, in one go */
+        hashtable_iter_init(h, &iter);
+        while (hashtable_iter_next(h, &iter, NULL, NULL))
+            if (hashtable_iter_rem(h, &iter) != hashtable_ret_ok)
+                perrex("Failed to remove a key\n");
+        hashtable_info(h, NULL, &count, NULL, NULL);
+        hashtable_iter_init(h, &iter);
+        if (count != 0 || hashtable_iter_next(h, &iter, NULL, NULL))
+            perrex("Keys left after removing all\n");
+
+        if (hashtable_put(h, "frozen", NULL, NULL) != hashtable_ret_ok ||
+            (fh = hashtable_freeze(h)) == NULL)
+            perrex("Failed to freeze table\n");
+        hashtable_iter_init(fh, &iter);
+        if (!hashtable_iter_next(fh, &iter, NULL, NULL) ||
+            hashtable_iter_rem(fh, &iter) != hashtable_ret_error)
+            perrex("Removed from a frozen table\n");
+        hashtable_destroy(fh);
+        print_info(h);
+        printf("### Sweep ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Iterating while an incremental grow goes on, the gets in between
+    ** moving the buckets
+    */
+    {
+        unsigned char seen[2000] = { 0 };
+        hashtable_iter_t iter;
+        size_t size, nsize, count = 0;
+        const char *key;
+        char buf[32];
+        void *val;
+        int n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 HASHTABLE_INCREMENTAL);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, iterating during a grow\n");
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        for (n = 0 ; n < 2000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "grow-%d", n);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)(n + 1), NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+            hashtable_info(h, &nsize, NULL, NULL, NULL);
+            if (nsize != size && n > 500)
+                break;		/* Just started a grow */
+            size = nsize;
+        }
+        if (n == 2000)
+            perrex("The table didn't grow\n");
+        /* Without changes, each key once */
+        hashtable_iter_init(h, &iter);
+        while (hashtable_iter_next(h, &iter, &key, &val))
+        {
+            uintptr_t v = (uintptr_t)val;
+
+            if (seen[v - 1]++)
+                perrex("Key %s returned twice\n", key);
+            count += 1;
+        }
+        if (count != (size_t)n + 1)
+            perrex("Iterated over %lu keys\n", (unsigned long)count);
+        /* A few gets per key, each moving some buckets */
+        memset(seen, 0, sizeof(seen));
+        hashtable_iter_init(h, &iter);
+        for (count = 0 ; hashtable_iter_next(h, &iter, &key, &val) ; count++)
+        {
+            seen[(uintptr_t)val - 1] = 1;
+            snprintf(buf, sizeof(buf), "grow-%lu", (unsigned long)count % 50);
+            if (hashtable_get(h, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to get key %s\n", buf);
+        }
+        while (n >= 0)
+            if (!seen[n--])
+                perrex("Key grow-%d missed\n", n + 1);
+        print_info(h);
+        printf("### Iterating during a grow ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Running out of memory in the middle of an incremental grow
+    */
+    {
+        hashtable_iter_t iter;
+        size_t size, nsize, count;
+        char buf[32];
+        void *val;
+        int n, k;
+
+        /* A hash that spreads the keys, so that the moved ones often go
+        ** into used buckets
+        */
+        h = hashtable_create_ext(10, 0.5, 0.8, hash_string_wy, NULL,
+                                 HASHTABLE_INCREMENTAL);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, out of memory during a grow\n");
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        for (n = 0 ; n < 4000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "oom-%d", n);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)(n + 1), NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+            hashtable_info(h, &nsize, NULL, NULL, NULL);
+            if (nsize != size && n > 1000)
+                break;		/* Just started a grow */
+            size = nsize;
+        }
+        if (n == 4000)
+            perrex("The table didn't grow\n");
+        /* Every other get fails to allocate, so the buckets that need a
+        ** node for the head can't be moved then, and are left as they were
+        */
+        for (k = 0 ; k < (int)size / 4 + 1 ; k++)
+        {
+            MallocsLeft = (k % 2 == 0 ? 0 : SIZE_MAX);
+            (void)hashtable_get(h, "oom-0", NULL);
+            MallocsLeft = SIZE_MAX;
+            hashtable_iter_init(h, &iter);
+            for (count = 0 ; hashtable_iter_next(h, &iter, NULL, NULL) ;
+                 count++)
+                ;
+            if (count != (size_t)n + 1)
+                perrex("Iterated over %lu keys\n", (unsigned long)count);
+        }
+        if (MallocFailed == 0)
+            perrex("No allocation failed\n");
+        for (k = 0 ; k <= n ; k++)
+        {
+            snprintf(buf, sizeof(buf), "oom-%d", k);
+            if (hashtable_get(h, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)(k + 1))
+                perrex("Lost key %s\n", buf);
+        }
+        printf("    Failed allocations: %lu\n", (unsigned long)MallocFailed);
+        print_info(h);
+        printf("### Out of memory during a grow ok\n");
+        putchar('\n');
+
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Building tables from arrays, in parallel for the chain engine, with
+    ** the last 1000 keys given twice, and borrowed keys with incremental grow
+    */
+    for (i = 0 ; i < NELEM(Engines) ; i++)
+    {
+        unsigned flags = Engines[i] | (i == 2 ? HASHTABLE_BORROW : 0);
+        const size_t nkeys = 100000, n = nkeys + 1000;
+        char (*kbuf)[24] = malloc(nkeys * sizeof(*kbuf));
+        const char **keys = malloc(n * sizeof(char *));
+        void **vals = malloc(n * sizeof(void *));
+        size_t size, count;
+        hashtable_t t;
+        const char *bad;
+        size_t k;
+
+        if (kbuf == NULL || keys == NULL || vals == NULL)
+            perrex("Out of memory\n");
+        printf("### Building a table, engine 0x%x\n", flags);
+        for (k = 0 ; k < n ; k++)
+        {
+            if (k < nkeys)
+                snprintf(kbuf[k], sizeof(kbuf[k]),
+                         (k % 2 ? "built-key-%lu" : "b%lu"), (unsigned long)k);
+            keys[k] = kbuf[k < nkeys ? k : k - 1000];
+            vals[k] = (void *)(uintptr_t)(k + 1);
+        }
+        Destroyed = 0;
+        h = hashtable_build(keys, (void *const *)vals, n, 4, 0.5, 0.8,
+                            NULL, count_dest, flags);
+        if (h == NULL || Destroyed != 1000)
+            perrex("Failed to build table\n");
+        hashtable_info(h, &size, &count, NULL, NULL);
+        if (count != nkeys || count > size / 2)
+            perrex("Wrong size or count after build: %lu, %lu\n",
+                   (unsigned long)size, (unsigned long)count);
+        for (k = 0 ; k < nkeys ; k++)
+        {
+            void *val;
+
+            if (hashtable_get(h, kbuf[k], &val) != hashtable_ret_ok ||
+                (uintptr_t)val != (k < nkeys - 1000 ? k + 1 : k + 1001))
+                perrex("Failed to get key %s\n", kbuf[k]);
+        }
+        print_info(h);
+        hashtable_destroy(h);
+        if (Destroyed != n)
+            perrex("Wrong number of values destroyed: %lu\n",
+                   (unsigned long)Destroyed);
+
+        /* A bad key after the duplicates: no values destroyed. And a table
+        ** too small for threads.
+        */
+        bad = keys[n - 1];
+        keys[n - 1] = "";
+        Destroyed = 0;
+        errno = 0;
+        if (hashtable_build(keys, (void *const *)vals, n, 4, 0, 0,
+                            NULL, count_dest, flags) != NULL ||
+            errno != EINVAL || Destroyed != 0)
+            perrex("Built a table with an empty key\n");
+        keys[n - 1] = bad;
+        h = hashtable_build(keys, NULL, 10, 0, 0, 0, NULL, NULL, flags);
+        if (h == NULL || hashtable_get(h, "b8", &vals[0]) != hashtable_ret_ok ||
+            vals[0] != NULL)
+            perrex("Failed to build a small table\n");
+        hashtable_destroy(h);
+        h = hashtable_build(keys, NULL, 0, 0, 0, 0, NULL, NULL, flags);
+        t = hashtable_create_ext(0, 0, 0, NULL, NULL, flags);
+        if (h == NULL || t == NULL)
+            perrex("Failed to build an empty table\n");
+        hashtable_info(h, &size, NULL, NULL, NULL);
+        hashtable_info(t, &count, NULL, NULL, NULL);
+        if (size != count)
+            perrex("Empty table built with size %lu, not %lu\n",
+                   (unsigned long)size, (unsigned long)count);
+        hashtable_destroy(t);
+        hashtable_destroy(h);
+        printf("### Build ok\n");
+        putchar('\n');
+
+        free(vals);
+        free(keys);
+        free(kbuf);
+    }
+
+    /*
+    ** Integer keys
+    */
+    {
+        hashtable64_t ih = hashtable64_create(0, 0, free);
+        hashtable64_iter_t iter;
+        size_t n, isize, icount, icmax, seen = 0;
+        uint64_t key, sum = 0;
+        void *val;
+
+        if (ih == NULL)
+            perrex("Failed to create integer table\n");
+        printf("### New integer table\n");
+        /* Sequential keys, keys that differ only in the high bits, and
+        ** the extremes
+        */
+        for (n = 0 ; n < 60000 ; n++)
+        {
+            uint64_t *vp = malloc(sizeof(uint64_t));
+
+            key = (n < 30000 ? n + 1 : (uint64_t)(n - 29999) << 32);
+            if (vp == NULL)
+                perrex("Out of memory\n");
+            *vp = key;
+            if (hashtable64_put(ih, key, vp, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %lu\n", (unsigned long)key);
+        }
+        if (hashtable64_put(ih, 0, NULL, NULL) != hashtable_ret_ok ||
+            hashtable64_put(ih, UINT64_MAX, NULL, NULL) != hashtable_ret_ok ||
+            hashtable64_put(ih, 0, &sum, &val) != hashtable_ret_replaced ||
+            val != NULL ||
+            hashtable64_get(ih, 0, &val) != hashtable_ret_ok || val != &sum ||
+            hashtable64_rem(ih, 0, &val) != hashtable_ret_ok ||
+            hashtable64_get(ih, 0, NULL) != hashtable_ret_not_found ||
+            hashtable64_rem(ih, UINT64_MAX, NULL) != hashtable_ret_ok)
+            perrex("Wrong handling of the key 0\n");
+        /* Remove every third, which shifts keys back all over */
+        for (n = 0 ; n < 60000 ; n += 3)
+        {
+            key = (n < 30000 ? n + 1 : (uint64_t)(n - 29999) << 32);
+            if (hashtable64_rem(ih, key, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %lu\n", (unsigned long)key);
+        }
+        for (n = 0 ; n < 60000 ; n++)
+        {
+            hashtable_ret_t ret;
+
+            key = (n < 30000 ? n + 1 : (uint64_t)(n - 29999) << 32);
+            ret = hashtable64_get(ih, key, &val);
+            if (n % 3 == 0 ? ret != hashtable_ret_not_found :
+                ret != hashtable_ret_ok || *(uint64_t *)val != key)
+                perrex("Wrong lookup of key %lu\n", (unsigned long)key);
+        }
+        if (hashtable64_put(ih, 0, NULL, NULL) != hashtable_ret_ok)
+            perrex("Failed to put key 0\n");
+        hashtable64_iter_init(ih, &iter);
+        while (hashtable64_iter_next(ih, &iter, &key, &val))
+        {
+            if (key == 0 ? val != NULL : *(uint64_t *)val != key)
+                perrex("Wrong value for key %lu in iteration\n",
+                       (unsigned long)key);
+            sum += key;
+            seen += 1;
+        }
+        hashtable64_info(ih, &isize, &icount, &icmax);
+        if (seen != 40001 || icount != 40001)
+            perrex("Wrong count in integer table: %lu\n",
+                   (unsigned long)icount);
+        printf("    Size: %lu  Count: %lu  Probe max.: %lu\n",
+               (unsigned long)isize, (unsigned long)icount,
+               (unsigned long)icmax);
+        hashtable64_destroy(ih);
+        printf("### Integer table ok\n");
+        putchar('\n');
+    }
+
+    /*
+    ** Hashing a key once, for several tables
+    */
+    {
+        hashtable_t t[4];
+        char buf[32];
+        void *val, **slot;
+        size_t left;
+        int n;
+
+        printf("### New tables, precomputed hash values\n");
+        t[0] = hashtable_create_ext(0, 0, 0, hash_string_wy, NULL,
+                                    HASHTABLE_CHAIN);
+        t[1] = hashtable_create_ext(0, 0, 0, hash_string_wy, NULL,
+                                    HASHTABLE_SWISS);
+        if (t[0] == NULL || t[1] == NULL)
+            perrex("Failed to create hash table\n");
+        for (n = 0 ; n < 2000 ; n++)
+        {
+            hashval_t hv;
+
+            snprintf(buf, sizeof(buf), "shared-%d", n);
+            hv = hashtable_hash(t[0], buf);
+            if (hv != hash_string_wy(buf) || hv != hashtable_hash(t[1], buf))
+                perrex("Wrong hash value for %s\n", buf);
+            for (i = 0 ; i < 2 ; i++)
+                if (hashtable_put_hash(t[i], buf, hv, (void *)(uintptr_t)n,
+                                       NULL) != hashtable_ret_ok)
+                    perrex("Failed to put key %s\n", buf);
+        }
+        t[2] = hashtable_freeze(t[0]);
+        t[3] = hashtable_freeze_mph(t[1]);
+        if (t[2] == NULL || t[3] == NULL)
+            perrex("Failed to freeze table\n");
+        for (n = 0 ; n < 2000 ; n++)
+        {
+            hashval_t hv;
+
+            snprintf(buf, sizeof(buf), "shared-%d", n);
+            hv = hashtable_hash(t[0], buf);
+            for (i = 0 ; i < 4 ; i++)
+                if (hashtable_get_hash(t[i], buf, hv, &val) !=
+                    hashtable_ret_ok || (uintptr_t)val != (uintptr_t)n)
+                    perrex("Failed to get key %s from table %d\n", buf, i);
+            if (hashtable_get_hash(t[0], buf, hv + 1, NULL) !=
+                hashtable_ret_not_found)
+                perrex("Found key %s with the wrong hash value\n", buf);
+        }
+        hashtable_destroy(t[2]);
+        hashtable_destroy(t[3]);
+        for (n = 0 ; n < 2000 ; n++)
+        {
+            hashval_t hv;
+
+            snprintf(buf, sizeof(buf), "shared-%d", n);
+            hv = hashtable_hash(t[0], buf);
+            if (hashtable_upsert_hash(t[0], buf, hv, &slot, NULL) !=
+                hashtable_ret_ok || (uintptr_t)*slot != (uintptr_t)n)
+                perrex("Failed to upsert key %s\n", buf);
+            if (hashtable_rem_hash(t[1], buf, hv, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        hashtable_info(t[1], NULL, &left, NULL, NULL);
+        if (left != 0)
+            perrex("Keys left after removing\n");
+        hashtable_destroy(t[0]);
+        hashtable_destroy(t[1]);
+        printf("### Precomputed hash values ok\n");
+        putchar('\n');
+    }
+
+    /*
+    ** Chain length histograms, with both engines and frozen tables
+    */
+    for (i = 0 ; i < 4 ; i++)
+    {
+        hashtable_t fh = NULL;
+        size_t hist[4], size, count, cmax, icmax, sum = 0, keys = 0;
+        char buf[32];
+        int n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 (i == 1 ? HASHTABLE_SWISS : HASHTABLE_CHAIN));
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, histogram, %s\n",
+               (i == 0 ? "CHAIN engine" : i == 1 ? "SWISS engine" :
+                i == 2 ? "frozen" : "minimal perfect hash"));
+        for (n = 0 ; n < 3000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "hist-%d", n);
+            if (hashtable_put(h, buf, NULL, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        if (i >= 2)
+        {
+            fh = (i == 2 ? hashtable_freeze(h) : hashtable_freeze_mph(h));
+            if (fh == NULL)
+                perrex("Failed to freeze table\n");
+        }
+        cmax = hashtable_histogram(fh ? fh : h, hist, 4);
+        hashtable_info(fh ? fh : h, &size, &count, NULL, &icmax);
+        printf("    0: %lu  1: %lu  2: %lu  3+: %lu  Chain max.: %lu\n",
+               (unsigned long)hist[0], (unsigned long)hist[1],
+               (unsigned long)hist[2], (unsigned long)hist[3],
+               (unsigned long)cmax);
+        for (n = 0 ; n < 4 ; n++)
+        {
+            sum += hist[n];
+            keys += n * hist[n];
+        }
+        if (cmax != icmax ||
+            (i == 1 ? sum != count || hist[0] != 0 : sum != size) ||
+            (cmax < 4 && i != 1 && keys != count))
+            perrex("Wrong histogram\n");
+        printf("### Histogram ok\n");
+        putchar('\n');
+
+        if (fh)
+            hashtable_destroy(fh);
+        hashtable_destroy(h);
+    }
+
+#if !defined(HASHTABLE_STATS) || HASHTABLE_STATS
+    /*
+    ** Operation counters, with both engines and a frozen table
+    */
+    for (i = 0 ; i < 3 ; i++)
+    {
+        hashtable_t fh = NULL;
+        hashtable_stats_t st;
+        char buf[32];
+        int n;
+
+        h = hashtable_create_ext(10, 0.5, 0.8, NULL, NULL,
+                                 (i == 1 ? HASHTABLE_SWISS : HASHTABLE_CHAIN));
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### New table, counters, %s\n",
+               (i == 0 ? "CHAIN engine" : i == 1 ? "SWISS engine" : "frozen"));
+        for (n = 0 ; n < 1000 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "counted-key-%d", n);
+            if (hashtable_put(h, buf, NULL, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        hashtable_stats(h, &st);
+        if (st.resizes == 0 || st.allocs < 1000 || st.searches != 1000 ||
+            st.hits != 0 || st.misses != 0)
+            perrex("Wrong counters after puts\n");
+        if (i == 2)
+        {
+            fh = hashtable_freeze(h);
+            if (fh == NULL)
+                perrex("Failed to freeze table\n");
+        }
+        hashtable_stats_reset(i == 2 ? fh : h);
+        for (n = 0 ; n < 1500 ; n++)
+        {
+            snprintf(buf, sizeof(buf), "counted-key-%d", n);
+            (void)hashtable_get(i == 2 ? fh : h, buf, NULL);
+        }
+        hashtable_stats(i == 2 ? fh : h, &st);
+        printf("    Size: %lu  Count: %lu  Probes: %lu  Compares: %lu\n",
+               (unsigned long)st.size, (unsigned long)st.count,
+               (unsigned long)st.probes, (unsigned long)st.compares);
+        if (st.count != 1000 || st.hits != 1000 || st.misses != 500 ||
+            st.searches != 1500 || st.probes < st.searches ||
+            st.compares < 1000 || st.resizes != 0 || st.allocs != 0)
+            perrex("Wrong counters after gets\n");
+        printf("### Counters ok\n");
+        putchar('\n');
+
+        if (fh)
+            hashtable_destroy(fh);
+        hashtable_destroy(h);
+    }
+#endif
+
+    /*
+    ** The concurrent table, with writers and readers at the same time
+    */
+    {
+        chashtable_t ch = chashtable_create(0, 0, NULL, NULL);
+        pthread_t tids[2 * CONC_THREADS];
+        conc_arg_t args[2 * CONC_THREADS];
+        char buf[32];
+        void *val;
+
+        if (ch == NULL)
+            perrex("Failed to create concurrent hash table\n");
+        printf("### New concurrent table, %d writers and %d readers\n",
+               CONC_THREADS, CONC_THREADS);
+        for (i = 0 ; i < 2 * CONC_THREADS ; i++)
+        {
+            args[i].h = ch;
+            args[i].id = i % CONC_THREADS;
+            args[i].fail = false;
+            if (pthread_create(tids + i, NULL,
+                               (i < CONC_THREADS ? conc_writer : conc_reader),
+                               args + i) != 0)
+                perrex("Failed to create thread\n");
+        }
+        for (i = 0 ; i < 2 * CONC_THREADS ; i++)
+        {
+            pthread_join(tids[i], NULL);
+            if (args[i].fail)
+                perrex("Concurrent %s %d failed\n",
+                       (i < CONC_THREADS ? "writer" : "reader"), i);
+        }
+        if (chashtable_count(ch) != CONC_THREADS * CONC_KEYS)
+            perrex("Wrong count in concurrent table: %lu\n",
+                   (unsigned long)chashtable_count(ch));
+        for (i = 0 ; i < CONC_THREADS * CONC_KEYS ; i++)
+        {
+            snprintf(buf, sizeof(buf), "w%d-%d",
+                     i / CONC_KEYS, i % CONC_KEYS);
+            if (chashtable_get(ch, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)(i % CONC_KEYS + 1))
+                perrex("Failed to get key %s\n", buf);
+        }
+        chashtable_destroy(ch);
+
+        /* Replaced and removed values are destroyed, sooner or later */
+        ch = chashtable_create(0, 0, hash_string_wy, free);
+        if (ch == NULL)
+            perrex("Failed to create concurrent hash table\n");
+        for (i = 0 ; i < 3000 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (chashtable_put(ch, buf, strdup(buf), NULL) != hashtable_ret_ok ||
+                chashtable_put(ch, buf, strdup(buf), NULL) !=
+                hashtable_ret_replaced)
+                perrex("Failed to put key %s\n", buf);
+        }
+        for (i = 0 ; i < 3000 ; i += 3)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (chashtable_rem(ch, buf, NULL) != hashtable_ret_ok)
+                perrex("Failed to remove key %s\n", buf);
+        }
+        if (chashtable_get(ch, "key-1", &val) != hashtable_ret_ok ||
+            strcmp(val, "key-1") != 0 ||
+            chashtable_get(ch, "key-3", NULL) != hashtable_ret_not_found)
+            perrex("Wrong contents in concurrent table\n");
+        chashtable_destroy(ch);
+        printf("### Concurrent table ok\n");
+        putchar('\n');
+    }
+
+    /*
+    ** Frozen tables
+    */
+    {
+        static const char bkey[] = { 'n', 'u', 'l', '\0', 'k', 'e', 'y' };
+        unsigned engines[] = { HASHTABLE_CHAIN,
+                               HASHTABLE_CHAIN | HASHTABLE_INCREMENTAL,
+                               HASHTABLE_SWISS };
+        const char *keys[] = { "first", "not-a-key", "a-rather-long-key-42" };
+        void *vals[3];
+        hashtable_ret_t rets[3];
+
+        for (unsigned e = 0 ; e < sizeof(engines) / sizeof(engines[0]) ; e++)
+        {
+            hashtable_t fh, fh2;
+            size_t count, slots, cmax, n = 0;
+            const void *key;
+            size_t len;
+            void *val;
+            char buf[32];
+
+            h = hashtable_create_ext(10, 0, 0, NULL, NULL, engines[e]);
+            if (h == NULL)
+                perrex("Failed to create hash table\n");
+            printf("### New frozen table, from engine 0x%x\n", engines[e]);
+            for (i = 0 ; i < 3000 ; i++)
+            {
+                snprintf(buf, sizeof(buf), "%s-%d",
+                         (i < 1000 ? "a-rather-long-key" : "k"), i);
+                if (hashtable_put(h, buf, (void *)(uintptr_t)(i + 1), NULL) !=
+                    hashtable_ret_ok)
+                    perrex("Failed to put key %s\n", buf);
+            }
+            for (i = 0 ; Words[i] ; i++)
+                if (hashtable_put(h, Words[i], Words[i], NULL) != hashtable_ret_ok)
+                    perrex("Failed to put key %s\n", Words[i]);
+            if (hashtable_put_n(h, bkey, sizeof(bkey), (void *)bkey, NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put binary key\n");
+            fh = hashtable_freeze(h);
+            if (fh == NULL)
+                perrex("Failed to freeze table\n");
+            fh2 = hashtable_freeze(fh);
+            if (fh2 == NULL)
+                perrex("Failed to freeze frozen table\n");
+            hashtable_destroy(fh);
+            fh = fh2;
+            print_info(fh);
+            hashtable_info(fh, NULL, &count, &slots, &cmax);
+            if (count != 3000 + 10 + 1 || slots > count || cmax == 0)
+                perrex("Wrong info for frozen table\n");
+            for (i = 0 ; i < 3000 ; i++)
+            {
+                snprintf(buf, sizeof(buf), "%s-%d",
+                         (i < 1000 ? "a-rather-long-key" : "k"), i);
+                if (hashtable_get(fh, buf, &val) != hashtable_ret_ok ||
+                    val != (void *)(uintptr_t)(i + 1))
+                    perrex("Failed to get key %s\n", buf);
+            }
+            for (i = 0 ; Words[i] ; i++)
+                if (hashtable_get(fh, Words[i], &val) != hashtable_ret_ok ||
+                    val != Words[i])
+                    perrex("Failed to get key %s\n", Words[i]);
+            if (hashtable_get_n(fh, bkey, sizeof(bkey), &val) !=
+                hashtable_ret_ok || val != bkey ||
+                hashtable_get_n(fh, bkey, 3, NULL) != hashtable_ret_not_found)
+                perrex("Failed to get binary key\n");
+            if (hashtable_get(fh, "not-a-key", NULL) != hashtable_ret_not_found)
+                perrex("Found not-a-key in frozen table\n");
+            if (hashtable_get_many(fh, keys, 3, vals, rets) != 2 ||
+                rets[1] != hashtable_ret_not_found ||
+                vals[0] != Words[0] || vals[2] != (void *)(uintptr_t)43)
+                perrex("Failed to get many keys from frozen table\n");
+            if (hashtable_put(fh, "new", NULL, NULL) != hashtable_ret_error ||
+                hashtable_rem(fh, "first", NULL) != hashtable_ret_error)
+                perrex("Changed a frozen table\n");
+            hashtable_iter_init(fh, &iter);
+            while (hashtable_iter_next_n(fh, &iter, &key, &len, &val))
+            {
+                if (hashtable_get_n(h, key, len, &vals[0]) != hashtable_ret_ok ||
+                    vals[0] != val)
+                    perrex("Iterated over wrong key in frozen table\n");
+                n += 1;
+            }
+            if (n != count)
+                perrex("Iterated over %lu keys, expected %lu\n",
+                       (unsigned long)n, (unsigned long)count);
+            hashtable_destroy(fh);
+            hashtable_destroy(h);
+            printf("### Frozen table ok\n");
+            putchar('\n');
+        }
+    }
+
+    /*
+    ** Minimal perfect hash tables
+    */
+    for (int n = 0 ; n <= 5000 ; n += (n < 20 ? 1 : 2490))
+    {
+        hashtable_t mh, oh, fh;
+        size_t size, count, slots, cmax, k = 0;
+        const char *key;
+        char buf[32];
+        void *val;
+
+        /* hash_string_fast gives the same value for "ab" and "bY" */
+        h = hashtable_create(0, 0, 0, hash_string_fast, NULL);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        for (i = 0 ; i < n ; i++)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (i & 1 ? "a-rather-long-key" : "k"), i);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)(i + 1), NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        if (n > 0 && (hashtable_put(h, "ab", "ab", NULL) != hashtable_ret_ok ||
+                      hashtable_put(h, "bY", "bY", NULL) != hashtable_ret_ok))
+            perrex("Failed to put colliding keys\n");
+        if (n > 0)
+        {
+            MallocsLeft = 1;	/* Out of memory while placing the keys */
+            errno = 0;
+            mh = hashtable_freeze_mph(h);
+            MallocsLeft = SIZE_MAX;
+            if (mh != NULL || errno != ENOMEM)
+                perrex("Built minimal perfect hash without memory: %s\n",
+                       strerror(errno));
+        }
+        mh = hashtable_freeze_mph(h);
+        if (mh == NULL)
+            perrex("Failed to build minimal perfect hash for %d keys\n", n);
+        hashtable_info(mh, &size, &count, &slots, &cmax);
+        if (count != (size_t)n + (n > 0 ? 2 : 0) ||
+            (n > 0 && size != count) || slots != count || cmax > 1)
+            perrex("Wrong info for minimal perfect hash table\n");
+        oh = save_open(mh, 0, NULL, NULL);	/* Stays a minimal perfect hash */
+        if (oh == NULL)
+            perrex("Failed to open saved table: %s\n", strerror(errno));
+        fh = hashtable_freeze(oh);	/* And back to an ordinary one */
+        if (fh == NULL)
+            perrex("Failed to freeze table\n");
+        for (i = 0 ; i < n ; i++)
+        {
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (i & 1 ? "a-rather-long-key" : "k"), i);
+            if (hashtable_get(mh, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)(i + 1) ||
+                hashtable_get(oh, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)(i + 1) ||
+                hashtable_get(fh, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)(i + 1))
+                perrex("Failed to get key %s\n", buf);
+        }
+        if (n > 0 &&
+            (hashtable_get(mh, "ab", &val) != hashtable_ret_ok ||
+             strcmp(val, "ab") != 0 ||
+             hashtable_get_n(oh, "bY", 2, &val) != hashtable_ret_ok ||
+             strcmp(val, "bY") != 0))
+            perrex("Failed to get colliding keys\n");
+        if (hashtable_get(mh, "not-a-key", NULL) != hashtable_ret_not_found ||
+            hashtable_get(oh, "not-a-key", NULL) != hashtable_ret_not_found ||
+            hashtable_get(fh, "k-", NULL) != hashtable_ret_not_found)
+            perrex("Found not-a-key in minimal perfect hash table\n");
+        hashtable_iter_init(mh, &iter);
+        while (hashtable_iter_next(mh, &iter, &key, &val))
+        {
+            void *v;
+
+            if (hashtable_get(h, key, &v) != hashtable_ret_ok || v != val)
+                perrex("Iterated over wrong key %s\n", key);
+            k += 1;
+        }
+        if (k != count)
+            perrex("Iterated over %lu keys, expected %lu\n",
+                   (unsigned long)k, (unsigned long)count);
+        if (n == 5000)
+        {
+            printf("### Minimal perfect hash table, %d keys\n", n);
+            print_info(mh);
+            printf("### Minimal perfect hash ok\n");
+            putchar('\n');
+        }
+        hashtable_destroy(fh);
+        hashtable_destroy(oh);
+        hashtable_destroy(mh);
+        hashtable_destroy(h);
+    }
+
+    /*
+    ** Saving tables and opening them with mmap
+    */
+    {
+        struct blob_s { uint32_t n; char tag[16]; } *blobs;
+        hashtable_t oh, oh2;
+        char buf[32];
+        void *val;
+        int fd;
+
+        h = hashtable_create(0, 0, 0, hash_string_wy, NULL);
+        blobs = malloc(2000 * sizeof(struct blob_s));
+        if (h == NULL || blobs == NULL)
+            perrex("Failed to create hash table\n");
+        printf("### Saving and opening tables\n");
+        for (i = 0 ; i < 2000 ; i++)
+        {
+            blobs[i].n = i;
+            snprintf(blobs[i].tag, sizeof(blobs[i].tag), "t%d", i);
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (i & 1 ? "a-rather-long-key" : "k"), i);
+            if (hashtable_put(h, buf, blobs + i, NULL) != hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        if (hashtable_put(h, "null", NULL, NULL) != hashtable_ret_ok)
+            perrex("Failed to put key null\n");
+        oh = save_open(h, sizeof(struct blob_s), NULL, NULL);
+        if (oh == NULL)
+            perrex("Failed to open saved table: %s\n", strerror(errno));
+        /* A saved mapped table is written as it is */
+        oh2 = save_open(oh, sizeof(struct blob_s), hash_string_wy, NULL);
+        if (oh2 == NULL)
+            perrex("Failed to open saved table: %s\n", strerror(errno));
+        hashtable_destroy(oh);
+        print_info(oh2);
+        for (i = 0 ; i < 2000 ; i++)
+        {
+            struct blob_s *bp;
+
+            snprintf(buf, sizeof(buf), "%s-%d",
+                     (i & 1 ? "a-rather-long-key" : "k"), i);
+            if (hashtable_get(oh2, buf, &val) != hashtable_ret_ok)
+                perrex("Failed to get key %s\n", buf);
+            bp = val;
+            if (bp == blobs + i || bp->n != (uint32_t)i ||
+                strcmp(bp->tag, blobs[i].tag) != 0)
+                perrex("Wrong value for key %s\n", buf);
+        }
+        if (hashtable_get(oh2, "null", &val) != hashtable_ret_ok ||
+            ((struct blob_s *)val)->n != 0 ||
+            hashtable_get(oh2, "not-a-key", NULL) != hashtable_ret_not_found)
+            perrex("Wrong contents in saved table\n");
+        hashtable_destroy(oh2);
+        hashtable_destroy(h);
+        free(blobs);
+
+        /* Integer values, and a custom hash function */
+        h = hashtable_create(0, 0, 0, custom_hash, NULL);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        for (i = 0 ; i < 500 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)i, NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        if (save_open(h, 0, NULL, NULL) != NULL || errno != EINVAL)
+            perrex("Opened a table with a custom hash function without it\n");
+        if (save_open(h, 0, hash_string_wy, NULL) != NULL || errno != EINVAL)
+            perrex("Opened a table with the wrong hash function\n");
+        oh = save_open(h, 0, custom_hash, NULL);
+        if (oh == NULL)
+            perrex("Failed to open saved table: %s\n", strerror(errno));
+        for (i = 0 ; i < 500 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (hashtable_get(oh, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)i)
+                perrex("Failed to get key %s\n", buf);
+        }
+        hashtable_destroy(oh);
+        hashtable_destroy(h);
+
+        /* And a custom hash function for binary keys */
+        h = hashtable_create_n(0, 0, 0, custom_hash_n, NULL, HASHTABLE_CHAIN);
+        if (h == NULL)
+            perrex("Failed to create hash table\n");
+        for (i = 0 ; i < 500 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (hashtable_put(h, buf, (void *)(uintptr_t)i, NULL) !=
+                hashtable_ret_ok)
+                perrex("Failed to put key %s\n", buf);
+        }
+        if (save_open(h, 0, custom_hash, NULL) != NULL || errno != EINVAL ||
+            save_open(h, 0, NULL, hash_mem_wy) != NULL || errno != EINVAL)
+            perrex("Opened a table with the wrong hash function\n");
+        oh = save_open(h, 0, NULL, custom_hash_n);
+        if (oh == NULL)
+            perrex("Failed to open saved table: %s\n", strerror(errno));
+        for (i = 0 ; i < 500 ; i++)
+        {
+            snprintf(buf, sizeof(buf), "key-%d", i);
+            if (hashtable_get(oh, buf, &val) != hashtable_ret_ok ||
+                val != (void *)(uintptr_t)i)
+                perrex("Failed to get key %s\n", buf);
+        }
+        hashtable_destroy(oh);
+        hashtable_destroy(h);
+
+        /* Not a table */
+        {
+            char path[] = "/tmp/htabunitXXXXXX";
+
+            fd = mkstemp(path);
+            if (fd < 0 || write(fd, Words[0], strlen(Words[0])) < 0)
+                perrex("Failed to write temporary file\n");
+            close(fd);
+            if (hashtable_open_mmap(path, NULL) != NULL || errno != EINVAL)
+                perrex("Opened a file that isn't a table\n");
+            unlink(path);
+        }
+        printf("### Saving and opening ok\n");
+        putchar('\n');
+    }
+
+    /*
+    ** Publishing frozen snapshots, while readers use them
+    */
+    {
+        snapshot_t s = snapshot_create(snap_version(1));
+        pthread_t tids[CONC_THREADS];
+        void *res;
+
+        if (s == NULL)
+            perrex("Failed to create snapshot\n");
+        printf("### New snapshot, %d readers\n", CONC_THREADS);
+        for (i = 0 ; i < CONC_THREADS ; i++)
+            if (pthread_create(tids + i, NULL, snap_reader, s) != 0)
+                perrex("Failed to create thread\n");
+        for (uintptr_t v = 2 ; v <= SNAP_VERSIONS ; v++)
+            snapshot_publish(s, snap_version(v));
+        for (i = 0 ; i < CONC_THREADS ; i++)
+        {
+            pthread_join(tids[i], &res);
+            if (res)
+                perrex("Snapshot reader %d failed: %s\n", i, (char *)res);
+        }
+        snapshot_destroy(s);
+        printf("### Snapshot ok\n");
+        putchar('\n');
+    }
+
     printf("Ok\n");
 
     exit(0);
@@ -0,0 +1,75 @@
+/* snapshot.c
+**
+** Publication of frozen tables, see snapshot.h.
+*/
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "snapshot.h"
+#include "epoch.h"
+
+struct snapshot_s
+{
+  _Atomic(hashtable_t) current;
+  epoch_t epoch;
+};
+
+snapshot_t
+snapshot_create(hashtable_t h)
+{
+  snapshot_t s = malloc(sizeof(struct snapshot_s));
+
+  if (s)
+  {
+    s->epoch = epoch_create();
+    if (s->epoch == NULL)
+    {
+      free(s);
+      return NULL;
+    }
+    atomic_init(&s->current, h);
+  }
+  return s;
+}
+
+void
+snapshot_destroy(snapshot_t s)
+{
+  hashtable_t h = atomic_load(&s->current);
+
+  epoch_destroy(s->epoch);
+  if (h)
+    hashtable_destroy(h);
+  free(s);
+}
+
+hashtable_t
+snapshot_enter(snapshot_t s, unsigned *ticketp)
+{
+  *ticketp = epoch_enter(s->epoch);
+  return atomic_load_explicit(&s->current, memory_order_acquire);
+}
+
+void
+snapshot_exit(snapshot_t s, unsigned ticket)
+{
+  epoch_exit(s->epoch, ticket);
+}
+
+static void
+destroy_table(void *p)
+{
+  hashtable_destroy(p);
+}
+
+void
+snapshot_publish(snapshot_t s, hashtable_t h)
+{
+  hashtable_t old = atomic_exchange_explicit(&s->current, h,
+                                             memory_order_acq_rel);
+
+  if (old)
+    epoch_retire(s->epoch, old, destroy_table);
+  (void)epoch_reclaim(s->epoch, 0);
+}
@@ -0,0 +1,59 @@
+/* snapshot.h
+**
+** Publication of frozen tables (see hashtable_freeze()), for tables that
+** are read much more often than they change.
+**
+** The writer builds a new version of the table in an ordinary hashtable_t,
+** freezes it, and publishes the frozen copy, which replaces the previous
+** one at once. Readers get the current version without locking, and the
+** old version is destroyed when the last reader that might use it is done,
+** RCU style (see epoch.h).
+**
+**   reader:
+**     unsigned ticket;
+**     hashtable_t t = snapshot_enter(s, &ticket);
+**     ... hashtable_get(t, ...), hashtable_iter_next(t, ...) ...
+**     snapshot_exit(s, ticket);
+**
+**   writer:
+**     snapshot_publish(s, hashtable_freeze(h));
+**
+** A reader must not keep the table, or pointers to its keys, after
+** snapshot_exit().
+*/
+
+#pragma once
+
+#include "hashtable.h"
+
+typedef struct snapshot_s *snapshot_t;
+
+/* Creates a snapshot, with 'h' (which may be NULL) as the first version.
+** Returns NULL if out of memory.
+*/
+extern snapshot_t
+snapshot_create(hashtable_t h);
+
+/* Destroys the snapshot, and its current table. There must be no readers
+** left.
+*/
+extern void
+snapshot_destroy(snapshot_t s);
+
+/* Returns the current table, which stays valid until snapshot_exit() is
+** called with the ticket set in '*ticketp'. Never blocks.
+*/
+extern hashtable_t
+snapshot_enter(snapshot_t s, unsigned *ticketp);
+
+extern void
+snapshot_exit(snapshot_t s, unsigned ticket);
+
+/* Replaces the current table with 'h'. The previous one is destroyed when
+** all readers that might use it have exited. This waits for them, so
+** it must not be called between snapshot_enter() and snapshot_exit() in
+** the same thread. Publishers are serialized, so several threads may call
+** it.
+*/
+extern void
+snapshot_publish(snapshot_t s, hashtable_t h);